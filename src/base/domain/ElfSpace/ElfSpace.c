@@ -76,10 +76,20 @@ typedef union {
 #define CR_TMP2		 coyotos_ElfSpace_APP_TMP2
 #define CR_TMP3		 coyotos_ElfSpace_APP_TMP3
 
+#define CR_ZEROPAGE	 coyotos_ElfSpace_APP_ZEROPAGE
+#define CR_ZEROCAPPAGE	 coyotos_ElfSpace_APP_ZEROCAPPAGE
+
 typedef struct IDL_SERVER_Environment {
   bool isEPH;
 } ISE;
 
+struct {
+  uint32_t faults;
+  uint32_t pagesAllocated;
+  uint32_t zeroMapped;
+  uint32_t zeroUpgrades;
+} stats;
+
 IDL_SERVER_HANDLER_PREDECL uint64_t
 HANDLE_coyotos_Cap_destroy(ISE *ise)
 {
@@ -157,50 +167,62 @@ round_up(uint64_t a, uint64_t b)
   return ((a + b - 1)/b) * b;
 }
 
-/// @bug current limitations:
-///   @li  doesn't fill in read-only faults with a fixed zero page
+/// Make the page at @p addr accessible, copying or allocating as
+/// needed.
+///
+/// @p forWrite is set if the fault was a write.  A read of a slot
+/// that holds nothing maps the shared zero Page (or CapPage, if @p
+/// wantCap), which a later write fault replaces with a private one.
 bool
-process_fault(uint64_t addr, bool wantCap)
+process_fault(uint64_t addr, bool wantCap, bool forWrite)
 {
   caploc_t cap = CR_TMP1;
   caploc_t next = CR_TMP2;
   caploc_t spare = CR_TMP3;
-  caploc_t next_spare = CR_TMP1;
 
   /*
-   * We will loop as we go down;  the capability registers used looks like:
-   *      cap        next     spare    next_spare
-   *  1.  TMP1       TMP2     TMP3     TMP1
-   *  2.  TMP2       TMP3     TMP1     TMP2
-   *  3.  TMP3       TMP1     TMP2     TMP3
-   *  4.  TMP1       TMP2     TMP3     TMP1
-   *  ... etc ...
+   * Each pass walks the space from the top in a single kernel call.
+   * The walk stops at the first slot we may need to change, leaving
+   * the GPT holding it in cap, and the capability in the slot in
+   * next.  Once we have changed it, we walk again.
    */
 
-  coyotos_Memory_l2value_t l2v = 0;
+  coyotos_AddressSpace_walkPath path;
   coyotos_Memory_l2value_t unusedl2v = 0;
-  coyotos_Memory_l2value_t lastl2v = COYOTOS_SOFTADDR_BITS;
 
   for (;;) {
-    if (!coyotos_GPT_getl2v(cap, &l2v))
+    uint32_t count = 0;
+
+    if (!coyotos_AddressSpace_walk(CR_SPACEGPT, addr,
+				   coyotos_Memory_restrictions_readOnly |
+				   coyotos_Memory_restrictions_weak,
+				   &count, path, cap, next))
       return false;
 
-    uintptr_t slot = highbits_shifted(addr, l2v);
-    uintptr_t remaddr = lowbits(addr, l2v);
+    // Find the offset remaining within the last GPT.  To prevent
+    // infinite recursion, we require that address spaces continually
+    // reduce l2v.
+    uint64_t remaddr = addr;
+    coyotos_Memory_l2value_t lastl2v = COYOTOS_SOFTADDR_BITS;
 
-    /// @bug at some point, we need to deal with too-low l2v values.
-    /// For now, we'll just fail.
-    if (!coyotos_AddressSpace_getSlot(cap, slot, next))
-      return false;
+    for (size_t i = 0; i < count; i++) {
+      if (path[i].l2v >= lastl2v)
+	return false;
+      lastl2v = path[i].l2v;
+      remaddr = lowbits(remaddr, lastl2v);
+    }
 
-    guard_t theGuard;
+    coyotos_Memory_l2value_t l2v = path[count - 1].l2v;
+    uintptr_t slot = path[count - 1].slot;
+    coyotos_Cap_AllegedType type = path[count - 1].type;
+    guard_t theGuard = path[count - 1].guard;
     bool invalidCap = false;
 
     // for invalid capabilities, treat them as if they had no guard.
     //
     // This simplifies the code below, at the expense of adding
     // unnecessary GPTs along the way, if remaddr is non-zero.
-    if (!coyotos_Memory_getGuard(next, &theGuard)) {
+    if (type == IKT_coyotos_Null || type == IKT_coyotos_Cap) {
       theGuard = make_guard(0, COYOTOS_PAGE_ADDR_BITS);
       invalidCap = true;
     }
@@ -265,20 +287,39 @@ process_fault(uint64_t addr, bool wantCap)
 				      spare, CR_NULL, CR_NULL);
 	return false;
       }
-      continue;  // re-execute loop with newly inserted GPT
+      continue;  // re-walk with newly inserted GPT
     }
     
     coyotos_Memory_restrictions restr = 0;
 
     if (invalidCap)
       restr = coyotos_Memory_restrictions_readOnly;
-    else if (!coyotos_Memory_getRestrictions(next, &restr)) {
-      return false;  // shouldn't happen
-    }
+    else
+      restr = path[count - 1].restr;
+
     if (restr & coyotos_Memory_restrictions_opaque) {
       return false;  // cannot peer through opacity
     }
 
+    // The shared zero objects are the only read-only capabilities we
+    // meet that are not also weak;  everything reached through the
+    // background space has been weakened.
+    bool isZero = (!invalidCap &&
+		   (type == IKT_coyotos_Page || type == IKT_coyotos_CapPage) &&
+		   ((restr & (coyotos_Memory_restrictions_readOnly |
+			      coyotos_Memory_restrictions_weak)) ==
+		    coyotos_Memory_restrictions_readOnly));
+
+    if (invalidCap && !forWrite) {
+      // A read of untouched memory.  Map the shared zero object until
+      // the first write.
+      if (!coyotos_AddressSpace_setSlot(cap, slot, 
+					wantCap ? CR_ZEROCAPPAGE : CR_ZEROPAGE))
+	return false;
+      stats.zeroMapped++;
+      return true;
+    }
+
     if (restr & (coyotos_Memory_restrictions_readOnly | 
 		 coyotos_Memory_restrictions_weak)) {
       
@@ -288,11 +329,6 @@ process_fault(uint64_t addr, bool wantCap)
 		   coyotos_Memory_restrictions_opaque));
 
       // we need to replace this capability with a strong capability.
-      coyotos_Cap_AllegedType type = 0;
-      if (!coyotos_Cap_getType(next, &type)) {
-	return false;
-      }
-
       coyotos_Range_obType obType = coyotos_Range_obType_otInvalid;
 
       switch (type) {
@@ -326,8 +362,9 @@ process_fault(uint64_t addr, bool wantCap)
 				   CR_NULL))
 	return false;
 
-      // copy the existing data, reduce the cap appropriately, and install it.
-      if (invalidCap) {
+      // copy the existing data, reduce the cap appropriately, and
+      // install it.  A new object is already zero.
+      if (invalidCap || isZero) {
 	if (!coyotos_AddressSpace_setSlot(cap, slot, spare)) {
 	  (void) coyotos_SpaceBank_free(CR_SPACEBANK, 1, 
 					spare, CR_NULL, CR_NULL);
@@ -343,28 +380,20 @@ process_fault(uint64_t addr, bool wantCap)
 
       // if we've upgraded a page, we're all done.
       if (obType == coyotos_Range_obType_otPage ||
-	  obType == coyotos_Range_obType_otCapPage)
+	  obType == coyotos_Range_obType_otCapPage) {
+	stats.pagesAllocated++;
+	if (isZero)
+	  stats.zeroUpgrades++;
 	return true;
+      }
 
-      continue; // re-process with new cap
+      continue; // re-walk with new cap
     }
 
-    // To prevent infinite recursion, we require that address spaces
-    // continually reduce l2v.
-    if (l2v >= lastl2v) {
-      return false;
-    }
-    lastl2v = l2v;
-
-    // we're traversing *into* a GPT.  Since the guard is zero, and
-    // we match it, we just need to update the address and swap around
-    // our caps.
-    addr = remaddr;
-
-    cap = next;
-    next = spare;
-    spare = next_spare;
-    next_spare = cap;
+    // The walk stopped at a strong capability we cannot fault in:  a
+    // page that is already writable, or a GPT it could not descend
+    // into because the space below is malformed or too deep.
+    return false;
   }
 }
 
@@ -461,6 +490,21 @@ HANDLE_coyotos_ElfSpace_setBreak(uint64_t newBreak, ISE *_env)
   return RC_coyotos_Cap_OK;
 }
 
+IDL_SERVER_HANDLER_PREDECL uint64_t
+HANDLE_coyotos_ElfSpace_getFaultStats(uint32_t *faults,
+				      uint32_t *pagesAllocated,
+				      uint32_t *zeroMapped,
+				      uint32_t *zeroUpgrades,
+				      ISE *_env)
+{
+  *faults = stats.faults;
+  *pagesAllocated = stats.pagesAllocated;
+  *zeroMapped = stats.zeroMapped;
+  *zeroUpgrades = stats.zeroUpgrades;
+
+  return RC_coyotos_Cap_OK;
+}
+
 IDL_SERVER_HANDLER_PREDECL uint64_t
 HANDLE_coyotos_SpaceHandler_getSpace(caploc_t _retVal, ISE *_env)
 {
@@ -473,25 +517,29 @@ IDL_SERVER_HANDLER_PREDECL void
 HANDLE_coyotos_MemoryHandler_handle(caploc_t proc,
 				    coyotos_Process_FC faultCode,
 				    uint64_t faultInfo,
+				    bool forWrite,
 				    ISE *_env)
 {
   bool handled = false;
 
-  // get the address space GPT in place
-  cap_copy(CR_TMP1, CR_SPACEGPT);
+  stats.faults++;
 
   switch (faultCode) {
   case coyotos_Process_FC_InvalidDataReference:
   case coyotos_Process_FC_AccessViolation:
     if (in_region(&stackRegion, faultInfo) ||
 	in_region(&dataRegion, faultInfo))
-      handled = process_fault(faultInfo, false);
+      handled = process_fault(faultInfo, false, forWrite);
+    // A capability store to the shared zero CapPage.
+    else if (in_region(&capRegion, faultInfo) &&
+	     faultCode == coyotos_Process_FC_AccessViolation)
+      handled = process_fault(faultInfo, true, true);
     break;
 
   case coyotos_Process_FC_InvalidCapReference:
     if (!in_region(&capRegion, faultInfo))
       break;
-    handled = process_fault(faultInfo, true);
+    handled = process_fault(faultInfo, true, forWrite);
     break;
 
   default:
@@ -574,7 +622,13 @@ initialize(void)
   // now, set up our capabilities and return our entry cap.
   if (!coyotos_AddressSpace_getSlot(CR_TOOLS, 
 				    coyotos_ElfSpace_TOOL_BACKGROUND,
-				    CR_BGGPT))
+				    CR_BGGPT) ||
+      !coyotos_AddressSpace_getSlot(CR_TOOLS, 
+				    coyotos_ElfSpace_TOOL_ZEROPAGE,
+				    CR_ZEROPAGE) ||
+      !coyotos_AddressSpace_getSlot(CR_TOOLS, 
+				    coyotos_ElfSpace_TOOL_ZEROCAPPAGE,
+				    CR_ZEROCAPPAGE))
     goto fail;
 
   if (!coyotos_Memory_reduce(CR_BGGPT,
@@ -39,6 +39,31 @@
 #define REPLY_IPW0_CAP(ldw, lastcap) \
   REPLY_IPW0(ldw) | IPW0_SC | IPW0_MAKE_LSC(lastcap)
 
+/** @brief Object structures for the allocBulk and freeBulk in progress */
+static Object *bulkObjects[coyotos_SpaceBank_bulkMax];
+
+/** @brief Check that @p cap names a CapPage or GPT in which slots
+ * @p first through @p first + @p count - 1 all exist.
+ */
+static bool
+bulk_slots_exist(caploc_t cap, uintptr_t first, uintptr_t count)
+{
+  coyotos_Cap_AllegedType type = 0;
+  uintptr_t nSlots;
+
+  if (!coyotos_Cap_getType(cap, &type))
+    return false;
+
+  if (type == IKT_coyotos_CapPage)
+    nSlots = coyotos_SpaceBank_bulkMax;
+  else if (type == IKT_coyotos_GPT)
+    nSlots = coyotos_GPT_nSlots;
+  else
+    return false;
+
+  return (first < nSlots && count <= nSlots - first);
+}
+
 /** @brief Process a single request, rewriting @p pb to do the reply.
  * @p limits is the recieve buffer. 
  */
@@ -168,6 +193,97 @@ process_request(InvParameterBlock_t *pb)
     /* return success */
     return;
   }
+  case OC_coyotos_SpaceBank_allocBulk: {
+    if (restr & coyotos_SpaceBank_restrictions_noAlloc)
+      goto no_access;
+
+    // 3 data words (type, count, first), 1 argument cap (dest)
+    if (data != 3 || edata != 0 || caps != 1)
+      goto bad_request;
+
+    coyotos_Range_obType ty = pb->pw[2];
+    uintptr_t count = pb->pw[3];
+    uintptr_t first = pb->pw[4];
+    coyotos_Memory_restrictions destRestr = 0;
+    size_t idx;
+
+    // Processes need a brand; they come from allocProcess().
+    if (!check_obType(ty) || ty == coyotos_Range_obType_otInvalid ||
+	ty == coyotos_Range_obType_otProcess)
+      goto bad_request;
+
+    if (count == 0 || count > coyotos_SpaceBank_bulkMax)
+      goto bad_request;
+
+    if (!bulk_slots_exist(CR_ARG0, first, count))
+      goto bad_request;
+
+    if (!coyotos_Memory_getRestrictions(CR_ARG0, &destRestr))
+      goto bad_request;
+    if (destRestr & (coyotos_Memory_restrictions_readOnly |
+		     coyotos_Memory_restrictions_weak))
+      goto no_access;
+
+    if (!bank_alloc_bulk(bank, ty, count, bulkObjects))
+      goto limit_reached;
+
+    for (idx = 0; idx < count; idx++) {
+      object_getCap(bulkObjects[idx], CR_TMP2);
+      if (!coyotos_AddressSpace_setSlot(CR_ARG0, first + idx, CR_TMP2)) {
+	// dest was checked above, so it must have been changed under
+	// us.  Take everything back.
+	for (idx = 0; idx < count; idx++)
+	  object_rescindAndFree(bulkObjects[idx]);
+	goto bad_request;
+      }
+    }
+    return;
+  }
+  case OC_coyotos_SpaceBank_freeBulk: {
+    if (restr & coyotos_SpaceBank_restrictions_noFree)
+      goto no_access;
+
+    // 2 data words (count, first), 1 argument cap (src)
+    if (data != 2 || edata != 0 || caps != 1)
+      goto bad_request;
+
+    uintptr_t count = pb->pw[2];
+    uintptr_t first = pb->pw[3];
+    size_t nObj = 0;
+    size_t idx;
+
+    if (count == 0 || count > coyotos_SpaceBank_bulkMax)
+      goto bad_request;
+
+    if (!bulk_slots_exist(CR_ARG0, first, count))
+      goto bad_request;
+
+    // Check everything before freeing anything.
+    for (idx = 0; idx < count; idx++) {
+      if (!coyotos_AddressSpace_getSlot(CR_ARG0, first + idx, CR_TMP2))
+	goto bad_request;
+
+      Object *obj = object_identify(CR_TMP2);
+      if (obj == 0) {
+	coyotos_Cap_AllegedType type = 0;
+	if (!coyotos_Cap_getType(CR_TMP2, &type) ||
+	    type != IKT_coyotos_Null)
+	  goto bad_request;
+	continue;
+      }
+      if (obj->bank != bank)
+	goto bad_request;
+
+      bulkObjects[nObj++] = obj;
+    }
+
+    // The same object may appear in more than one slot.
+    for (idx = 0; idx < nObj; idx++)
+      if (bulkObjects[idx]->bank == bank)
+	object_rescindAndFree(bulkObjects[idx]);
+
+    return;
+  }
   case OC_coyotos_SpaceBank_allocProcess:
     if (restr & coyotos_SpaceBank_restrictions_noAlloc)
       goto no_access;
@@ -31,7 +31,9 @@
 #include <coyotos/syscall.h>
 #include <coyotos/runtime.h>
 #include <idl/coyotos/Memory.h>
+#include <idl/coyotos/Null.h>
 #include <idl/coyotos/GPT.h>
+#include <idl/coyotos/CapPage.h>
 #include <idl/coyotos/Endpoint.h>
 #include <idl/coyotos/Process.h>
 #include <idl/coyotos/Range.h>
@@ -64,10 +66,13 @@ typedef struct Object Object;
  *
  * For an object <tt>obj</tt>, its type is <tt>obj->extent->obType</tt>. 
  * Its OID is <tt>obj->extent->baseOID + (obj - obj->extent->array)</tt>
+ *
+ * Free objects are not linked anywhere; they are recorded in the
+ * freeMap of their Extent.
  */
 struct Object {
-  Object *next; /**< @brief next Object in freelist or bank's oList  */
-  Object *prev; /**< @brief previous Object in freelist or bank's oList  */
+  Object *next; /**< @brief next Object in bank's oList  */
+  Object *prev; /**< @brief previous Object in bank's oList  */
   Bank *bank;   /**< @brief Bank object is allocated from, or NULL if free */
   Extent *extent; /**< @brief Extent containing, this object */
 };
@@ -76,6 +81,9 @@ struct Object {
  *
  * Contains an array of Object structures;  to compute the OID of an object,
  * add its array index to baseOID.
+ *
+ * Bit @c i of @c freeMap is set if and only if @c array[i] is free,
+ * so the free objects of an extent can be found 64 at a time.
  */
 struct Extent {
   coyotos_Range_oid_t baseOID;
@@ -90,6 +98,8 @@ struct Extent {
    * NULL for non-Endpoint extents.
    */
   Bank *bankArray;
+  uint64_t *freeMap; /**< @brief bitmap of free objects, one bit per object */
+  size_t freeHint; /**< @brief no freeMap word below this one is non-zero */
   Extent *nextExtent; /**< @brief next Extent of this type */
   coyotos_Range_obType obType; /**< @brief type of this Extent */
 };
@@ -108,7 +118,14 @@ struct Bank {
   Object *oList;
 
   uint64_t limits[coyotos_Range_obType_otNUM_TYPES];
+  /** @brief objects allocated from this Bank and its descendants,
+   * plus the quota cached by them.
+   */
   uint64_t usage[coyotos_Range_obType_otNUM_TYPES];
+  /** @brief quota already charged to this Bank and all of its
+   * parents, but not yet used by an allocation.
+   */
+  uint64_t cached[coyotos_Range_obType_otNUM_TYPES];
 };
 
 static inline bool
@@ -178,6 +195,14 @@ void get_pagecap(caploc_t out, oid_t oid);
  */
 Object *bank_alloc(Bank *bank, coyotos_Range_obType ty, caploc_t out);
 
+/** @brief Allocate @p count objects of type @p ty from @p bank,
+ * storing their Object structures in @p out.  Returns false, having
+ * allocated nothing, if the limit was reached.  No capabilities are
+ * fabricated.
+ */
+bool bank_alloc_bulk(Bank *bank, coyotos_Range_obType ty, size_t count,
+		     Object **out);
+
 /** @brief Allocate a Process from @p bank, placing @p brand in its
  * brand slot, and placing the cap in @p out.  Returns the Object
  * structure for the new object, or NULL if the limit was reached.
@@ -97,22 +97,17 @@ static void
 install_Page(caploc_t pageCap, uintptr_t addr)
 {
   /*
-   * We will loop as we go down;  the capability registers used looks like:
-   *      cap        next     spare    next_spare
-   *  1.  ADDRSPACE  TMP1     TMP2     TMP3
-   *  2.  TMP1       TMP2     TMP3     TMP1
-   *  3.  TMP2       TMP3     TMP1     TMP2
-   *  4.  TMP3       TMP1     TMP2     TMP3
-   *  5.  TMP1       TMP2     TMP3     TMP1
-   *  ... etc. ...
+   * Each pass walks our address space from the top in a single kernel
+   * call.  The walk stops at the slot we need to change, leaving the
+   * GPT holding it in cap, and the capability in the slot in next.  If
+   * we have to insert a GPT on the way, we walk again.
    */
   assert(pageCap.raw != CR_TMP1.raw && pageCap.raw != CR_TMP2.raw
 	 && pageCap.raw != CR_TMP3.raw);
 
-  caploc_t cap = CR_ADDRSPACE;
-  caploc_t next = CR_TMP1;
-  caploc_t spare = CR_TMP2;
-  caploc_t next_spare = CR_TMP3;
+  caploc_t cap = CR_TMP1;
+  caploc_t next = CR_TMP2;
+  caploc_t spare = CR_TMP3;
 
   {
     guard_t theGuard = 0;
@@ -122,35 +117,41 @@ install_Page(caploc_t pageCap, uintptr_t addr)
     assert3(guard_l2g(theGuard), ==, COYOTOS_PAGE_ADDR_BITS);
   }
 
+  coyotos_AddressSpace_walkPath path;
   coyotos_Memory_l2value_t l2v = 0;
-  coyotos_Memory_l2value_t lastl2v = COYOTOS_SOFTADDR_BITS;
 
   // the top-level GPT always has a guard of zero and an l2g of the HW
   // address limit
   for (;;) {
-    MUST_SUCCEED(coyotos_GPT_getl2v(cap, &l2v));
+    uint32_t count = 0;
 
-    uintptr_t slot = highbits_shifted(addr, l2v);
-    uintptr_t remaddr = lowbits(addr, l2v);
+    MUST_SUCCEED(coyotos_AddressSpace_walk(CR_ADDRSPACE, addr, 0,
+					   &count, path, cap, next));
+
+    uintptr_t remaddr = addr;
+    for (size_t i = 0; i < count; i++)
+      remaddr = lowbits(remaddr, path[i].l2v);
+
+    coyotos_AddressSpace_walkLevel *last = &path[count - 1];
+    uintptr_t slot = last->slot;
     
-    if (l2v == COYOTOS_PAGE_ADDR_BITS) {
+    if (last->l2v == COYOTOS_PAGE_ADDR_BITS) {
       MUST_SUCCEED(coyotos_AddressSpace_setSlot(cap, slot, pageCap));
       return;
     }
-    MUST_SUCCEED(coyotos_AddressSpace_getSlot(cap, slot, next));
 
-    guard_t theGuard;
-    if (!coyotos_Memory_getGuard(next, &theGuard)) {
+    if (last->type == IKT_coyotos_Null || last->type == IKT_coyotos_Cap) {
       assert3(remaddr, ==, 0);
       MUST_SUCCEED(coyotos_AddressSpace_setSlot(cap, slot, pageCap));
       return;
     }
 
+    guard_t theGuard = last->guard;
     uint32_t match = guard_match(theGuard);
     coyotos_Memory_l2value_t l2g = guard_l2g(theGuard);
     assert3(match, ==, 0);
     assert3(l2g, <=, 32);
-    assert3(l2g, <=, l2v);
+    assert3(l2g, <=, last->l2v);
     
     uintptr_t matchbits = highbits_shifted(remaddr, l2g);
     if (matchbits != 0) {
@@ -167,26 +168,14 @@ install_Page(caploc_t pageCap, uintptr_t addr)
 					   next));
       MUST_SUCCEED(coyotos_AddressSpace_setSlot(spare, 0, next));
       MUST_SUCCEED(coyotos_AddressSpace_setSlot(cap, slot, spare));
-      continue;  // re-execute loop with newly inserted GPT
+      continue;  // re-walk with newly inserted GPT
     }
-    if (l2g == COYOTOS_PAGE_ADDR_BITS) {
-      // replacing a page.  Just overwrite it.
-      MUST_SUCCEED(coyotos_AddressSpace_setSlot(cap, slot, pageCap));
-      return;
-    }
-
-    assert3(l2v, <, lastl2v);
-    lastl2v = l2v;
-
-    // we're traversing *into* a GPT.  Since the guard is zero, and
-    // we match it, we just need to update the address and swap around
-    // our caps.
-    addr = remaddr;
 
-    cap = next;
-    next = spare;
-    spare = next_spare;
-    next_spare = cap;
+    // Our space is only a few levels deep, so the walk always reaches
+    // the slot for addr.  All that is left is replacing a page.
+    assert3(l2g, ==, COYOTOS_PAGE_ADDR_BITS);
+    MUST_SUCCEED(coyotos_AddressSpace_setSlot(cap, slot, pageCap));
+    return;
   }
 }
 
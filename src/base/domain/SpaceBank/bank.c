@@ -32,8 +32,6 @@ size_t nExtents = 0;
 
 Extent *extentByType[coyotos_Range_obType_otNUM_TYPES];
 
-Object *freelistByType[coyotos_Range_obType_otNUM_TYPES];
-
 Bank *primeBank;
 
 oid_t prealloc_base[coyotos_Range_obType_otNUM_TYPES];
@@ -50,15 +48,18 @@ bank_getEndpoint(Bank *bank)
   return &ext->array[bank - ext->bankArray];
 }
 
+/** @brief Charge @p count objects of type @p ty to @p bank and each of
+ * its parents.  Either all of them are charged or none are.
+ */
 static inline bool
-bank_reserveSpace(Bank *bank, coyotos_Range_obType ty)
+bank_reserveSpace(Bank *bank, coyotos_Range_obType ty, size_t count)
 {
   Bank *cur;
 
   for (cur = bank; cur != 0; cur = cur->parent) {
-    if (cur->usage[ty] >= cur->limits[ty])
+    if (cur->limits[ty] - cur->usage[ty] < count)
       break;
-    cur->usage[ty]++;
+    cur->usage[ty] += count;
   }
 
   if (cur == 0)
@@ -66,48 +67,166 @@ bank_reserveSpace(Bank *bank, coyotos_Range_obType ty)
 
   /* failed; undo changes */
   while (bank != cur) {
-    assert(bank->usage[ty] > 0);
+    assert(bank->usage[ty] >= count);
 
-    bank->usage[ty]--;
+    bank->usage[ty] -= count;
     bank = bank->parent;
   }
   return false;
 }
 
 static inline void
-bank_unreserveSpace(Bank *bank, coyotos_Range_obType ty)
+bank_unreserveSpace(Bank *bank, coyotos_Range_obType ty, size_t count)
 {
   Bank *cur;
 
   for (cur = bank; cur != 0; cur = cur->parent) {
-    assert(cur->usage[ty] > 0);
-    cur->usage[ty]--;
+    assert(cur->usage[ty] >= count);
+    cur->usage[ty] -= count;
   }
 }
 
-static inline void
-object_setAllocatedBank(Object *object, Bank *bank)
+/** @brief Quota a bank takes from its parents each time it runs out.
+ *
+ * Allocations are satisfied from the bank's cached quota, so the walk
+ * up the parent chain in bank_reserveSpace() happens once per
+ * BANK_CACHE_CHUNK allocations rather than once per allocation.
+ */
+#define BANK_CACHE_CHUNK 16
+
+/** @brief Return the bank after @p cur in a preorder walk of the
+ * subtree rooted at @p root, or NULL when the walk is done.
+ */
+static Bank *
+bank_nextInSubtree(Bank *root, Bank *cur)
+{
+  if (cur->firstChild)
+    return cur->firstChild;
+
+  for (; cur != root; cur = cur->parent)
+    if (cur->nextSibling)
+      return cur->nextSibling;
+
+  return 0;
+}
+
+/** @brief Return the cached quota of type @p ty of every bank in the
+ * subtree rooted at @p root to its parents.
+ */
+static void
+bank_flushCaches(Bank *root, coyotos_Range_obType ty)
+{
+  Bank *cur;
+
+  for (cur = root; cur != 0; cur = bank_nextInSubtree(root, cur)) {
+    if (cur->cached[ty] == 0)
+      continue;
+    bank_unreserveSpace(cur, ty, cur->cached[ty]);
+    cur->cached[ty] = 0;
+  }
+}
+
+/** @brief Sum the cached quota in the subtree rooted at @p root into
+ * @p out, by type.
+ */
+static void
+bank_subtreeCached(Bank *root, uint64_t out[coyotos_Range_obType_otNUM_TYPES])
+{
+  Bank *cur;
+  size_t idx;
+
+  for (idx = 0; idx < coyotos_Range_obType_otNUM_TYPES; idx++)
+    out[idx] = 0;
+
+  for (cur = root; cur != 0; cur = bank_nextInSubtree(root, cur))
+    for (idx = 0; idx < coyotos_Range_obType_otNUM_TYPES; idx++)
+      out[idx] += cur->cached[idx];
+}
+
+/** @brief Take quota for @p count objects of type @p ty from @p bank.
+ *
+ * Uses the bank's cached quota if there is enough, and otherwise
+ * charges the parent chain for the shortfall plus a fresh chunk. If
+ * even the shortfall cannot be charged, the quota may be sitting in
+ * some other bank's cache, so all caches are flushed and the charge
+ * is retried. An allocation therefore fails only if it really would
+ * exceed a limit.
+ */
+static bool
+bank_takeQuota(Bank *bank, coyotos_Range_obType ty, size_t count)
 {
-  coyotos_Range_obType ty = object->extent->obType;
+  if (bank->cached[ty] >= count) {
+    bank->cached[ty] -= count;
+    return true;
+  }
 
-  Object **listHead = (bank != 0)? &bank->oList : &freelistByType[ty];
+  uint64_t need = count - bank->cached[ty];
 
-  if (object->next != NULL) {
-    Object **oldHead = (object->bank != 0)? &object->bank->oList :
-      &freelistByType[ty];
+  if (bank_reserveSpace(bank, ty, need + BANK_CACHE_CHUNK))
+    bank->cached[ty] += need + BANK_CACHE_CHUNK;
+  else if (bank_reserveSpace(bank, ty, need))
+    bank->cached[ty] += need;
+  else {
+    bank_flushCaches(primeBank, ty);
+    if (!bank_reserveSpace(bank, ty, count))
+      return false;
+    bank->cached[ty] = count;
+  }
+
+  bank->cached[ty] -= count;
+  return true;
+}
 
-    object->next->prev = object->prev;
-    object->prev->next = object->next;
-    if (*oldHead == object)
-      *oldHead = object->next;
+/** @brief Give back quota for @p count objects of type @p ty to
+ * @p bank.  Quota beyond two chunks is returned to the parent chain.
+ */
+static void
+bank_returnQuota(Bank *bank, coyotos_Range_obType ty, size_t count)
+{
+  bank->cached[ty] += count;
+
+  if (bank->cached[ty] > 2 * BANK_CACHE_CHUNK) {
+    bank_unreserveSpace(bank, ty, bank->cached[ty] - BANK_CACHE_CHUNK);
+    bank->cached[ty] = BANK_CACHE_CHUNK;
+  }
+}
+
+/** @brief Number of 64-bit words in the freeMap of @p ext */
+static inline size_t
+extent_freeWords(Extent *ext)
+{
+  return (ext->count + 63) / 64;
+}
+
+/** @brief Set or clear the freeMap bit for @p object */
+static inline void
+object_markFree(Object *object, bool isFree)
+{
+  Extent *ext = object->extent;
+  size_t idx = object - ext->array;
+  size_t word = idx / 64;
+  uint64_t bit = 1ULL << (idx % 64);
+
+  if (isFree) {
+    ext->freeMap[word] |= bit;
+    if (word < ext->freeHint)
+      ext->freeHint = word;
+  } else {
+    ext->freeMap[word] &= ~bit;
   }
+}
+
+/** @brief Link @p object, which is on no list, into @p bank's oList */
+static inline void
+object_linkToBank(Object *object, Bank *bank)
+{
+  Object *head = bank->oList;
 
-  if (*listHead == 0) {
+  if (head == 0) {
     object->next = object;
     object->prev = object;
-    *listHead = object;
+    bank->oList = object;
   } else {
-    Object *head = *listHead;
     object->next = head;
     object->prev = head->prev;
     head->prev->next = object;
@@ -116,6 +235,67 @@ object_setAllocatedBank(Object *object, Bank *bank)
   object->bank = bank;
 }
 
+static inline void
+object_setAllocatedBank(Object *object, Bank *bank)
+{
+  if (object->bank == 0) {
+    object_markFree(object, false);
+  } else {
+    Object **oldHead = &object->bank->oList;
+
+    if (object->next == object) {
+      *oldHead = 0;
+    } else {
+      object->next->prev = object->prev;
+      object->prev->next = object->next;
+      if (*oldHead == object)
+	*oldHead = object->next;
+    }
+    object->next = 0;
+    object->prev = 0;
+  }
+
+  if (bank != 0) {
+    object_linkToBank(object, bank);
+  } else {
+    object->bank = 0;
+    object_markFree(object, true);
+  }
+}
+
+/** @brief Take up to @p count free objects of type @p ty out of the
+ * free maps, storing them in @p out.  Returns the number taken.
+ *
+ * Each freeMap word examined yields up to 64 objects, and freeHint
+ * lets us skip the fully allocated prefix of each extent.
+ */
+static size_t
+freemap_take(coyotos_Range_obType ty, Object **out, size_t count)
+{
+  size_t n = 0;
+  Extent *ext;
+
+  for (ext = extentByType[ty]; ext != 0 && n < count; ext = ext->nextExtent) {
+    size_t nWords = extent_freeWords(ext);
+    size_t w;
+
+    for (w = ext->freeHint; w < nWords && n < count; w++) {
+      uint64_t word = ext->freeMap[w];
+
+      while (word != 0 && n < count) {
+	size_t bit = __builtin_ctzll(word);
+	word &= word - 1;
+	out[n++] = &ext->array[w * 64 + bit];
+      }
+      ext->freeMap[w] = word;
+
+      if (word == 0 && w == ext->freeHint)
+	ext->freeHint = w + 1;
+    }
+  }
+  return n;
+}
+
 void
 object_getCap(Object *obj, caploc_t out)
 {
@@ -138,7 +318,7 @@ object_rescindAndFree(Object *obj)
   MUST_SUCCEED(coyotos_Range_rescind(CR_RANGE, CR_TMP1));
 
   // rescind obj and free it.
-  bank_unreserveSpace(obj->bank, ty);
+  bank_returnQuota(obj->bank, ty, 1);
   object_setAllocatedBank(obj, NULL);
 }
 
@@ -180,23 +360,42 @@ get_pagecap(caploc_t out, oid_t oid)
 bool
 bank_setLimits(Bank *bank, const coyotos_SpaceBank_limits *newLims)
 {
+  uint64_t cached[coyotos_Range_obType_otNUM_TYPES];
   size_t idx;
+
+  bank_subtreeCached(bank, cached);
+
   for (idx = 0; idx < coyotos_Range_obType_otNUM_TYPES; idx++)
-    if (bank->usage[idx] > newLims->byType[idx])
+    if (bank->usage[idx] - cached[idx] > newLims->byType[idx])
       return false;
 
+  // Cached quota does not count against the new limits; hand back
+  // whatever would not fit under them.
+  for (idx = 0; idx < coyotos_Range_obType_otNUM_TYPES; idx++)
+    if (bank->usage[idx] > newLims->byType[idx])
+      bank_flushCaches(bank, idx);
+
   for (idx = 0; idx < coyotos_Range_obType_otNUM_TYPES; idx++)
     bank->limits[idx] = newLims->byType[idx];
 
   return true;
 }
 
+/* The usage counters include quota cached in the banks below, so the
+ * reported values subtract it back out. These queries are rare enough
+ * that walking the subtree is cheaper than keeping the counters exact
+ * on every allocation.
+ */
+
 void
 bank_getUsage(Bank *bank, coyotos_SpaceBank_limits *out)
 {
+  uint64_t cached[coyotos_Range_obType_otNUM_TYPES];
   size_t idx;
+
+  bank_subtreeCached(bank, cached);
   for (idx = 0; idx < coyotos_Range_obType_otNUM_TYPES; idx++)
-    out->byType[idx] = bank->usage[idx];
+    out->byType[idx] = bank->usage[idx] - cached[idx];
 }
 
 void
@@ -210,6 +409,7 @@ bank_getLimits(Bank *bank, coyotos_SpaceBank_limits *out)
 void
 bank_getEffLimits(Bank *bank, coyotos_SpaceBank_limits *out)
 {
+  uint64_t cached[coyotos_Range_obType_otNUM_TYPES];
   Bank *cur;
   size_t idx;
 
@@ -219,8 +419,10 @@ bank_getEffLimits(Bank *bank, coyotos_SpaceBank_limits *out)
 
   // Find the most constrained values by walking up the parent chain.
   for (cur = bank->parent; cur != 0; cur = cur->parent) {
+    bank_subtreeCached(cur, cached);
     for (idx = 0; idx < coyotos_Range_obType_otNUM_TYPES; idx++) {
-      unsigned long long avail = cur->limits[idx] - cur->usage[idx];
+      unsigned long long avail =
+	cur->limits[idx] - (cur->usage[idx] - cached[idx]);
       if (avail < out->byType[idx])
 	out->byType[idx] = avail;
     }
@@ -228,8 +430,9 @@ bank_getEffLimits(Bank *bank, coyotos_SpaceBank_limits *out)
 
   // Add in the child bank's usage to get the effective limit, as opposed
   // to the # of objects available.
+  bank_subtreeCached(bank, cached);
   for (idx = 0; idx < coyotos_Range_obType_otNUM_TYPES; idx++)
-    out->byType[idx] += bank->usage[idx];
+    out->byType[idx] += bank->usage[idx] - cached[idx];
 }
 
 bool
@@ -309,11 +512,19 @@ bank_destroy(Bank *bank, bool destroyObjects)
 
     Bank *next = bank->parent;
 
+    // Return the bank's cached quota to its parents. Its own usage
+    // counts are discarded below.
+    coyotos_Range_obType type;
+    for (type = 0; type < coyotos_Range_obType_otNUM_TYPES; type++) {
+      if (bank->cached[type] != 0)
+	bank_unreserveSpace(next, type, bank->cached[type]);
+      bank->cached[type] = 0;
+    }
+
     // clean up the bank
     bank->parent = 0;
     assert(bank->oList == 0);
 
-    coyotos_Range_obType type;
     for (type = 0; type < coyotos_Range_obType_otNUM_TYPES; type++) {
       bank->limits[type] = -1ULL;
       bank->usage[type] = 0;
@@ -357,11 +568,19 @@ allocate_objects_and_banks(void)
     Object *array = allocate_bytes(sizeof (*ext->array) * ext->count);
     assert(array != 0);
     ext->array = array;
-    for (objidx = 0; objidx < ext->count; objidx++) {
+    for (objidx = 0; objidx < ext->count; objidx++)
       array[objidx].extent = ext;
-      // add to freelist
-      object_setAllocatedBank(&array[objidx], NULL);
-    }
+
+    // every object starts out free
+    size_t nWords = extent_freeWords(ext);
+    uint64_t *freeMap = allocate_bytes(sizeof (*ext->freeMap) * nWords);
+    assert(freeMap != 0);
+    ext->freeMap = freeMap;
+    ext->freeHint = 0;
+    for (objidx = 0; objidx < nWords; objidx++)
+      freeMap[objidx] = -1ULL;
+    if (ext->count % 64)
+      freeMap[nWords - 1] = (1ULL << (ext->count % 64)) - 1;
     if (ext->obType != coyotos_Range_obType_otEndpoint)
       ext->bankArray = NULL;
     else {
@@ -436,23 +655,46 @@ setup_prealloc(coyotos_Range_obType type, size_t count)
   ext->bootstrapped = 0;
 }
 
-Object *
-bank_do_alloc(Bank *bank, coyotos_Range_obType type, caploc_t out)
+bool
+bank_alloc_bulk(Bank *bank, coyotos_Range_obType type, size_t count,
+		Object **out)
+{
+  if (!bank_takeQuota(bank, type, count))
+    return false;
+
+  size_t n = freemap_take(type, out, count);
+  size_t idx;
+
+  if (n < count) {
+    // The limits allowed more than the backed range holds; put back
+    // what we took.
+    for (idx = 0; idx < n; idx++)
+      object_markFree(out[idx], true);
+    bank_returnQuota(bank, type, count);
+    return false;
+  }
+
+  for (idx = 0; idx < count; idx++)
+    object_linkToBank(out[idx], bank);
+
+  return true;
+}
+
+static Object *
+bank_do_alloc(Bank *bank, coyotos_Range_obType type)
 {
-  bool result = bank_reserveSpace(bank, type);
+  Object *obj;
 
-  if (!result)
+  if (!bank_alloc_bulk(bank, type, 1, &obj))
     return 0;
 
-  Object *obj = freelistByType[type];
-  object_setAllocatedBank(obj, bank);
   return obj;
 }
 
 Object *
 bank_alloc(Bank *bank, coyotos_Range_obType type, caploc_t out)
 {
-  Object *obj = bank_do_alloc(bank, type, out);
+  Object *obj = bank_do_alloc(bank, type);
   if (obj) {
     oid_t oid = object_getOid(obj);
     MUST_SUCCEED(coyotos_Range_getCap(CR_RANGE, oid, type, out));
@@ -463,7 +705,7 @@ bank_alloc(Bank *bank, coyotos_Range_obType type, caploc_t out)
 Object *
 bank_alloc_proc(Bank *bank, caploc_t brand, caploc_t out)
 {
-  Object *obj = bank_do_alloc(bank, coyotos_Range_obType_otProcess, out);
+  Object *obj = bank_do_alloc(bank, coyotos_Range_obType_otProcess);
   if (obj) {
     oid_t oid = object_getOid(obj);
     MUST_SUCCEED(coyotos_Range_getProcess(CR_RANGE, oid, brand, out));
@@ -490,7 +732,7 @@ object_unalloc(Object *obj)
   Bank *bank = obj->bank;
   assert(bank);
 
-  bank_unreserveSpace(bank, object_getType(obj));
+  bank_returnQuota(bank, object_getType(obj), 1);
   object_setAllocatedBank(obj, NULL);
 }
 
@@ -590,7 +832,7 @@ setup_allocations(CoyImgAlloc *alloc, size_t count)
     Bank *bank = lookup_bank(bankid);
     Object *obj = lookup_object(type, oid);
 
-    bool result = bank_reserveSpace(bank, type);
+    bool result = bank_reserveSpace(bank, type, 1);
     assert(result);
 
     object_setAllocatedBank(obj, bank);
@@ -615,7 +857,7 @@ setup_bootstrap_allocations(void)
 
       assert(obj->bank == NULL);
       // treat it as allocated by the primeBank
-      bool result = bank_reserveSpace(primeBank, object_getType(obj));
+      bool result = bank_reserveSpace(primeBank, object_getType(obj), 1);
       assert(result);
       object_setAllocatedBank(obj, primeBank);
     }
@@ -662,7 +904,7 @@ initialize(void)
   // allocated from the Prime Bank.
   setup_bootstrap_allocations();
 
-  // at this point, our ranges, banks, and freelists are fully consistent.
+  // at this point, our ranges, banks, and free maps are fully consistent.
 
   /// @bug at some point, we should rescind and free the metadata pages, and
   /// possibly the GPTs which point to them.
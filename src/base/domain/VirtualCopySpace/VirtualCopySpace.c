@@ -74,6 +74,13 @@ typedef union {
 #define CR_TMP2		 coyotos_VirtualCopySpace_APP_TMP2
 #define CR_TMP3		 coyotos_VirtualCopySpace_APP_TMP3
 
+#define CR_SPARE1	 coyotos_VirtualCopySpace_APP_SPARE1
+#define CR_SPARE2	 coyotos_VirtualCopySpace_APP_SPARE2
+#define CR_SPARE3	 coyotos_VirtualCopySpace_APP_SPARE3
+
+#define CR_ZEROPAGE	 coyotos_VirtualCopySpace_APP_ZEROPAGE
+#define CR_ZEROCAPPAGE	 coyotos_VirtualCopySpace_APP_ZEROCAPPAGE
+
 typedef struct IDL_SERVER_Environment {
   bool isHandlerFacet;
   bool isVCSFacet;
@@ -81,6 +88,22 @@ typedef struct IDL_SERVER_Environment {
 
 bool frozen = false;
 
+/** @brief Pages to copy ahead of a write fault. */
+uint32_t faultAhead = coyotos_VirtualCopySpace_defaultFaultAhead;
+
+/** @brief Number of Pages held in the CR_SPAREn registers. */
+uint32_t nSparePages = 0;
+
+struct {
+  uint32_t faults;
+  uint32_t pagesCopied;
+  uint32_t pagesAhead;
+  uint32_t gptsAdded;
+  uint32_t bankAllocs;
+  uint32_t zeroMapped;
+  uint32_t zeroUpgrades;
+} stats;
+
 IDL_SERVER_HANDLER_PREDECL uint64_t
 HANDLE_coyotos_Cap_destroy(ISE *ise)
 {
@@ -115,6 +138,38 @@ HANDLE_coyotos_VirtualCopySpace_freeze(caploc_t _retVal, ISE *_env)
   return RC_coyotos_Cap_UnknownRequest;
 }
 
+IDL_SERVER_HANDLER_PREDECL uint64_t
+HANDLE_coyotos_VirtualCopySpace_setFaultAhead(uint32_t nPages, ISE *_env)
+{
+  if (nPages > coyotos_VirtualCopySpace_maxFaultAhead)
+    return RC_coyotos_Cap_RequestError;
+
+  faultAhead = nPages;
+
+  return RC_coyotos_Cap_OK;
+}
+
+IDL_SERVER_HANDLER_PREDECL uint64_t
+HANDLE_coyotos_VirtualCopySpace_getFaultStats(uint32_t *faults,
+					      uint32_t *pagesCopied,
+					      uint32_t *pagesAhead,
+					      uint32_t *gptsAdded,
+					      uint32_t *bankAllocs,
+					      uint32_t *zeroMapped,
+					      uint32_t *zeroUpgrades,
+					      ISE *_env)
+{
+  *faults = stats.faults;
+  *pagesCopied = stats.pagesCopied;
+  *pagesAhead = stats.pagesAhead;
+  *gptsAdded = stats.gptsAdded;
+  *bankAllocs = stats.bankAllocs;
+  *zeroMapped = stats.zeroMapped;
+  *zeroUpgrades = stats.zeroUpgrades;
+
+  return RC_coyotos_Cap_OK;
+}
+
 IDL_SERVER_HANDLER_PREDECL uint64_t
 HANDLE_coyotos_SpaceHandler_getSpace(caploc_t _retVal, ISE *_env)
 {
@@ -183,51 +238,118 @@ round_up(uint64_t a, uint64_t b)
   return ((a + b - 1)/b) * b;
 }
 
-/// @bug current limitations:
-///   @li  doesn't fill in read-only faults with a fixed zero page
+/// Allocate an object of type @p obType into @p out.
+///
+/// Pages are allocated from the bank three at a time, and the
+/// remainder held in the CR_SPAREn registers until needed.  A fault
+/// that copies ahead needs several in a row.
+static bool
+alloc_object(coyotos_Range_obType obType, caploc_t out)
+{
+  if (obType == coyotos_Range_obType_otPage) {
+    if (nSparePages == 0) {
+      stats.bankAllocs++;
+      if (coyotos_SpaceBank_alloc(CR_SPACEBANK,
+				  coyotos_Range_obType_otPage,
+				  coyotos_Range_obType_otPage,
+				  coyotos_Range_obType_otPage,
+				  CR_SPARE1,
+				  CR_SPARE2,
+				  CR_SPARE3))
+	nSparePages = 3;
+    }
+
+    switch (nSparePages) {
+    case 3:
+      cap_copy(out, CR_SPARE3);
+      break;
+    case 2:
+      cap_copy(out, CR_SPARE2);
+      break;
+    case 1:
+      cap_copy(out, CR_SPARE1);
+      break;
+    default:
+      goto single;   // bank too close to its limit for three
+    }
+    nSparePages--;
+    return true;
+  }
+
+ single:
+  stats.bankAllocs++;
+  return coyotos_SpaceBank_alloc(CR_SPACEBANK,
+				 obType,
+				 coyotos_Range_obType_otInvalid,
+				 coyotos_Range_obType_otInvalid,
+				 out,
+				 CR_NULL,
+				 CR_NULL);
+}
+
+/// Make the page at @p addr writable, copying or allocating as
+/// needed.
+///
+/// @p forWrite is set if the fault was a write.  A read of a slot
+/// that holds nothing maps the shared zero Page (or CapPage, if @p
+/// wantCap), which a later write fault replaces with a private one.
+///
+/// If @p ahead is set, the page has not actually faulted, so we only
+/// copy a page still shared with the background space, along with
+/// any shared GPTs above it.  Anything else makes us return false.
+///
 bool
-process_fault(uint64_t addr, bool wantCap)
+process_fault(uint64_t addr, bool wantCap, bool forWrite, bool ahead)
 {
-  caploc_t cap = CR_SPACEGPT;
-  caploc_t next = CR_TMP1;
-  caploc_t spare = CR_TMP2;
-  caploc_t next_spare = CR_TMP3;
+  caploc_t cap = CR_TMP1;
+  caploc_t next = CR_TMP2;
+  caploc_t spare = CR_TMP3;
 
   /*
-   * We will loop as we go down;  the capability registers used looks like:
-   *      cap        next     spare    next_spare
-   *  1.  SPACEGPT   TMP1     TMP2     TMP3
-   *  2.  TMP1       TMP2     TMP3     TMP1
-   *  3.  TMP2       TMP3     TMP1     TMP2
-   *  4.  TMP3       TMP1     TMP2     TMP3
-   *  5.  TMP1       TMP2     TMP3     TMP1
-   *  ... etc ...
+   * Each pass walks the space from the top in a single kernel call.
+   * The walk stops at the first slot we may need to change, leaving
+   * the GPT holding it in cap, and the capability in the slot in
+   * next.  Once we have changed it, we walk again.
    */
 
-  coyotos_Memory_l2value_t l2v = 0;
+  coyotos_AddressSpace_walkPath path;
   coyotos_Memory_l2value_t unusedl2v = 0;
-  coyotos_Memory_l2value_t lastl2v = COYOTOS_SOFTADDR_BITS;
 
   for (;;) {
-    if (!coyotos_GPT_getl2v(cap, &l2v))
+    uint32_t count = 0;
+
+    if (!coyotos_AddressSpace_walk(CR_SPACEGPT, addr,
+				   coyotos_Memory_restrictions_readOnly |
+				   coyotos_Memory_restrictions_weak,
+				   &count, path, cap, next))
       return false;
 
-    uintptr_t slot = highbits_shifted(addr, l2v);
-    uintptr_t remaddr = lowbits(addr, l2v);
+    // Find the offset remaining within the last GPT.  To prevent
+    // infinite recursion, we require that address spaces continually
+    // reduce l2v.
+    uint64_t remaddr = addr;
+    coyotos_Memory_l2value_t lastl2v = COYOTOS_SOFTADDR_BITS;
 
-    /// @bug at some point, we need to deal with too-low l2v values.
-    /// For now, we'll just fail.
-    if (!coyotos_AddressSpace_getSlot(cap, slot, next))
-      return false;
+    for (size_t i = 0; i < count; i++) {
+      if (path[i].l2v >= lastl2v)
+	return false;
+      lastl2v = path[i].l2v;
+      remaddr = lowbits(remaddr, lastl2v);
+    }
 
-    guard_t theGuard;
+    coyotos_Memory_l2value_t l2v = path[count - 1].l2v;
+    uintptr_t slot = path[count - 1].slot;
+    coyotos_Cap_AllegedType type = path[count - 1].type;
+    guard_t theGuard = path[count - 1].guard;
     bool invalidCap = false;
 
     // for invalid capabilities, treat them as if they had no guard.
     //
     // This simplifies the code below, at the expense of adding
     // unnecessary GPTs along the way, if remaddr is non-zero.
-    if (!coyotos_Memory_getGuard(next, &theGuard)) {
+    if (type == IKT_coyotos_Null || type == IKT_coyotos_Cap) {
+      if (ahead)
+	return false;
       theGuard = make_guard(0, COYOTOS_PAGE_ADDR_BITS);
       invalidCap = true;
     }
@@ -245,6 +367,9 @@ process_fault(uint64_t addr, bool wantCap)
     uint64_t mismatch = ((remaddr ^ matchValue) & mask);
     
     if (mismatch != 0) {
+      if (ahead)
+	return false;
+
       // we need to add a GPT
 
       // figure out its guard and l2v
@@ -264,15 +389,9 @@ process_fault(uint64_t addr, bool wantCap)
 
       // now that that's all figured out, allocate the new cap, and
       // set everything up.
-      if (!coyotos_SpaceBank_alloc(CR_SPACEBANK,
-				   coyotos_Range_obType_otGPT, 
-				   coyotos_Range_obType_otInvalid,
-				   coyotos_Range_obType_otInvalid,
-				   spare,
-				   CR_NULL,
-				   CR_NULL)) {
+      if (!alloc_object(coyotos_Range_obType_otGPT, spare))
 	return false;
-      }
+      stats.gptsAdded++;
 
       // If the cap was invalid (i.e. Null), don't install anything in
       // the chosen slot.
@@ -292,20 +411,42 @@ process_fault(uint64_t addr, bool wantCap)
 				      spare, CR_NULL, CR_NULL);
 	return false;
       }
-      continue;  // re-execute loop with newly inserted GPT
+      continue;  // re-walk with newly inserted GPT
     }
     
     coyotos_Memory_restrictions restr = 0;
 
     if (invalidCap)
       restr = coyotos_Memory_restrictions_readOnly;
-    else if (!coyotos_Memory_getRestrictions(next, &restr)) {
-      return false;  // shouldn't happen
-    }
+    else
+      restr = path[count - 1].restr;
+
     if (restr & coyotos_Memory_restrictions_opaque) {
       return false;  // cannot peer through opacity
     }
 
+    // The shared zero objects are the only read-only capabilities we
+    // meet that are not also weak;  everything reached through the
+    // background space has been weakened.
+    bool isZero = (!invalidCap &&
+		   (type == IKT_coyotos_Page || type == IKT_coyotos_CapPage) &&
+		   ((restr & (coyotos_Memory_restrictions_readOnly |
+			      coyotos_Memory_restrictions_weak)) ==
+		    coyotos_Memory_restrictions_readOnly));
+
+    if (invalidCap && !forWrite) {
+      // A read of untouched memory.  Map the shared zero object until
+      // the first write.
+      if (!coyotos_AddressSpace_setSlot(cap, slot, 
+					wantCap ? CR_ZEROCAPPAGE : CR_ZEROPAGE))
+	return false;
+      stats.zeroMapped++;
+      return true;
+    }
+
+    if (isZero && ahead)
+      return false;  // leave it shared until it is written
+
     if (restr & (coyotos_Memory_restrictions_readOnly | 
 		 coyotos_Memory_restrictions_weak)) {
       
@@ -315,11 +456,6 @@ process_fault(uint64_t addr, bool wantCap)
 		   coyotos_Memory_restrictions_opaque));
 
       // we need to replace this capability with a strong capability.
-      coyotos_Cap_AllegedType type = 0;
-      if (!coyotos_Cap_getType(next, &type)) {
-	return false;
-      }
-
       coyotos_Range_obType obType = coyotos_Range_obType_otInvalid;
 
       switch (type) {
@@ -344,17 +480,12 @@ process_fault(uint64_t addr, bool wantCap)
       if (obType == coyotos_Range_obType_otInvalid)
 	return false;
 
-      if (!coyotos_SpaceBank_alloc(CR_SPACEBANK,
-				   obType,
-				   coyotos_Range_obType_otInvalid,
-				   coyotos_Range_obType_otInvalid,
-				   spare,
-				   CR_NULL,
-				   CR_NULL))
+      if (!alloc_object(obType, spare))
 	return false;
 
-      // copy the existing data, reduce the cap appropriately, and install it.
-      if (invalidCap) {
+      // copy the existing data, reduce the cap appropriately, and
+      // install it.  A new object is already zero.
+      if (invalidCap || isZero) {
 	if (!coyotos_AddressSpace_setSlot(cap, slot, spare)) {
 	  (void) coyotos_SpaceBank_free(CR_SPACEBANK, 1, 
 					spare, CR_NULL, CR_NULL);
@@ -370,28 +501,40 @@ process_fault(uint64_t addr, bool wantCap)
 
       // if we've upgraded a page, we're all done.
       if (obType == coyotos_Range_obType_otPage ||
-	  obType == coyotos_Range_obType_otCapPage)
+	  obType == coyotos_Range_obType_otCapPage) {
+	stats.pagesCopied++;
+	if (isZero)
+	  stats.zeroUpgrades++;
 	return true;
+      }
+      stats.gptsAdded++;
 
-      continue; // re-process with new cap
+      continue; // re-walk with new cap
     }
 
-    // To prevent infinite recursion, we require that address spaces
-    // continually reduce l2v.
-    if (l2v >= lastl2v) {
-      return false;
-    }
-    lastl2v = l2v;
+    // The walk stopped at a strong capability we cannot fault in:  a
+    // page that is already writable, or a GPT it could not descend
+    // into because the space below is malformed or too deep.
+    return false;
+  }
+}
+
+/// Copy up to faultAhead pages following the one at @p addr, which
+/// has just taken a write fault.  Sequential writes into a freshly
+/// copied space then take one fault per run rather than one per page.
+static void
+fault_ahead(uint64_t addr)
+{
+  uint64_t base = addr & ~(uint64_t)COYOTOS_PAGE_ADDR_MASK;
 
-    // we're traversing *into* a GPT.  Since the guard is zero, and
-    // we match it, we just need to update the address and swap around
-    // our caps.
-    addr = remaddr;
+  for (uint32_t i = 1; i <= faultAhead; i++) {
+    uint64_t next = base + (uint64_t)i * COYOTOS_PAGE_SIZE;
+    if (next < base)
+      break;		// wrapped
 
-    cap = next;
-    next = spare;
-    spare = next_spare;
-    next_spare = cap;
+    if (!process_fault(next, false, true, true))
+      break;
+    stats.pagesAhead++;
   }
 }
 
@@ -399,17 +542,24 @@ IDL_SERVER_HANDLER_PREDECL void
 HANDLE_coyotos_MemoryHandler_handle(caploc_t proc,
 				    coyotos_Process_FC faultCode,
 				    uint64_t faultInfo,
+				    bool forWrite,
 				    ISE *_env)
 {
   bool clearFault = false;
 
+  stats.faults++;
+
   switch (faultCode) {
   case coyotos_Process_FC_InvalidDataReference:
+    clearFault = process_fault(faultInfo, false, forWrite, false);
+    break;
   case coyotos_Process_FC_AccessViolation:
-    clearFault = process_fault(faultInfo, false);
+    clearFault = process_fault(faultInfo, false, true, false);
+    if (clearFault)
+      fault_ahead(faultInfo);
     break;
   case coyotos_Process_FC_InvalidCapReference:
-    clearFault = process_fault(faultInfo, true);
+    clearFault = process_fault(faultInfo, true, forWrite, false);
     break;
 
   default:
@@ -445,7 +595,13 @@ initialize(void)
 
   if (!coyotos_AddressSpace_getSlot(CR_TOOLS, 
 				    coyotos_VirtualCopySpace_TOOL_BACKGROUND,
-				    CR_BGGPT))
+				    CR_BGGPT) ||
+      !coyotos_AddressSpace_getSlot(CR_TOOLS, 
+				    coyotos_VirtualCopySpace_TOOL_ZEROPAGE,
+				    CR_ZEROPAGE) ||
+      !coyotos_AddressSpace_getSlot(CR_TOOLS, 
+				    coyotos_VirtualCopySpace_TOOL_ZEROCAPPAGE,
+				    CR_ZEROCAPPAGE))
     goto fail;
 
   if (!coyotos_Memory_getGuard(CR_BGGPT, &theGuard)) {
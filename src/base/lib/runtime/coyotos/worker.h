@@ -0,0 +1,70 @@
+#ifndef __COYOTOS_WORKER_H__
+#define __COYOTOS_WORKER_H__
+
+/*
+ * Copyright (C) 2007, The EROS Group, LLC
+ *
+ * This file is part of the Coyotos Operating System.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** @file 
+ * @brief interface definition for worker processes that share the
+ * address space of their creator.
+ **/
+
+#include <coyotos/coytypes.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/** @brief Start a worker process running @p fn(@p arg).
+ *
+ * The worker is allocated from CR_SPACEBANK, and shares this
+ * process's address space, schedule, fault handler, and application
+ * capability registers. It runs on the stack [@p stack, @p stack +
+ * @p stackSize), which must not be used for anything else while the
+ * worker lives. @p fn must not return.
+ *
+ * The worker gets a reply endpoint of its own in CR_REPLYEPT, and a
+ * new endpoint with endpoint ID @p epID in CR_INITEPT. Both name the
+ * worker as their recipient. An endpoint delivers to a single
+ * process, so a server wanting several workers to serve its clients
+ * must hand out entry capabilities made from the workers'
+ * endpoints.
+ *
+ * On success, a capability to the worker's process is left in @p
+ * proc, and a capability to its CR_INITEPT endpoint is left in @p
+ * ep. @p tmp is clobbered. Returns false if an allocation or setup
+ * step fails; the caller should then destroy or free @p proc.
+ *
+ * The capability temporaries of captemp_alloc() are not safe to use
+ * from more than one process sharing an address space.
+ */
+bool coyotos_worker_spawn(void (*fn)(void *), void *arg,
+			  void *stack, size_t stackSize,
+			  uint64_t epID, caploc_t proc, caploc_t ep,
+			  caploc_t tmp);
+
+/** @brief Architecture-specific part of coyotos_worker_spawn().
+ *
+ * Builds the initial call frame for @p fn(@p arg) on the stack, and
+ * loads the register set of @p proc so that it will begin executing
+ * @p fn on that stack.
+ */
+bool __rt_worker_setregs(caploc_t proc, void (*fn)(void *), void *arg,
+			 void *stack, size_t stackSize);
+
+#endif /* __COYOTOS_WORKER_H__ */
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2007, The EROS Group, LLC.
+ *
+ * This file is part of the Coyotos Operating System.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** @file
+ * @brief Start worker processes that share our address space.
+ */
+
+#include <idl/coyotos/SpaceBank.h>
+#include <idl/coyotos/Endpoint.h>
+#include <idl/coyotos/Process.h>
+
+#include "coyotos/runtime.h"
+#include "coyotos/worker.h"
+
+/** @brief Process slots the worker copies from us.  The address
+ * space is installed last, by setSpaceAndPC, since that starts the
+ * worker running.
+ */
+static const coyotos_Process_cslot shared_slots[] = {
+  coyotos_Process_cslot_handler,
+  coyotos_Process_cslot_schedule,
+  coyotos_Process_cslot_ioSpace,
+  coyotos_Process_cslot_cohort,
+};
+
+/** @brief Allocate an endpoint whose recipient is @p proc into @p out */
+static bool
+alloc_endpoint(caploc_t proc, caploc_t out)
+{
+  return
+    coyotos_SpaceBank_alloc(CR_SPACEBANK,
+			    coyotos_Range_obType_otEndpoint,
+			    coyotos_Range_obType_otInvalid,
+			    coyotos_Range_obType_otInvalid,
+			    out,
+			    CR_NULL,
+			    CR_NULL) &&
+    coyotos_Endpoint_setRecipient(out, proc);
+}
+
+bool
+coyotos_worker_spawn(void (*fn)(void *), void *arg,
+		     void *stack, size_t stackSize,
+		     uint64_t epID, caploc_t proc, caploc_t ep,
+		     caploc_t tmp)
+{
+  size_t i;
+  uint32_t reg;
+
+  if (!coyotos_SpaceBank_allocProcess(CR_SPACEBANK, CR_NULL, proc))
+    return false;
+
+  for (i = 0; i < sizeof (shared_slots) / sizeof (shared_slots[0]); i++)
+    if (!coyotos_Process_getSlot(CR_SELF, shared_slots[i], tmp) ||
+	!coyotos_Process_setSlot(proc, shared_slots[i], tmp))
+      return false;
+
+  /* Copy the runtime and application registers. The worker's own
+   * process and endpoints are filled in below. The IDL registers
+   * are per-invocation, and need not be copied. */
+  for (reg = CRN_NULL + 1; reg <= CRN_LASTAPP; reg++) {
+    if (reg == CRN_REPLYEPT || reg == CRN_SELF || reg == CRN_INITEPT)
+      continue;
+    if (!coyotos_Process_getCapReg(CR_SELF, reg, tmp) ||
+	!coyotos_Process_setCapReg(proc, reg, tmp))
+      return false;
+  }
+
+  if (!coyotos_Process_setCapReg(proc, CRN_SELF, proc))
+    return false;
+
+  /* Replies to the worker's calls must come back to the worker. */
+  if (!alloc_endpoint(proc, tmp) ||
+      !coyotos_Endpoint_setPayloadMatch(tmp) ||
+      !coyotos_Process_setCapReg(proc, CRN_REPLYEPT, tmp))
+    return false;
+
+  if (!alloc_endpoint(proc, ep) ||
+      !coyotos_Endpoint_setEndpointID(ep, epID) ||
+      !coyotos_Process_setCapReg(proc, CRN_INITEPT, ep))
+    return false;
+
+  if (!__rt_worker_setregs(proc, fn, arg, stack, stackSize))
+    return false;
+
+  return
+    coyotos_Process_getSlot(CR_SELF, coyotos_Process_cslot_addrSpace, tmp) &&
+    coyotos_Process_setSpaceAndPC(proc, tmp, (uintptr_t) fn);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2007, The EROS Group, LLC.
+ *
+ * This file is part of the Coyotos Operating System.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** @file
+ * @brief i386 register setup for worker processes.
+ */
+
+#include <idl/coyotos/i386/Process.h>
+
+#include "coyotos/runtime.h"
+
+#include "coyotos/worker.h"
+
+bool
+__rt_worker_setregs(caploc_t proc, void (*fn)(void *), void *arg,
+		    void *stack, size_t stackSize)
+{
+  coyotos_i386_Process_fixregs regs;
+
+  /* Start from our own registers, so that the segment selectors and
+   * flags are ones the kernel will accept. */
+  if (!coyotos_i386_Process_getFixRegs(CR_SELF, &regs))
+    return false;
+
+  /* Build the frame fn() expects on entry: a return address, which
+   * is null since fn must not return, followed by its argument. */
+  uintptr_t sp = ((uintptr_t)stack + stackSize) & ~(uintptr_t)15;
+  sp -= 2 * sizeof (uintptr_t);
+  ((uintptr_t *)sp)[0] = 0;
+  ((uintptr_t *)sp)[1] = (uintptr_t)arg;
+
+  regs.EAX = 0;
+  regs.EBX = 0;
+  regs.ECX = 0;
+  regs.EDX = 0;
+  regs.ESI = 0;
+  regs.EDI = 0;
+  regs.EBP = 0;
+  regs.ESP = sp;
+  regs.EIP = (uintptr_t)fn;
+
+  return coyotos_i386_Process_setFixRegs(proc, regs);
+}
@@ -119,6 +119,7 @@ static void
 HANDLE_coyotos_MemoryHandler_handle(caploc_t proc,
 				    coyotos_Process_FC faultCode,
 				    uint64_t faultInfo,
+				    bool forWrite,
 				    struct IDL_SERVER_Environment *_env)
 {
   log_message("MemoryHandler\n");  
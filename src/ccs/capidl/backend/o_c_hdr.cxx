@@ -27,6 +27,7 @@
 #include <string>
 #include <ostream>
 #include <fstream>
+#include <vector>
 
 #define REGISTER_ALIGN_BY_HOLE
 
@@ -1737,9 +1738,99 @@ emit_server_if_union(GCPtr<Symbol> s, INOstream& out)
   out << "\n";
 }
 
+/* Opcodes are 32-bit hashes of the qualified method name, so a
+ * switch on them compiles to a tree of comparisons. Look for a
+ * multiplier that sends the opcodes of an interface to distinct
+ * slots of a small power-of-two table. A switch on the slot number
+ * is dense, and compiles to a single indexed jump. The table is
+ * allowed to be up to eight times larger than the opcode count. */
+static bool
+find_opcode_hash(const std::vector<uint32_t>& opCodes,
+		 uint32_t& mult, unsigned& l2slots)
+{
+  unsigned minl2 = 1;
+  while ((1u << minl2) < opCodes.size())
+    minl2++;
+
+  for (unsigned l2 = minl2; l2 <= minl2 + 3 && l2 < 32; l2++) {
+    for (uint32_t k = 0; k < 4096; k++) {
+      uint32_t m = 0x9e3779b1u + 2 * k;
+      std::vector<bool> used(1u << l2, false);
+      bool ok = true;
+
+      for (size_t i = 0; ok && i < opCodes.size(); i++) {
+	uint32_t slot = (uint32_t)(opCodes[i] * m) >> (32 - l2);
+	if (used[slot])
+	  ok = false;
+	used[slot] = true;
+      }
+
+      if (ok) {
+	mult = m;
+	l2slots = l2;
+	return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+static void
+emit_server_if_dispatch_case(GCPtr<Symbol> child, bool checkOpCode,
+			     INOstream& out)
+{
+  ArgInfo args;
+  extract_args(child, args);
+
+  out << "{\n";
+  out.more();
+  if (checkOpCode) {
+    out << "if (_opCode != OC_" << child->QualifiedName('_') << ")\n";
+    out.more();
+    out << "break;\n";
+    out.less();
+  }
+  out << "_IDL_DEMARSHALL_" << child->QualifiedName('_') << "(\n"
+      << "    &_params->" << child->name << ", _env,\n"
+      << "    HANDLE_" << child->QualifiedName('_');
+
+  if (args.out.indirectBytes)
+    out << ",\n"
+	<< "    CLEANUP_" << child->QualifiedName('_');
+  out << ");\n"
+      << "return;\n";
+  out.less();
+  out << "}\n";
+}
+
 static void
 emit_server_if_dispatch_proc(GCPtr<Symbol> s, INOstream& out)
 {
+  /* The operations of this interface and of every interface it
+   * inherits from, flattened into a single table. */
+  std::vector<GCPtr<Symbol> > ops;
+  std::vector<uint32_t> opCodes;
+
+  for (GCPtr<Symbol> ifsym = s; ifsym; ifsym = ifsym->baseType) {
+    for(size_t i = 0; i < ifsym->children.size(); i++) {
+      GCPtr<Symbol> child = ifsym->children[i];
+
+      if (child->cls != sc_operation && child->cls != sc_oneway)
+	continue;
+
+      if (child->flags & SF_NO_OPCODE)
+	continue;
+
+      ops.push_back(child);
+      opCodes.push_back((uint32_t) child->CodedName());
+    }
+  }
+
+  uint32_t mult = 0;
+  unsigned l2slots = 0;
+  bool hashed = find_opcode_hash(opCodes, mult, l2slots);
+
   out << "static inline void\n"
       << "_IDL_IFDISPATCH_" << s->QualifiedName('_') << "(\n"
       << "    _IDL_IFUNION_" << s->QualifiedName('_') << " *_params,\n"
@@ -1747,58 +1838,52 @@ emit_server_if_dispatch_proc(GCPtr<Symbol> s, INOstream& out)
       << "{\n";
   {
     out.more();
-    out << "switch(_params->_pb.pw[IPW_OPCODE]) {\n";
-    for (GCPtr<Symbol> ifsym = s; ifsym; ifsym = ifsym->baseType) {
-      for(size_t i = 0; i < ifsym->children.size(); i++) {
-	GCPtr<Symbol> child = ifsym->children[i];
-
-	if (child->cls != sc_operation && child->cls != sc_oneway)
-	  continue;
-
-	if (child->flags & SF_NO_OPCODE)
-	  continue;
+    out << "uint32_t _opCode = _params->_pb.pw[IPW_OPCODE];\n"
+	<< "\n";
 
-	ArgInfo args;
-	extract_args(child, args);
+    if (hashed) {
+      out << "/* " << ops.size() << " operations in "
+	  << (1u << l2slots) << " slots */\n"
+	  << "switch ((uint32_t)(_opCode * 0x"
+	  << std::hex << mult << std::dec << "u) >> "
+	  << (32 - l2slots) << ") {\n";
 
+      for (uint32_t slot = 0; slot < (1u << l2slots); slot++) {
+	for (size_t i = 0; i < ops.size(); i++) {
+	  if (((uint32_t)(opCodes[i] * mult) >> (32 - l2slots)) != slot)
+	    continue;
 
-	out << "case OC_" << child->QualifiedName('_') <<":\n";
-	{
-	  out.more();
-	  out << "{\n";
+	  out << "case " << slot << ": /* "
+	      << ops[i]->QualifiedName('.') << " */\n";
 	  out.more();
-	  out << "_IDL_DEMARSHALL_" << child->QualifiedName('_') << "(\n"
-	      << "    &_params->" << child->name << ", _env,\n"
-	      << "    HANDLE_" << child->QualifiedName('_');
-
-
-	  if (args.out.indirectBytes)
-	    out << ",\n"
-		<< "    CLEANUP_" << child->QualifiedName('_');
-	  out << ");\n"
-	      << "break;\n";
-	  out.less();
-	  out << "}\n";
+	  emit_server_if_dispatch_case(ops[i], true, out);
 	  out.less();
 	}
       }
     }
-    out << "default:\n";
-    {
-      out.more();
-      out << "{\n";
-      out.more();
-      out << "_params->_except.icw =\n"
-	  << "  IPW0_MAKE_LDW((sizeof(_params->_except)/sizeof(uintptr_t))-1)\n"
-	  << "  |IPW0_EX|IPW0_SP;\n"
-	  << "_params->_except.exceptionCode = RC_coyotos_Cap_UnknownRequest;\n"
-	  << "_params->_pb.sndLen = 0;\n"
-	  << "break;\n";
-      out.less();
-      out << "}\n";
-      out.less();
+    else {
+      out << "switch(_opCode) {\n";
+
+      for (size_t i = 0; i < ops.size(); i++) {
+	out << "case OC_" << ops[i]->QualifiedName('_') <<":\n";
+	out.more();
+	emit_server_if_dispatch_case(ops[i], false, out);
+	out.less();
+      }
     }
-    out << "}\n";
+
+    out << "default:\n";
+    out.more();
+    out << "break;\n";
+    out.less();
+    out << "}\n"
+	<< "\n";
+
+    out << "_params->_except.icw =\n"
+	<< "  IPW0_MAKE_LDW((sizeof(_params->_except)/sizeof(uintptr_t))-1)\n"
+	<< "  |IPW0_EX|IPW0_SP;\n"
+	<< "_params->_except.exceptionCode = RC_coyotos_Cap_UnknownRequest;\n"
+	<< "_params->_pb.sndLen = 0;\n";
     out.less();
     out << "}\n";
     out << "\n";
@@ -3171,17 +3256,32 @@ emit_active_if_legs(GCPtr<Symbol> s, INOstream& out)
 }
 
 static void
-emit_active_if_switch_cases(GCPtr<Symbol> s, INOstream& out)
+emit_active_if_dispatchers(GCPtr<Symbol> s, INOstream& out)
 {
   if (!s->isActiveUOC)
     return;
 
-  out << "case IKT_" << s->QualifiedName('_') << ":\n";
+  out << "static void\n"
+      << "dispatch_" << s->QualifiedName('_')
+      << "(_IDL_GRAND_SERVER_UNION *gsu,\n"
+      << "    struct IDL_SERVER_Environment *_env)\n"
+      << "{\n";
   out.more();
   out << "_IDL_IFDISPATCH_" << s->QualifiedName('_')
-      << "(&gsu." << s->QualifiedName('_') << ", _env);\n"
-      << "break;\n";
+      << "(&gsu->" << s->QualifiedName('_') << ", _env);\n";
   out.less();
+  out << "}\n"
+      << "\n";
+}
+
+static void
+emit_active_if_table_entries(GCPtr<Symbol> s, INOstream& out)
+{
+  if (!s->isActiveUOC)
+    return;
+
+  out << "{ IKT_" << s->QualifiedName('_')
+      << ", dispatch_" << s->QualifiedName('_') << " },\n";
 }
 
 void
@@ -3216,6 +3316,8 @@ output_c_template(GCPtr<Symbol> globalScope, BackEndFn fn)
       << "#include <coyotos/syscall.h>\n"
       << "#include <coyotos/runtime.h>\n"
       << "#include <coyotos/reply_create.h>\n"
+      << "#include <coyotos/worker.h>\n"
+      << "#include <coyotos/captemp.h>\n"
       << "\n"
       << "#include <idl/coyotos/SpaceBank.h>\n"
       << "#include <idl/coyotos/Endpoint.h>\n"
@@ -3237,12 +3339,7 @@ output_c_template(GCPtr<Symbol> globalScope, BackEndFn fn)
   out.less();
   out << "} _IDL_GRAND_SERVER_UNION;\n";
 
-  out << "\n"
-      << "/* You should supply a function that selects an interface\n"
-      << " * type based on the incoming endpoint ID and protected\n"
-      << " * payload */\n"
-      << "extern uint64_t choose_if(uint64_t epID, uint32_t pp);\n"
-      << "\n";
+  out << "\n";
 
   out << "/* The IDL_SERVER_Environment structure type is something\n"
       << " * that you should extend to hold any \"extra\" information\n"
@@ -3262,6 +3359,49 @@ output_c_template(GCPtr<Symbol> globalScope, BackEndFn fn)
       << "uint64_t epID;\n";
   out.less();
   out << "} IDL_SERVER_Environment;\n"
+      << "\n";
+
+  server_template_symdump(globalScope, out, emit_active_if_dispatchers);
+
+  out << "/* The interfaces served, indexed by protected payload.\n"
+      << " * Reorder the entries to match the PP values of the entry\n"
+      << " * capabilities you hand out, and extend choose_if_index() if\n"
+      << " * the endpoint ID matters too. Both choose_if() and the\n"
+      << " * dispatch loop index this table, so selecting the interface\n"
+      << " * for a request is a single indexed jump. Other requests\n"
+      << " * get UnknownRequest.\n"
+      << " */\n"
+      << "static const struct {\n";
+  out.more();
+  out << "uint64_t ikt;\n"
+      << "void (*dispatch)(_IDL_GRAND_SERVER_UNION *,\n"
+      << "    struct IDL_SERVER_Environment *);\n";
+  out.less();
+  out << "} if_byPP[] = {\n";
+  out.more();
+  server_template_symdump(globalScope, out, emit_active_if_table_entries);
+  out.less();
+  out << "};\n"
+      << "\n"
+      << "#define NUM_IF_BYPP (sizeof(if_byPP) / sizeof(if_byPP[0]))\n"
+      << "\n"
+      << "static inline size_t\n"
+      << "choose_if_index(uint64_t epID, uint32_t pp)\n"
+      << "{\n";
+  out.more();
+  out << "return pp;\n";
+  out.less();
+  out << "}\n"
+      << "\n"
+      << "uint64_t\n"
+      << "choose_if(uint64_t epID, uint32_t pp)\n"
+      << "{\n";
+  out.more();
+  out << "size_t i = choose_if_index(epID, pp);\n"
+      << "\n"
+      << "return (i < NUM_IF_BYPP) ? if_byPP[i].ikt : IKT_coyotos_Cap;\n";
+  out.less();
+  out << "}\n"
       << "\n"
       << "void\n"
       << "ProcessRequests(struct IDL_SERVER_Environment *_env)\n"
@@ -3319,31 +3459,120 @@ output_c_template(GCPtr<Symbol> globalScope, BackEndFn fn)
   out << "}\n";
 
   out << "\n"
-      << "switch(choose_if(gsu.pb.epID, gsu.pb.u.pp)) {\n";
-
-  server_template_symdump(globalScope, out, emit_active_if_switch_cases);
+      << "size_t ifIndex = choose_if_index(gsu.pb.epID, gsu.pb.u.pp);\n"
+      << "\n"
+      << "if (ifIndex < NUM_IF_BYPP) {\n";
+  out.more();
+  out << "if_byPP[ifIndex].dispatch(&gsu, _env);\n"
+      << "continue;\n";
+  out.less();
+  out << "}\n"
+      << "\n"
+      << "gsu.except.icw =\n"
+      << "  IPW0_MAKE_LDW((sizeof(gsu.except)/sizeof(uintptr_t))-1)\n"
+      << "  |IPW0_EX|IPW0_SP;\n"
+      << "gsu.except.exceptionCode = RC_coyotos_Cap_UnknownRequest;\n"
+      << "gsu.pb.sndLen = 0;\n";
+  out.less();
+  out << "}\n";
+  out.less();
+  out << "}\n";
+  out << "\n";
 
-  out << "default:\n";
+  out << "/* Worker processes. Each worker is a separate process sharing\n"
+      << " * this address space, so it has its own capability registers,\n"
+      << " * reply endpoint, stack, and receive buffer (gsu lives on the\n"
+      << " * stack of ProcessRequests), and runs the same dispatch loop.\n"
+      << " * Handlers must lock any global state they share.\n"
+      << " *\n"
+      << " * An endpoint delivers to a single process, so each worker\n"
+      << " * receives on an endpoint of its own with the same endpoint ID\n"
+      << " * as CR_INITEPT, and choose_if() cannot tell them apart. Make\n"
+      << " * every entry capability you hand out with worker_entry_cap(),\n"
+      << " * which deals them out across the workers in turn.\n"
+      << " *\n"
+      << " * By default there are no extra workers, and this process\n"
+      << " * serves every client itself. Define IDL_SERVER_NWORKERS to run\n"
+      << " * more.\n"
+      << " */\n"
+      << "#ifndef IDL_SERVER_NWORKERS\n"
+      << "#define IDL_SERVER_NWORKERS 0\n"
+      << "#endif\n"
+      << "#define IDL_SERVER_WORKER_STACK_SIZE 16384\n"
+      << "\n"
+      << "static struct IDL_SERVER_Environment\n"
+      << "  worker_env[IDL_SERVER_NWORKERS + 1];\n"
+      << "static char\n"
+      << "  worker_stack[IDL_SERVER_NWORKERS + 1][IDL_SERVER_WORKER_STACK_SIZE]\n"
+      << "  __attribute__((aligned(16)));\n"
+      << "\n"
+      << "/* Process and serving endpoint of each worker. Worker 0 is this\n"
+      << " * process, serving on CR_INITEPT. The others live in capability\n"
+      << " * temporaries that are never released. */\n"
+      << "static caploc_t worker_proc[IDL_SERVER_NWORKERS + 1];\n"
+      << "static caploc_t worker_ep[IDL_SERVER_NWORKERS + 1];\n"
+      << "static uint32_t worker_next;\n"
+      << "\n"
+      << "static void\n"
+      << "worker_main(void *arg)\n"
+      << "{\n";
+  out.more();
+  out << "ProcessRequests(arg);\n";
+  out.less();
+  out << "}\n"
+      << "\n"
+      << "/* Make an entry capability with protected payload pp in out,\n"
+      << " * naming each worker's endpoint in turn. Safe to call from any\n"
+      << " * worker. */\n"
+      << "bool\n"
+      << "worker_entry_cap(uint32_t pp, caploc_t out)\n"
+      << "{\n";
+  out.more();
+  out << "size_t i =\n"
+      << "  __sync_fetch_and_add(&worker_next, 1) % (IDL_SERVER_NWORKERS + 1);\n"
+      << "\n"
+      << "return coyotos_Endpoint_makeEntryCap(worker_ep[i], pp, out);\n";
+  out.less();
+  out << "}\n"
+      << "\n"
+      << "/* Start IDL_SERVER_NWORKERS workers, serving endpoint ID epID. */\n"
+      << "bool\n"
+      << "start_workers(uint64_t epID)\n"
+      << "{\n";
+  out.more();
+  out << "size_t i;\n"
+      << "\n"
+      << "worker_proc[0] = CR_SELF;\n"
+      << "worker_ep[0] = CR_INITEPT;\n"
+      << "\n"
+      << "for (i = 1; i <= IDL_SERVER_NWORKERS; i++) {\n";
+  out.more();
+  out << "worker_proc[i] = captemp_alloc();\n"
+      << "worker_ep[i] = captemp_alloc();\n"
+      << "\n"
+      << "unless(\n";
   {
+    out.indent(7);
+    out << "coyotos_worker_spawn(worker_main, &worker_env[i],\n";
+    out.indent(21);
+    out << "worker_stack[i], sizeof(worker_stack[i]),\n"
+	<< "epID, worker_proc[i], worker_ep[i],\n"
+	<< "CR_REPLY1)\n";
+    out.indent(-21);
+    out << ")";
+    out.indent(-7);
     out.more();
-    out << "{\n";
-    out.more();
-    out << "gsu.except.icw =\n"
-	<< "  IPW0_MAKE_LDW((sizeof(gsu.except)/sizeof(uintptr_t))-1)\n"
-	<< "  |IPW0_EX|IPW0_SP;\n"
-	<< "gsu.except.exceptionCode = RC_coyotos_Cap_UnknownRequest;\n"
-	<< "gsu.pb.sndLen = 0;\n"
-	<< "break;\n";
-    out.less();
-    out << "}\n";
+    out << "return false;\n";
     out.less();
   }
-  out << "}\n";
   out.less();
-  out << "}\n";
+  out << "}\n"
+      << "\n"
+      << "return true;\n";
   out.less();
-  out << "}\n";
-  out << "\n";
+  out << "}\n"
+      << "\n";
+
   out << "static inline bool\n"
       << "exit_gracelessly(errcode_t errCode)\n"
       << "{\n";
@@ -3359,15 +3588,20 @@ output_c_template(GCPtr<Symbol> globalScope, BackEndFn fn)
       << "initialize()\n"
       << "{\n";
   out.more();
-  out << "unless(\n";
+  out << "/* Endpoint ID 1 matches the initial endpoint in CR_INITEPT */\n"
+      << "unless(start_workers(1))\n";
+  out.more();
+  out << "exit_gracelessly(IDL_exceptCode);\n";
+  out.less();
+  out << "\n"
+      << "unless(\n";
   {
     out.indent(7);
     out << "/* Set up our entry capability */\n"
-	<< "coyotos_Endpoint_makeEntryCap(CR_INITEPT,\n";
-    out.indent(30);
-    out << "1 /* Insert your PP value here */,\n"
-	<< "CR_REPLY0)\n";
-    out.indent(-30);
+	<< "worker_entry_cap(1 /* Insert your PP value here */,\n";
+    out.indent(17);
+    out << "CR_REPLY0)\n";
+    out.indent(-17);
     out << ")";
     out.indent(-7);
     out.more();
@@ -3386,14 +3620,12 @@ output_c_template(GCPtr<Symbol> globalScope, BackEndFn fn)
       << "main(int argc, char *argv[])\n"
       << "{\n";
   out.more();
-  out << "struct IDL_SERVER_Environment ise;\n"
-      << "\n"
-      << "if (!initialize())\n";
+  out << "if (!initialize())\n";
   out.more();
   out << "return 0;\n";
   out.less();
   out << "\n";
-  out << "ProcessRequests(&ise);\n"
+  out << "ProcessRequests(&worker_env[0]);\n"
       << "\n"
       << "return 0;\n";
   out.less();
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2007, The EROS Group, LLC.
+ *
+ * This file is part of the Coyotos Operating System.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** @file
+ * @brief Convert kernel event trace records to Chrome trace JSON.
+ *
+ * Input files hold raw EvtTraceRecords, as returned by
+ * KernLog.readTrace, in any order and from any mix of CPUs. The
+ * output can be loaded into chrome://tracing or Perfetto. Each CPU
+ * is shown as a thread. Every event appears as an instant event, and
+ * the stretches between a process being dispatched and its next
+ * entry into the kernel appear as slices named after the process.
+ *
+ * The records are assumed to have the byte order of the host.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <coyotos/evtrace.h>
+
+using namespace std;
+
+static const char *evtNames[ety_NTYPE] = {
+  "None",
+  "Halt",
+  "Trap",
+  "TrapRet",
+  "RunProc",
+  "PageFault",
+  "MapSwitch",
+  "RestartTX",
+  "AbandonTX",
+  "UserPreempt",
+  "KernPreempt",
+  "IpcSend",
+  "IpcRecv",
+  "ProcFault",
+  "Wakeup",
+  "LockDefer",
+};
+
+struct option longopts[] = {
+  { "help",                 0,  0, 'h' },
+  { "mhz",                  1,  0, 'm' },
+  { "output",               1,  0, 'o' },
+  {0,                       0,  0, 0}
+};
+
+void
+help()
+{
+  std::cerr 
+    << "Usage:" << endl
+    << "  evtdecode [-m mhz] [-o outfile] tracefile...\n"
+    << "      Converts kernel event trace records to Chrome trace JSON.\n"
+    << "      mhz is the cycle counter rate, used to convert to\n"
+    << "      microseconds (default 1000).\n"
+    << "  evtdecode -h|--help\n"
+    << flush;
+}
+
+static bool
+by_tsc(const EvtTraceRecord& a, const EvtTraceRecord& b)
+{
+  return a.tsc < b.tsc;
+}
+
+static bool
+read_records(const char *path, vector<EvtTraceRecord>& recs)
+{
+  ifstream in(path, ios::in | ios::binary);
+  if (!in) {
+    cerr << "evtdecode: cannot open " << path << endl;
+    return false;
+  }
+
+  EvtTraceRecord rec;
+  while (in.read((char *) &rec, sizeof(rec))) {
+    if (rec.type == ety_None)
+      continue;
+    recs.push_back(rec);
+  }
+
+  if (in.gcount() != 0)
+    cerr << "evtdecode: " << path << ": ignoring trailing partial record"
+	 << endl;
+
+  return true;
+}
+
+static void
+emit_common(ostream& out, const char *ph, const string& name, 
+	    unsigned cpu, double ts)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.3f", ts);
+
+  out << "  {\"ph\":\"" << ph << "\",\"name\":\"" << name
+      << "\",\"pid\":0,\"tid\":" << cpu << ",\"ts\":" << buf;
+}
+
+static string
+hex(uint64_t v)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long) v);
+  return buf;
+}
+
+int
+main(int argc, char *argv[]) 
+{
+  int c;
+  double mhz = 1000.0;
+  const char *outName = 0;
+
+  while ((c = getopt_long(argc, argv, "hm:o:", longopts, 0)) != -1) {
+    switch(c) {
+    case 'm':
+      mhz = strtod(optarg, 0);
+      if (mhz <= 0) {
+	cerr << "evtdecode: bad --mhz value" << endl;
+	exit(1);
+      }
+      break;
+    case 'o':
+      outName = optarg;
+      break;
+    case 'h':
+      help();
+      exit(0);
+    default:
+      help();
+      exit(1);
+    }
+  }
+
+  if (optind == argc) {
+    help();
+    exit(1);
+  }
+
+  vector<EvtTraceRecord> recs;
+  for (int i = optind; i < argc; i++)
+    if (!read_records(argv[i], recs))
+      exit(1);
+
+  stable_sort(recs.begin(), recs.end(), by_tsc);
+
+  ofstream outFile;
+  if (outName) {
+    outFile.open(outName);
+    if (!outFile) {
+      cerr << "evtdecode: cannot create " << outName << endl;
+      exit(1);
+    }
+  }
+  ostream& out = outName ? outFile : cout;
+
+  uint64_t base = recs.empty() ? 0 : recs[0].tsc;
+
+  /* Process running on each CPU, and when it was dispatched. */
+  map<unsigned, EvtTraceRecord> running;
+
+  out << "{\"traceEvents\":[\n";
+  bool first = true;
+
+  for (size_t i = 0; i < recs.size(); i++) {
+    const EvtTraceRecord& r = recs[i];
+    double ts = (r.tsc - base) / mhz;
+
+    /* Close the user-mode slice on this CPU when it re-enters the
+       kernel or switches process. */
+    if (r.type == ety_Trap || r.type == ety_PageFault || 
+	r.type == ety_RunProc) {
+      map<unsigned, EvtTraceRecord>::iterator it = running.find(r.cpu);
+      if (it != running.end()) {
+	double start = (it->second.tsc - base) / mhz;
+	char dur[64];
+	snprintf(dur, sizeof(dur), "%.3f", ts - start);
+
+	if (!first) out << ",\n";
+	first = false;
+	emit_common(out, "X", "proc " + hex(it->second.v0), r.cpu, start);
+	out << ",\"dur\":" << dur << "}";
+	running.erase(it);
+      }
+    }
+
+    if (r.type == ety_RunProc)
+      running[r.cpu] = r;
+
+    string name = (r.type < ety_NTYPE) ? evtNames[r.type] : 
+      "Event" + hex(r.type);
+
+    if (!first) out << ",\n";
+    first = false;
+    emit_common(out, "i", name, r.cpu, ts);
+    out << ",\"s\":\"t\",\"args\":{\"v0\":\"" << hex(r.v0)
+	<< "\",\"v1\":\"" << hex(r.v1)
+	<< "\",\"v2\":\"" << hex(r.v2)
+	<< "\",\"tsc\":" << r.tsc << "}}";
+  }
+
+  out << "\n]}\n";
+
+  return 0;
+}
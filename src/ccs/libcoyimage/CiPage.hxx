@@ -48,7 +48,8 @@ struct CiPage : public sherpa::Countable {
 //
 // It would be really nice to only write out page data if the page was
 // non-zero.  Unfortunately, this interacts badly with the
-// serialization code.  For now, it's #ifdefed out.
+// serialization code.  For now, it's #ifdefed out. Zero pages are
+// instead elided by the image page table (see CoyImage::ToFile()).
 //
 inline sherpa::oBinaryStream&
 operator<<(sherpa::oBinaryStream& obs, const CiPage& page)
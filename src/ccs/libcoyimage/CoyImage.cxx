@@ -26,6 +26,7 @@
 #include <string.h>
 #include <iostream>
 #include <fstream>
+#include <map>
 
 #include "CoyImage.hxx"
 #include <libsherpa/UExcept.hxx>
@@ -53,6 +54,30 @@ howmany(size_t a, size_t b)
   return ((a + b - 1)/b);
 }
 
+/// FNV-1a hash of a page, used to find candidate duplicate pages.
+static uint64_t
+page_hash(const CiPage& pg)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+
+  for (size_t i = 0; i < pg.pgSize; i++) {
+    h ^= pg.data[i];
+    h *= 0x100000001b3ull;
+  }
+
+  return h;
+}
+
+static bool
+page_is_zero(const CiPage& pg)
+{
+  for (size_t i = 0; i < pg.pgSize; i++)
+    if (pg.data[i] != 0)
+      return false;
+
+  return true;
+}
+
 static bool
 alloc_ascending(const CiAlloc& a1, const CiAlloc& a2)
 {
@@ -163,9 +188,60 @@ CoyImage::ToFile(sherpa::Path p)
       howmany(vec.alloc.size() * CiAlloc::AllocEntrySize, target.pageSize);
   }
 
+  // Build the page table. Page 0 (the header) is always frame 0. Zero
+  // data pages get no frame, and a data page whose content matches an
+  // earlier one shares its frame. The bank and allocation pages are
+  // serialized directly rather than from their CiPage objects, so
+  // each of them gets a frame of its own, as does each capability
+  // page. Frames are assigned in order of first use; the kernel
+  // loader relies on this.
+  std::vector<uint32_t> pageTable;
+  std::vector<size_t> frameToPage; // data frames only
+  std::map<uint64_t, std::vector<uint32_t> > framesByHash;
+  uint32_t nFrame = 0;
+
+  pageTable.push_back(nFrame++);
+  frameToPage.push_back(0);
+
+  for (size_t i = 1; i < originalPages; i++) {
+    const CiPage& pg = *vec.page[i];
+
+    if (page_is_zero(pg)) {
+      pageTable.push_back(COYIMG_ZERO_PAGE);
+      continue;
+    }
+
+    std::vector<uint32_t>& candidates = framesByHash[page_hash(pg)];
+    uint32_t frame = COYIMG_ZERO_PAGE;
+
+    for (size_t c = 0; c < candidates.size(); c++) {
+      const CiPage& other = *vec.page[frameToPage[candidates[c]]];
+      if (memcmp(pg.data, other.data, pg.pgSize) == 0) {
+	frame = candidates[c];
+	break;
+      }
+    }
+
+    if (frame == COYIMG_ZERO_PAGE) {
+      frame = nFrame++;
+      frameToPage.push_back(i);
+      candidates.push_back(frame);
+    }
+
+    pageTable.push_back(frame);
+  }
+
+  for (size_t i = originalPages; i < vec.page.size(); i++)
+    pageTable.push_back(nFrame++);
+
+  for (size_t i = 0; i < vec.capPage.size(); i++)
+    pageTable.push_back(nFrame++);
+
+  size_t nTablePages = 
+    howmany(pageTable.size() * sizeof(uint32_t), target.pageSize);
+
   uint32_t totalBytes = 
-    vec.page.size() * target.pageSize +
-    vec.capPage.size() * target.pageSize +
+    (nFrame + nTablePages) * target.pageSize +
     vec.gpt.size() * sizeof(ExGPT) +
     vec.endpt.size() * sizeof(ExEndpoint) +
     vec.proc.size() * sizeof(ExProcess);
@@ -175,7 +251,7 @@ CoyImage::ToFile(sherpa::Path p)
 
   obs << "coyimage"		// magic string
       << target.endian          // target-specific endian value
-      << (uint32_t) 1		// image version number
+      << (uint32_t) COYIMG_VERSION // image version number
       << target.no		// target architecture
       << target.pageSize	// target page size
       << (uint32_t) vec.alloc.size()
@@ -193,7 +269,8 @@ CoyImage::ToFile(sherpa::Path p)
       << (uint64_t) originalPages + nBankPages // symbol table start
       << (uint64_t) originalPages + nBankPages + 0 // string table start
       << (uint64_t) originalPages + nBankPages + 0 + 0 // alloc table start
-      << (uint64_t) originalPages + nBankPages + 0 + 0 + nAllocPages; // end
+      << (uint64_t) originalPages + nBankPages + 0 + 0 + nAllocPages // end
+      << nFrame;
 
   // End of page 0 content. Align up to end of page:
   obs.align(target.pageSize);
@@ -201,9 +278,13 @@ CoyImage::ToFile(sherpa::Path p)
   // Write the objects in order of object frame type number 
   {
     // We need to handle the page vector specially. Page 0 has already
-    // been written (the header):
-    for (size_t i = 1; i < originalPages; i++)
-      obs << *vec.page[i];
+    // been written (the header). Only the first page to use each
+    // frame is written:
+    for (size_t i = 1; i < originalPages; i++) {
+      uint32_t frame = pageTable[i];
+      if (frame != COYIMG_ZERO_PAGE && frameToPage[frame] == i)
+	obs << *vec.page[i];
+    }
 
     obs.align(target.pageSize);
 
@@ -229,6 +310,11 @@ CoyImage::ToFile(sherpa::Path p)
   // Round up to page boundary (should already be there):
   obs.align(target.pageSize);
 
+  for (size_t i = 0; i < pageTable.size(); i++)
+    obs << pageTable[i];
+
+  obs.align(target.pageSize);
+
   for (size_t i = 0; i < vec.gpt.size(); i++)
     obs << *vec.gpt[i];
 
@@ -34,11 +34,11 @@
 
 #include "hwmap.h"
 
-/* This lock is not strictly required, but is preserved for
- * parallelism with other architectures, and also because somebody may
- * do a coldfire multiprocessor someday.
+/* This lock is not strictly required, but is preserved because
+ * somebody may do a coldfire multiprocessor someday. If they do, the
+ * per-producer locking in the i386 hwmap.c is the model to follow.
  */
-spinlock_t mappingListLock;
+static spinlock_t mappingListLock;
 
 Mapping KernMapping;
 Mapping UserMapping[256];	/* One per user ASID. Entry 0 is never used */
@@ -52,6 +52,13 @@ global_tlb_flush()
   local_tlb_flush();
 }
 
+/* There are no global kernel entries to spare. */
+void
+global_tlb_flush_kernel()
+{
+  global_tlb_flush();
+}
+
 void
 global_tlb_flushva(kva_t va)
 {
@@ -199,12 +206,22 @@ memhdr_destroy_products(MemHeader *hdr)
 
 void
 depend_entry_invalidate(const DependEntry *entry, int slot)
+{
+}
+
+void
+depend_entry_flush(bool mayAbandon)
 {
   global_tlb_flush();
 }
 
 void
 rm_whack_pte(struct Mapping *map,  size_t slot)
+{
+}
+
+void
+rm_whack_flush(void)
 {
   global_tlb_flush();
 }
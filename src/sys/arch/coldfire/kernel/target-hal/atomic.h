@@ -107,5 +107,13 @@ atomic_clear_bits(TARGET_HAL_ATOMIC32_T *a, uint32_t mask)
 		       : "cc");
 }
 
+/** @brief Full memory barrier.
+ *
+ * Coldfire is uniprocessor, so only the compiler needs restraining. */
+static inline void
+memory_barrier(void)
+{
+  __asm__ __volatile__("" : : : "memory");
+}
 
 #endif /* COLDFIRE_HAL_ATOMIC_H */
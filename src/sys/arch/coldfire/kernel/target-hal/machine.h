@@ -24,8 +24,17 @@
  * @brief Miscellaneous machine-specific functions.
  */
 
+#include <stdint.h>
 #include <kerninc/ccs.h>
 
+/** @bug ColdFire has no cycle counter. Trace events on this target
+ * are not timestamped. */
+static inline uint64_t
+read_cycle_counter(void)
+{
+  return 0;
+}
+
 /** @brief Halt the processor without rebooting.
  *
  * Implementation is architecture specific.
@@ -143,6 +143,12 @@ local_tlb_flush()
   hwreg_write(COLDFIRE_MMUOR, COLDFIRE_MMUOR_CNL);
 }
 
+static inline void
+local_tlb_flush_global()
+{
+  local_tlb_flush();
+}
+
 static inline void
 local_tlb_flushva(kva_t va)
 {
@@ -182,11 +182,16 @@ cmos_pit_wakeup(VectorInfo *vec, Process *inProc, fixregs_t *saveArea)
 
   //  printf("%s Timer Interrupt!\n", inProc ? "Process" : "Kernel");
 
+  /* Nothing more to do until the running process has used up its
+   * slice, unless a higher priority process is waiting. */
+  if (!sched_tick())
+    return;
+
   /* Preemption has occurred. */
   if (inProc) {
     LOG_EVENT(ety_UserPreempt, inProc, 0, 0);
     atomic_set_bits(&CUR_CPU->flags, CPUFL_WAS_PREEMPTED);
-    rq_add(&mainRQ, inProc, 0);
+    rq_addReady(inProc, 0);
     sched_abandon_transaction();
   }
 
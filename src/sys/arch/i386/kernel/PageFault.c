@@ -36,6 +36,7 @@
 #include <kerninc/pstring.h>
 #include "hwmap.h"
 #include "kva.h"
+#include "IA32/PTE.h"
 
 #define DEBUG_PGFLT if (0)
 #define DEBUG_TRANSMAP if (0)
@@ -97,6 +98,15 @@ typedef const struct PageTableLevel {
   /** @brief Release a PTE value we have been manipulating */
   void (*finishPTE)(pte_t *pte);
 
+  /** @brief Routine to install a large page PTE, mapping the
+   * 2^l2slot bytes at @p content directly, or NULL if this level
+   * cannot hold large pages.
+   *
+   * @p restr will already be masked by the <tt>slot_restr</tt> of the
+   * level below.
+   */
+  bool (*installLarge)(pte_t *pte, kpa_t content, uint8_t restr);
+
 } PageTableLevel;
 
 static pte_t *
@@ -168,7 +178,8 @@ canaryPAE(pte_t *pte)
 }
 
 static bool
-installPAE(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage)
+installPAE_bits(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage,
+		bool isLarge)
 {
   IA32_PAE *target = (IA32_PAE *)pte;
 
@@ -181,7 +192,7 @@ installPAE(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage)
       (restr & CAP_RESTR_CD) ? 1 : 0,   /* cache disable */
       1,				/* accessed */
       1,				/* dirty */
-      0,				/* large page */
+      isLarge ? 1 : 0,			/* large page */
       0,				/* global */
       (restr & CAP_RESTR_WK)? 1 : 0,    /* SW0:  Weak */
       0,				/* SW1: unused */
@@ -205,6 +216,18 @@ installPAE(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage)
   return true;
 }
 
+static bool
+installPAE(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage)
+{
+  return installPAE_bits(pte, content, restr, isCapPage, false);
+}
+
+static bool
+installPAE_large(pte_t *pte, kpa_t content, uint8_t restr)
+{
+  return installPAE_bits(pte, content, restr, false, true);
+}
+
 static bool
 installPAE_PDPE(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage)
 {
@@ -308,7 +331,8 @@ canaryPTE(pte_t *pte)
 
 
 static bool
-installPTE(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage)
+installPTE_bits(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage,
+		bool isLarge)
 {
   IA32_PTE *target = (IA32_PTE *)pte;
 
@@ -321,7 +345,7 @@ installPTE(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage)
       (restr & CAP_RESTR_CD) ? 1 : 0,   /* cache disable */
       1,				/* accessed */
       1,				/* dirty */
-      0,				/* large page */
+      isLarge ? 1 : 0,			/* large page */
       0,				/* global */
       (restr & CAP_RESTR_WK)? 1 : 0,    /* SW0:  Weak */
       0,				/* SW1: unused */
@@ -338,24 +362,254 @@ installPTE(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage)
   return true;
 }
 
+static bool
+installPTE(pte_t *pte, kpa_t content, uint8_t restr, bool isCapPage)
+{
+  return installPTE_bits(pte, content, restr, isCapPage, false);
+}
+
+static bool
+installPTE_large(pte_t *pte, kpa_t content, uint8_t restr)
+{
+  return installPTE_bits(pte, content, restr, false, true);
+}
+
 const PageTableLevel paePtbl[] = {
   { 32, 2, 30, 0, 				      
-    mapPAE, readPAE, canaryPAE, installPAE_PDPE, unmapPAE },
+    mapPAE, readPAE, canaryPAE, installPAE_PDPE, unmapPAE, 0 },
   { 30, 1, 21, 0,
-    mapPAE, readPAE, canaryPAE, installPAE, unmapPAE },
+    mapPAE, readPAE, canaryPAE, installPAE, unmapPAE, installPAE_large },
   { 21, 0, 12, CAP_RESTR_RO|CAP_RESTR_NX|CAP_RESTR_CD|CAP_RESTR_WT,
-    mapPAE, readPAE, canaryPAE, installPAE, unmapPAE },
+    mapPAE, readPAE, canaryPAE, installPAE, unmapPAE, 0 },
   { 0 }
 };
 
 const PageTableLevel normPtbl[] = {
   { 32, 1, 22, 0,
-    mapPTE, readPTE, canaryPTE, installPTE, unmapPTE },
+    mapPTE, readPTE, canaryPTE, installPTE, unmapPTE, installPTE_large },
   { 22, 0, 12, CAP_RESTR_RO|CAP_RESTR_CD|CAP_RESTR_WT,
-    mapPTE, readPTE, canaryPTE, installPTE, unmapPTE },
+    mapPTE, readPTE, canaryPTE, installPTE, unmapPTE, 0 },
   { 0 }
 };
 
+/** @brief Return true if @p pte is not soft-valid, or maps a large
+ * page.
+ *
+ * The low word of a PAE entry has the same layout as a PTE, so this
+ * serves for both.
+ */
+static inline bool
+pte_large_candidate(pte_t *pte)
+{
+  uint32_t lo = *(uint32_t *)pte;
+  return (!(lo & PTE_SW2) || (lo & PTE_PGSZ));
+}
+
+/** @brief State of a scan of the region a large page would map. */
+typedef struct LargeScan {
+  /** @brief Second pass: record Depend and RevMap entries. */
+  bool     install;
+  /** @brief Pages are to be mapped writable and marked dirty. */
+  bool     forWrite;
+  /** @brief Every page seen so far is dirty. */
+  bool     dirty;
+  /** @brief log_2 of the size of the large page. */
+  uint8_t  l2large;
+  /** @brief Restriction bits that are significant for a leaf page. */
+  uint8_t  restr_mask;
+  /** @brief Restrictions of the path to the first page. */
+  uint8_t  restr;
+  /** @brief Table and slot of the large page PTE. */
+  Mapping *map;
+  size_t   slot;
+  /** @brief Physical address of the first page. */
+  kpa_t    pa;
+  /** @brief Number of pages seen so far. */
+  size_t   npage;
+} LargeScan;
+
+static bool large_scan_gpt(LargeScan *ls, GPT *gpt, coyaddr_t off,
+			   size_t l2len, uint8_t restr, size_t depth);
+
+/** @brief Scan the 2^@p l2len bytes at @p off in the space named by
+ * @p cap.
+ *
+ * Returns true if they are all Pages, physically contiguous with the
+ * pages already seen, and reached through only GPTs and guards that
+ * span the whole region with the same restrictions.
+ */
+static bool
+large_scan_cap(LargeScan *ls, capability *cap, coyaddr_t off,
+	       size_t l2len, uint8_t restr, size_t depth)
+{
+  if (depth >= MEMWALK_MAX)
+    return false;
+
+  cap_prepare(cap);
+
+  /* Windows, CapPages and everything else take the normal path. */
+  if (cap->type != ct_GPT && cap->type != ct_Page)
+    return false;
+
+  size_t l2g = cap->u1.mem.l2g;
+  if (l2g < l2len)
+    return false;
+
+  coyaddr_t guard = (coyaddr_t)cap->u1.mem.match << l2g;
+  if ((off & ~(((coyaddr_t)2 << (l2g - 1)) - 1)) != guard)
+    return false;
+  off ^= guard;
+
+  restr |= (cap->restr & ls->restr_mask);
+
+  if (cap->type == ct_GPT)
+    return large_scan_gpt(ls, (GPT *)cap->u2.prepObj.target, off, l2len,
+			  restr, depth + 1);
+
+  if (l2len != COYOTOS_PAGE_ADDR_BITS || off != 0)
+    return false;
+
+  Page *pg = (Page *)cap->u2.prepObj.target;
+  kpa_t want = ls->pa + ((kpa_t)ls->npage << COYOTOS_PAGE_ADDR_BITS);
+
+  if (ls->npage == 0) {
+    if (pg->pa & (((kpa_t)1 << ls->l2large) - 1))
+      return false;
+    ls->pa = pg->pa;
+    ls->restr = restr;
+  } else if (pg->pa != want || restr != ls->restr) {
+    return false;
+  }
+
+  if (ls->forWrite && pg->mhdr.hdr.immutable)
+    return false;
+  if (!pg->mhdr.hdr.dirty)
+    ls->dirty = false;
+
+  if (ls->install) {
+    if (ls->forWrite)
+      (void) obhdr_dirty(&pg->mhdr.hdr);
+    rm_install_pte_page(pg, ls->map, ls->slot);
+  }
+
+  ls->npage++;
+  return true;
+}
+
+/** @brief Scan the 2^@p l2len bytes at @p off in @p gpt, as for
+ * large_scan_cap().
+ *
+ * On the second pass, records a single Depend entry naming every
+ * slot of @p gpt that the region covers.
+ */
+static bool
+large_scan_gpt(LargeScan *ls, GPT *gpt, coyaddr_t off,
+	       size_t l2len, uint8_t restr, size_t depth)
+{
+  size_t l2v = gpt->state.l2v;
+  size_t first = off >> l2v;
+  size_t nslot = 1;
+  size_t l2sub = l2len;
+
+  if (l2len > l2v) {
+    if (l2len - l2v > GPT_SLOT_INDEX_BITS)
+      return false;
+    nslot = (size_t)1 << (l2len - l2v);
+    l2sub = l2v;
+  }
+
+  if (first + nslot > gpt_addressable_slots(gpt))
+    return false;
+
+  off -= (coyaddr_t)first << l2v;
+
+  for (size_t i = 0; i < nslot; i++) {
+    if (!large_scan_cap(ls, &gpt->state.cap[first + i], off, l2sub,
+			restr, depth))
+      return false;
+  }
+
+  if (ls->install) {
+    DependEntry de;
+    de.gpt = gpt;
+    de.map = ls->map;
+    de.slotMask = ((1u << nslot) - 1) << first;
+    de.slotBias = first;
+    de.l2slotSpan = 0;
+    de.basePTE = ls->slot;
+    de.withinPTE = 1;
+
+    depend_install(de);
+  }
+
+  return true;
+}
+
+/** @brief Try to map the whole of the 2^<tt>curPT->l2slot</tt> byte
+ * region at @p addr, which @p gpt produces, with a single large page
+ * PTE in slot @p slot of @p map.
+ *
+ * This succeeds only if the region is backed by physically contiguous,
+ * suitably aligned Pages with uniform restrictions. Any GPT that
+ * produces part of the region gets one Depend entry for the whole
+ * large page, and every page gets a RevMap entry naming the large
+ * PTE. @p restr gives the restrictions accumulated above @p gpt, and
+ * on success is replaced by those the PTE should carry.
+ *
+ * A write fault marks every page dirty, as the hardware tracks only
+ * one dirty bit for the large page. Otherwise the PTE is writable
+ * only if every page is already dirty.
+ */
+static bool
+pf_large_page(const PageTableLevel *curPT, Mapping *map, size_t slot,
+	      GPT *gpt, coyaddr_t addr, bool wantWrite,
+	      size_t *restr, size_t leaf_restr_mask, kpa_t *pa)
+{
+  if (curPT->installLarge == 0 || 
+      curPT[1].l2slot != COYOTOS_PAGE_ADDR_BITS)
+    return false;
+  if (!IA32_UsingPAE && !IA32_HavePSE)
+    return false;
+
+  LargeScan ls = {
+    .install = false,
+    .forWrite = wantWrite && !(*restr & (CAP_RESTR_RO|CAP_RESTR_WK)),
+    .dirty = true,
+    .l2large = curPT->l2slot,
+    .restr_mask = leaf_restr_mask,
+    .restr = 0,
+    .map = map,
+    .slot = slot,
+    .pa = 0,
+    .npage = 0,
+  };
+  coyaddr_t off = addr & ~(((coyaddr_t)1 << curPT->l2slot) - 1);
+
+  if (!large_scan_gpt(&ls, gpt, off, curPT->l2slot, 0, 0))
+    return false;
+
+  /* The first pass found no immutable page if forWrite is set, so
+   * the second pass can dirty them all. It holds the locks the first
+   * pass took, and sees the same space. */
+  bool allDirty = ls.dirty || ls.forWrite;
+  kpa_t base = ls.pa;
+
+  ls.install = true;
+  ls.npage = 0;
+  if (!large_scan_gpt(&ls, gpt, off, curPT->l2slot, 0, 0))
+    sched_restart_transaction();
+
+  assert(ls.npage == 
+	 (size_t)1 << (curPT->l2slot - COYOTOS_PAGE_ADDR_BITS));
+  assert(ls.pa == base);
+
+  *restr |= ls.restr;
+  if (!allDirty)
+    *restr |= CAP_RESTR_RO;
+  *pa = base;
+  return true;
+}
+
 void
 do_pageFault(Process *base, uintptr_t addr_arg, 
 	     bool wantWrite, 
@@ -377,7 +631,10 @@ do_pageFault(Process *base, uintptr_t addr_arg,
   size_t leaf_restr_mask = 
     CAP_RESTR_CD | CAP_RESTR_WT | restr_mask;
 
-  result = memwalk(&base->state.addrSpace, addr, wantWrite, &mwr);
+  cpu_count(cst_PageFaults);
+
+  result = memwalk_cached(&base->walkCache, &base->state.addrSpace,
+			  addr, wantWrite, &mwr);
 
   if (addr >= KVA) {
     result = coyotos_Process_FC_InvalidDataReference;
@@ -441,6 +698,12 @@ do_pageFault(Process *base, uintptr_t addr_arg,
     addr -= slot << curPT->l2slot;
 
     pte_t *pte = curPT->findPTE(curmap, slot);
+
+    /* Only consider a large page for an empty slot, or to replace one.
+     * A slot that holds a page table was either found unsuitable, or
+     * is being built up a page at a time, and rescanning the region on
+     * every fault through it would be too costly. */
+    bool tryLarge = pte_large_candidate(pte);
     
     curPT->canaryPTE(pte);
 
@@ -465,6 +728,7 @@ do_pageFault(Process *base, uintptr_t addr_arg,
 	de.slotBias = mwe->slot;
 	de.l2slotSpan = min(minl2, curPT->l2table) - curPT->l2slot;
 	de.basePTE = slot & ~((1u << de.l2slotSpan) - 1);
+	de.withinPTE = 0;
 
 	depend_install(de);
       }
@@ -478,6 +742,19 @@ do_pageFault(Process *base, uintptr_t addr_arg,
     kpa_t target_pa;
     Mapping *newmap = 0;
 
+    if (tryLarge && !mwe->window && mwe->entry->hdr.ty == ot_GPT &&
+	minl2 >= curPT->l2slot &&
+	pf_large_page(curPT, curmap, slot, (GPT *)mwe->entry, mwe->remAddr,
+		      wantWrite, &restr, leaf_restr_mask, &target_pa)) {
+      if (!curPT->installLarge(pte, target_pa, 
+			       (restr & curPT[1].slot_restr))) {
+	curPT->finishPTE(pte);
+	sched_restart_transaction();
+      }
+      curPT->finishPTE(pte);
+      break;
+    }
+
     if (curPT->l2slot == COYOTOS_PAGE_ADDR_BITS) {
       // the page, boss, the page!
       assert(mwe->entry->hdr.ty == ot_Page || 
@@ -519,8 +796,8 @@ do_pageFault(Process *base, uintptr_t addr_arg,
 	guard &= ~(((coyaddr_t)1 << curPT->l2slot) - 1);
       }
 
-      /** @bug We need to be holding the mappingListLock until
-       * the RevMap entry is installed.
+      /** @bug We need to be holding the producer's productsLock
+       * until the RevMap entry is installed.
        */
       newmap = pgtbl_get(mwe->entry, curPT->level - 1, guard,
 			 ~(((coyaddr_t)2 << (minl2 - 1)) - 1),
@@ -553,6 +830,6 @@ do_pageFault(Process *base, uintptr_t addr_arg,
   return;
 
  deliver_fault:
-  proc_deliver_memory_fault(MY_CPU(current), result, addr, &mwr);
+  proc_deliver_memory_fault(MY_CPU(current), result, addr, wantWrite, &mwr);
   /*  proc_TakeFault(MY_CPU(current), result, addr); */
 }
@@ -198,5 +198,8 @@ cpu_finish_ap_setup()
 
   GNU_INLINE_ASM ("sti");
   printf("AP %x: Online\n", MY_CPU(id));
+
+  /* From here on, rq_choose() may hand us processes. */
+  CUR_CPU->active = true;
   sched_dispatch_something();
 }
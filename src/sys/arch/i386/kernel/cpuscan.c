@@ -33,6 +33,7 @@
 #include <kerninc/assert.h>
 
 #include "cpu.h"
+#include "hwmap.h"
 #include "IA32/CPUID.h"
 
 uint32_t
@@ -239,6 +240,9 @@ cpu_scan_features(void)
   // CPUID eax=1 returns model and stepping information.
   uint32_t cpuSignature = cpuid(1u, &regs);
 
+  /* boot.S turned on CR4.PGE if this is set. */
+  IA32_HavePGE = (regs.edx & CPUID_EDX_PGE) != 0;
+
   if (vendor & (INTEL|AMD)) {
     uint32_t famid = FIELD(regs.eax, 11, 8);
     uint32_t model = FIELD(regs.eax, 7, 4);
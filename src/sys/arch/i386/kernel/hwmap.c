@@ -34,18 +34,41 @@
 #include <kerninc/util.h>
 #include <kerninc/AgeList.h>
 #include <kerninc/pstring.h>
+#include <kerninc/RevMap.h>
+#include <kerninc/IPI.h>
 #include "hwmap.h"
 #include "kva.h"
 
 PDPT KernPDPT;
 
-spinlock_t mappingListLock;
-
 Mapping *pageTable = 0;
 Mapping *pdpt = 0;
 AgeList ptAgeList = { { &ptAgeList.list, &ptAgeList.list, } } ;
 AgeList pdptAgeList = { { &pdptAgeList.list, &pdptAgeList.list, } } ;
 
+/** @brief Protects ptAgeList and pdptAgeList.
+ *
+ * Lock order is MemHeader::productsLock, then ageListLock, then a
+ * product index bucket lock. pgtable_alloc() needs the productsLock
+ * of the producer it steals from while it holds ageListLock, so it
+ * only ever tries for that lock.
+ */
+static spinlock_t ageListLock;
+
+/** @brief A bucket of the product index.
+ *
+ * The index finds the product of a given MemHeader by (level, match,
+ * restr) without walking the producer's whole product chain. Each
+ * bucket is protected by its own lock, which is taken last.
+ */
+typedef struct ProductBucket {
+  spinlock_t lock;
+  Mapping *chain;
+} ProductBucket;
+
+static ProductBucket *productIndex;
+static size_t productIndexL2;
+
 Mapping KernMapping;
 
 /** @brief True if we are using PAE mode. Set in boot.S as we do
@@ -54,12 +77,23 @@ Mapping KernMapping;
 bool IA32_UsingPAE = false;
 bool IA32_NXSupported = false;
 bool IA32_HavePSE = false;
+/** @brief True if kernel mappings are marked global. Set in
+ * cpu_scan_features(); boot.S has already enabled CR4.PGE.
+ */
+bool IA32_HavePGE = false;
 
-/* Following are placeholder implementations */
 void
 global_tlb_flush()
 {
-  local_tlb_flush();
+  tlb_batch_addall(&MY_CPU(tlbBatch), NULL);
+  ipi_tlb_shootdown(false);
+}
+
+void
+global_tlb_flush_kernel()
+{
+  tlb_batch_addglobal(&MY_CPU(tlbBatch));
+  ipi_tlb_shootdown(false);
 }
 
 void
@@ -78,10 +112,14 @@ hwmap_disable_low_map()
     PTE_CLEAR(KernPDPT.entry[0]);
   else
     PTE_CLEAR(KernPageDir[0]);
+
+  /* The alias shares the kernel's page table, so any entries loaded
+   * through it were global. */
+  global_tlb_flush_kernel();
 }
 
 
-static void
+static size_t
 reserve_pgtbls(void)
 {
   // Allocate physical storage for the page tables. I'm looking at
@@ -106,13 +144,15 @@ reserve_pgtbls(void)
     link_init(&pageTable[i].ageLink);
     agelist_addBack(&ptAgeList, &pageTable[i]);
   }
+
+  return nPageTableFrame - 1;
 }
 
-static void
+static size_t
 reserve_pdpts(void)
 {
   if (!IA32_UsingPAE)
-    return;
+    return 0;
 
   assert(Cache.c_Process.count);
 
@@ -140,14 +180,28 @@ reserve_pdpts(void)
     link_init(&pdpt[i].ageLink);
     agelist_addBack(&pdptAgeList, &pdpt[i]);
   }
+
+  return nPDPT;
+}
+
+/** @brief Size the product index for @p nTables page tables. */
+static void
+reserve_product_index(size_t nTables)
+{
+  productIndexL2 = 1;
+  while (((size_t)1 << productIndexL2) < nTables)
+    productIndexL2++;
+
+  productIndex = CALLOC(ProductBucket, (size_t)1 << productIndexL2);
 }
 
 void 
 pagetable_init(void)
 {
   printf("Reserving page tables\n");
-  reserve_pgtbls();
-  reserve_pdpts();
+  size_t nTables = reserve_pgtbls();
+  nTables += reserve_pdpts();
+  reserve_product_index(nTables);
 
   if (IA32_UsingPAE) {
     KernMapping.pa = KVTOP(&KernPDPT);
@@ -161,8 +215,46 @@ pagetable_init(void)
   CUR_CPU->curMap = &KernMapping;
 }
 
+static inline ProductBucket *
+product_bucket(MemHeader *hdr, size_t level, coyaddr_t match, size_t restr)
+{
+  uint32_t h = (uintptr_t)hdr / sizeof (void *);
+  h = h * 0x9e3779b1u + (uint32_t)(match >> COYOTOS_PAGE_ADDR_BITS);
+  h = h * 0x9e3779b1u + (uint32_t)((level << 8) | restr);
+  h *= 0x9e3779b1u;
+
+  return &productIndex[h >> (32 - productIndexL2)];
+}
+
+/** @brief Find the product of @p hdr with the given attributes.
+ *
+ * Caller must hold the bucket lock. */
+static Mapping *
+product_find(ProductBucket *b, MemHeader *hdr, size_t level,
+	     coyaddr_t guard, coyaddr_t mask, size_t restr)
+{
+  for (Mapping *cur = b->chain; cur != NULL; cur = cur->nextHash) {
+    if (cur->producer == hdr &&
+	cur->level == level &&
+	cur->match == guard &&
+	cur->mask == mask &&
+	cur->restr == restr)
+      return cur;
+  }
+
+  return NULL;
+}
+
+static inline AgeList *
+mapping_ageList(Mapping *m)
+{
+  return (m->level == 2) ? &pdptAgeList : &ptAgeList;
+}
+
 /** @brief Make the mapping @p m undiscoverable by removing it from
- * its product chain. 
+ * its product chain and the product index.
+ *
+ * Caller must hold the productsLock of the producer.
  *
  * @bug This should be generic code, but it isn't obvious what source
  * file to stick it in.
@@ -170,10 +262,9 @@ pagetable_init(void)
 static void
 mapping_make_unreachable(Mapping *m)
 {
-  /* Producer chains are guarded by the mappingListLock. Okay to
-     fiddle them here. */
-
   MemHeader *hdr = m->producer;
+  assert(spinlock_isheld(&hdr->productsLock));
+
   Mapping **mPtr = &hdr->products;
 
   while (*mPtr != m)
@@ -183,32 +274,71 @@ mapping_make_unreachable(Mapping *m)
   assert(*mPtr == m);
 
   *mPtr = m->nextProduct;
+
+  ProductBucket *b = product_bucket(hdr, m->level, m->match, m->restr);
+  SpinHoldInfo shi = spinlock_grab(&b->lock);
+
+  for (mPtr = &b->chain; *mPtr != m; mPtr = &((*mPtr)->nextHash))
+    assert(*mPtr != NULL);
+  *mPtr = m->nextHash;
+
+  spinlock_release(shi);
+
+  m->nextProduct = NULL;
+  m->nextHash = NULL;
+  m->producer = NULL;
 }
 
+/** @brief Take a table of level @p level for reuse by @p self.
+ *
+ * Caller must hold ageListLock and the productsLock of @p self. The
+ * oldest table whose producer can be locked without waiting is made
+ * unreachable and whacked.
+ *
+ * Whacking the table sends a TLB shootdown with both spinlocks
+ * held. The table must be flushed from every TLB before it is
+ * reused, so this cannot wait until they are released; see the
+ * notes in IPI.h for why this does not deadlock.
+ */
 static Mapping *
-pgtable_alloc(size_t level)
+pgtable_alloc(MemHeader *self, size_t level)
 {
-  assert(spinlock_isheld(&mappingListLock));
+  assert(spinlock_isheld(&ageListLock));
 
   AgeList *ageList = (level == 2) ? &pdptAgeList : &ptAgeList;
 
   assert(level < 2 || IA32_UsingPAE);
 
-  Mapping *pt;
-  for(;;) {
-    pt = agelist_oldest(ageList);
+  Mapping *pt = NULL;
+  for (Link *l = ageList->list.prev; l != &ageList->list; l = l->prev) {
+    Mapping *cand = (Mapping *)l;
+    MemHeader *owner = cand->producer;
 
-    if (pt->producer) {
-      /* Make this page table undiscoverable. */
-      mapping_make_unreachable(pt);
+    if (owner == NULL) {
+      pt = cand;
+      break;
+    }
 
-      rm_whack_mapping(pt);
+    if (owner == self) {
+      mapping_make_unreachable(cand);
+      rm_whack_mapping(cand);
+      pt = cand;
+      break;
     }
 
+    SpinHoldInfo shi;
+    if (!mutex_trygrab(&owner->productsLock.m, &shi.hi))
+      continue;
+
+    mapping_make_unreachable(cand);
+    rm_whack_mapping(cand);
+    spinlock_release(shi);
+    pt = cand;
     break;
   }
 
-  assert(pt);
+  if (pt == NULL)
+    fatal("No reclaimable page tables at level %d\n", level);
 
   /* Re-initialize mapping table to safe state */
   if (level == 2) {
@@ -236,28 +366,50 @@ pgtbl_get(MemHeader *hdr, size_t level,
 {
   assert(level <= 1 + IA32_UsingPAE);
 
-  SpinHoldInfo shi = spinlock_grab(&mappingListLock);
+  ProductBucket *b = product_bucket(hdr, level, guard, restr);
 
-  for (Mapping *cur = hdr->products;
-       cur != NULL;
-       cur = cur->nextProduct) {
-    if (cur->level == level &&
-	cur->match == guard &&
-	cur->mask == mask &&
-	cur->restr == restr) {
-      if (level == 2) {
-	agelist_remove(&pdptAgeList, cur);
-	agelist_addFront(&pdptAgeList, cur);
-      } else {
-	agelist_remove(&ptAgeList, cur);
-	agelist_addFront(&ptAgeList, cur);
-      }
-      spinlock_release(shi);
+  /* Fast path: no productsLock. */
+  SpinHoldInfo bshi = spinlock_grab(&b->lock);
+  Mapping *cur = product_find(b, hdr, level, guard, mask, restr);
+  spinlock_release(bshi);
+
+  SpinHoldInfo ashi;
+
+  if (cur) {
+    ashi = spinlock_grab(&ageListLock);
+
+    /* pgtable_alloc() may have taken the table for some other
+     * producer since we let go of the bucket. It cannot do so while
+     * we hold ageListLock, so look again before trusting it. */
+    bshi = spinlock_grab(&b->lock);
+    cur = product_find(b, hdr, level, guard, mask, restr);
+    spinlock_release(bshi);
+
+    if (cur) {
+      agelist_remove(mapping_ageList(cur), cur);
+      agelist_addFront(mapping_ageList(cur), cur);
+      spinlock_release(ashi);
       return cur;
     }
+
+    spinlock_release(ashi);
+  }
+
+  SpinHoldInfo pshi = spinlock_grab(&hdr->productsLock);
+
+  /* Someone else may have built it while we were unlocked. */
+  bshi = spinlock_grab(&b->lock);
+  cur = product_find(b, hdr, level, guard, mask, restr);
+  spinlock_release(bshi);
+
+  if (cur) {
+    spinlock_release(pshi);
+    return cur;
   }
-  
-  Mapping *nMap = pgtable_alloc(level);
+
+  ashi = spinlock_grab(&ageListLock);
+  Mapping *nMap = pgtable_alloc(hdr, level);
+  spinlock_release(ashi);
 
   nMap->level = level;
   nMap->match = guard;
@@ -268,14 +420,19 @@ pgtbl_get(MemHeader *hdr, size_t level,
   nMap->nextProduct = hdr->products;
   hdr->products = nMap;
 
-  spinlock_release(shi);
+  bshi = spinlock_grab(&b->lock);
+  nMap->nextHash = b->chain;
+  b->chain = nMap;
+  spinlock_release(bshi);
+
+  spinlock_release(pshi);
   return nMap;
 }
 
 void
 memhdr_invalidate_products(MemHeader *hdr)
 {
-  SpinHoldInfo shi = spinlock_grab(&mappingListLock);
+  SpinHoldInfo shi = spinlock_grab(&hdr->productsLock);
   Mapping *pt;
 
   for (pt = hdr->products; pt != 0; pt = pt->nextProduct)
@@ -287,7 +444,7 @@ memhdr_invalidate_products(MemHeader *hdr)
 void
 memhdr_destroy_products(MemHeader *hdr)
 {
-  SpinHoldInfo shi = spinlock_grab(&mappingListLock);
+  SpinHoldInfo shi = spinlock_grab(&hdr->productsLock);
 
   Mapping *pt;
 
@@ -297,18 +454,88 @@ memhdr_destroy_products(MemHeader *hdr)
 
     rm_whack_mapping(pt);
 
-    if (pt->level == 2) {
-      agelist_remove(&pdptAgeList, pt);
-      agelist_addBack(&pdptAgeList, pt);
-    } else {
-      agelist_remove(&ptAgeList, pt);
-      agelist_addBack(&ptAgeList, pt);
-    }
+    SpinHoldInfo ashi = spinlock_grab(&ageListLock);
+    agelist_remove(mapping_ageList(pt), pt);
+    agelist_addBack(mapping_ageList(pt), pt);
+    spinlock_release(ashi);
   }
 
   spinlock_release(shi);
 }
 
+/** @brief Most PTEs naming a single table that we will chase to
+ * recover the addresses it maps. */
+#define HWMAP_MAX_PARENTS 4
+
+/** @brief log_2 of the space covered by one slot of a level @p level
+ * table. */
+static inline size_t
+hwmap_l2slot(size_t level)
+{
+  return COYOTOS_PAGE_ADDR_BITS + level * (IA32_UsingPAE ? 9 : 10);
+}
+
+/** @brief Queue invalidation of @p npage pages mapped through @p
+ * map, starting at @p va.
+ *
+ * @p va holds the address bits contributed by @p map and the levels
+ * below it. The rest are recovered from the PTEs that point at @p
+ * map, and their tables' own parents, up to the top level.
+ */
+static void
+hwmap_queue_from(TlbBatch *tb, Mapping *map, kva_t va, size_t npage)
+{
+  if (map->level == KernMapping.level) {
+    if (tb->count + npage > TLB_BATCH_MAX) {
+      tlb_batch_addall(tb, map);
+      return;
+    }
+
+    for (size_t i = 0; i < npage; i++)
+      tlb_batch_addva(tb, map, va + (i << COYOTOS_PAGE_ADDR_BITS));
+    return;
+  }
+
+  Mapping *ptbl[HWMAP_MAX_PARENTS];
+  size_t pslot[HWMAP_MAX_PARENTS];
+  size_t np = rm_mapping_parents(map, HWMAP_MAX_PARENTS, ptbl, pslot);
+
+  /* No parents at all means some other CPU is part way through
+   * whacking the tables above us, so we cannot tell who still has
+   * them loaded. */
+  if (np == 0 || np > HWMAP_MAX_PARENTS) {
+    tlb_batch_addall(tb, NULL);
+    return;
+  }
+
+  for (size_t p = 0; p < np; p++)
+    hwmap_queue_from(tb, ptbl[p],
+		     va + ((kva_t)pslot[p] << hwmap_l2slot(ptbl[p]->level)),
+		     npage);
+}
+
+/** @brief Queue invalidation of @p nslot entries of @p map, starting
+ * at @p slot, on the current CPU's TlbBatch.
+ *
+ * A table is shared by every address space whose GPTs produce it,
+ * and is found by guard rather than by address, so the addresses an
+ * entry maps must be recovered through the RevMap. An entry above
+ * the bottom level covers too much to invalidate page by page, so it
+ * queues a full flush.
+ */
+static void
+hwmap_queue_invalidate(Mapping *map, size_t slot, size_t nslot)
+{
+  TlbBatch *tb = &MY_CPU(tlbBatch);
+
+  if (map->level == KernMapping.level)
+    tlb_batch_addall(tb, map);
+  else if (map->level != 0)
+    tlb_batch_addall(tb, NULL);
+  else if (tb->count != TLB_BATCH_FULL || !tb->anyMap)
+    hwmap_queue_from(tb, map, (kva_t)slot << COYOTOS_PAGE_ADDR_BITS, nslot);
+}
+
 void
 depend_entry_invalidate(const DependEntry *entry, int slot)
 {
@@ -332,15 +559,20 @@ depend_entry_invalidate(const DependEntry *entry, int slot)
       if (slot >= 0 && i != slot)
 	continue;
       if (mask & (1u << i)) {
-	int biased = i - slotBias;
+	int biased = entry->withinPTE ? 0 : i - slotBias;
 	assert(base + biased * slotSize + (slotSize - 1) < maxpte);
+	size_t first = base + biased * slotSize;
+	size_t n = 0;
 	for (size_t j = 0; j < slotSize; j++) {
-	  size_t slot = base + biased * slotSize + j;
+	  size_t slot = first + j;
 	  if (slot >= map->userSlots)
 	    continue;
 
 	  pte_invalidate((struct PTE *)&pte[slot]);
+	  n++;
 	}
+	if (n)
+	  hwmap_queue_invalidate(map, first, n);
       }
     }
     TRANSMAP_UNMAP(map_base);
@@ -358,27 +590,30 @@ depend_entry_invalidate(const DependEntry *entry, int slot)
       if (slot >= 0 && i != slot)
 	continue;
       if (mask & (1u << i)) {
-	size_t biased = i - slotBias;
+	size_t biased = entry->withinPTE ? 0 : i - slotBias;
 	assert(base + biased * slotSize + (slotSize - 1) < maxpte);
+	size_t first = base + biased * slotSize;
+	size_t n = 0;
 	for (size_t j = 0; j < slotSize; j++) {
-	  size_t slot = base + biased * slotSize + j;
+	  size_t slot = first + j;
 	  if (slot >= map->userSlots)
 	    continue;
 
 	  pte_invalidate((struct PTE *)&pte[slot]);
+	  n++;
 	}
+	if (n)
+	  hwmap_queue_invalidate(map, first, n);
       }
     }
     TRANSMAP_UNMAP(pte);
   }
+}
 
-  /* Now that all of the entries are invalidated, flush the TLB */
-  global_tlb_flush();
-
-  /** @bug need to cross-call other CPUs to have them flush their TLBs.
-   * Also, do we want to delay doing this until all of the Depend entries
-   * are gone?
-   */
+void
+depend_entry_flush(bool mayAbandon)
+{
+  ipi_tlb_shootdown(mayAbandon);
 }
 
 void
@@ -407,13 +642,15 @@ rm_whack_pte(struct Mapping *map,  size_t slot)
     TRANSMAP_UNMAP(pte);
   }
 
-  /* Now that all of the entries are invalidated, flush the TLB */
-  global_tlb_flush();
+  hwmap_queue_invalidate(map, slot, 1);
+}
 
-  /** @bug need to cross-call other CPUs to have them flush their TLBs.
-   * Also, do we want to delay doing this until all of the revmap entries
-   * are gone?
-   */
+void
+rm_whack_flush(void)
+{
+  /* Always reached with a spinlock held or part way through
+   * reclaiming a block, so never abandon from here. */
+  ipi_tlb_shootdown(false);
 }
 
 void
@@ -523,7 +760,7 @@ hwmap_dump_table(kpa_t kpa, int level, int indent)
 
     for (idx = 0; idx < NPAE_PER_PAGE; idx++) {
       hwmap_dump_pae(idx, &table[idx], indent + 2);
-      if (level == 1 && table[idx].bits.V)
+      if (level == 1 && table[idx].bits.V && !table[idx].bits.PGSZ)
 	hwmap_dump_table(PAE_FRAME_TO_KPA(table[idx].bits.frameno),
 			 level - 1, indent + 4);
     }
@@ -535,7 +772,7 @@ hwmap_dump_table(kpa_t kpa, int level, int indent)
 
     for (idx = 0; idx < NPTE_PER_PAGE; idx++) {
       hwmap_dump_pte(idx, &table[idx], indent + 2);
-      if (level == 1 && table[idx].bits.V)
+      if (level == 1 && table[idx].bits.V && !table[idx].bits.PGSZ)
 	hwmap_dump_table(PTE_FRAME_TO_KPA(table[idx].bits.frameno),
 			 level - 1, indent + 4);
     }
@@ -42,6 +42,7 @@
 extern bool IA32_UsingPAE;
 extern bool IA32_NXSupported;
 extern bool IA32_HavePSE;
+extern bool IA32_HavePGE;
 
 #define NPTE_PER_PAGE (COYOTOS_PAGE_SIZE/sizeof(IA32_PTE))
 #define PTE_PFRAME_BOUND (((kpa_t) 1) << 20)
@@ -98,6 +99,15 @@ void hwmap_enable_low_map();
  * of physical memory. */
 void hwmap_disable_low_map();
 
+/** @brief Mark the kernel mappings made so far global, if
+ * IA32_HavePGE is set.
+ *
+ * kmap_map() marks later ones as it makes them. The transient map is
+ * left alone, because it relies on address space switches to flush
+ * its released entries.
+ */
+void kmap_enable_global(void);
+
 /* Number of page tables to reserve for a given number of pages. */
 #define RESERVED_PAGE_TABLES(nPage) (nPage / 10)
 #define PAGES_PER_PROCESS 25
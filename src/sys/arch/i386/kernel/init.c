@@ -42,6 +42,7 @@
 #include <kerninc/Cache.h>
 #include <kerninc/CPU.h>
 #include <kerninc/CommandLine.h>
+#include <kerninc/event.h>
 #include <kerninc/util.h>
 
 #include "IA32/CR.h"
@@ -341,7 +342,12 @@ release_module(struct MultibootModuleInfo *mmi)
   mmi->mod_end = mmi->mod_start;
 }
 
-/** @brief Transfer the content of a module into the object cache. */
+/** @brief Transfer the content of a module into the object cache.
+ *
+ * The leading page frames of the module now belong to the page
+ * cache. Advance the module start past them so that
+ * release_module() returns only the remainder.
+ */
 static void
 load_module(struct MultibootModuleInfo *mmi)
 {
@@ -351,14 +357,19 @@ load_module(struct MultibootModuleInfo *mmi)
 
   const char *imgName = cmdline_argv0();
 
-  cache_preload_image(imgName, mmi->mod_start,
-		      mmi->mod_end - mmi->mod_start);
+  kpa_t adopted = 
+    cache_preload_image(imgName, mmi->mod_start,
+			mmi->mod_end - mmi->mod_start);
+
+  assert(adopted <= mmi->mod_end);
+  mmi->mod_start = adopted;
 }
 
 /** @brief Transfer module content into the object heap.
  *
  * Move object content into the object vectors. Once this is done we
- * release the transferred module images.
+ * release whatever part of the module images was not adopted by the
+ * page cache.
  *
  * @bug The test for exactly one module isn't correct. Not immediately
  * clear what the correct test ought to be. This is a design issue
@@ -565,6 +576,7 @@ arch_init(void)
   {
     size_t nPage = totPage - RESERVED_PAGE_TABLES(totPage);
     nPage -= (cpu_ncpu-1) * KSTACK_NPAGES; /* per-CPU stacks */
+    nPage -= event_init();	/* trace rings */
 
     cache_estimate_sizes(PAGES_PER_PROCESS, nPage);
   }
@@ -575,6 +587,13 @@ arch_init(void)
 
   cpu_scan_features();
 
+  /* Kernel mappings are marked global so that they survive address
+   * space switches. "noglobal" turns this off, which is mainly useful
+   * to measure what it saves. */
+  if (cmdline_has_option("noglobal"))
+    IA32_HavePGE = false;
+  kmap_enable_global();
+
   /* Initialize the hardware exception vector table. */
   vector_init();
   
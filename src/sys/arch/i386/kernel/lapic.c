@@ -23,10 +23,12 @@
  */
 
 #include <kerninc/printf.h>
+#include <kerninc/IPI.h>
 #include "lapic.h"
 #include "IRQ.h"
 #include "PIC.h"
 #include "8259.h"
+#include "cpu.h"
 
 static inline uint32_t 
 lapic_irq_register(irq_t irq)
@@ -107,6 +109,9 @@ lapic_unmask(VectorInfo *vi)
   case irq_LAPIC_SVR:
     /* Spurious vector interrupt. Cannot be enabled or disabled from software. */
     break;
+  case irq_LAPIC_IPI:
+    /* IPIs arrive through the ICR, which has no mask bit. */
+    break;
   default:
     {
       uint32_t reg = lapic_irq_register(vi->irq);
@@ -124,6 +129,9 @@ lapic_mask(VectorInfo *vi)
   case irq_LAPIC_SVR:
     /* Spurious vector interrupt. Cannot be enabled or disabled from software. */
     break;
+  case irq_LAPIC_IPI:
+    /* IPIs arrive through the ICR, which has no mask bit. */
+    break;
   default:
     {
       uint32_t reg = lapic_irq_register(vi->irq);
@@ -163,6 +171,33 @@ lapic_spurious_interrupt()
   fatal("Spurious lapic interrupt!\n");
 }
 
+static void
+lapic_ipi_interrupt(VectorInfo *vec, Process *inProc, fixregs_t *saveArea)
+{
+  ipi_process();
+}
+
+void
+ipi_send(cpuid_t cpu)
+{
+  flags_t f = locally_disable_interrupts();
+
+  while (lapic_read_register(LAPIC_ICR0) & LAPIC_ICR0_DELIVER_PENDING)
+    ;
+
+  lapic_write_register(LAPIC_ICR32, 
+		       (uint32_t) archcpu_vec[cpu].lapic_id << 24);
+  lapic_write_register(LAPIC_ICR0,
+		       IRQ_PIN(irq_LAPIC_IPI) |
+		       LAPIC_ICR0_DELIVER_FIXED |
+		       LAPIC_ICR0_DESTMODE_PHYSICAL |
+		       LAPIC_ICR0_LEVEL_ASSERT |
+		       LAPIC_ICR0_TRIGGER_EDGE |
+		       LAPIC_ICR0_DEST_FIELD);
+
+  locally_enable_interrupts(f);
+}
+
 void 
 lapic_dump()
 {
@@ -248,6 +283,8 @@ lapic_init()
 
     irq_Bind(irq_LAPIC_SVR, VEC_MODE_EDGE, VEC_LEVEL_ACTHIGH, 
 	     lapic_spurious_interrupt);
+    irq_Bind(irq_LAPIC_IPI, VEC_MODE_EDGE, VEC_LEVEL_ACTHIGH, 
+	     lapic_ipi_interrupt);
 
     VectorInfo *vector = irq_MapInterrupt(irq_LAPIC_SVR);
     vector->unmasked = 1;
@@ -95,5 +95,14 @@ atomic_clear_bits(TARGET_HAL_ATOMIC32_T *a, uint32_t mask)
 		       : "cc");
 }
 
+/** @brief Full memory barrier.
+ *
+ * A locked no-op on the stack is serializing on every IA-32
+ * implementation, including those that predate MFENCE. */
+static inline void
+memory_barrier(void)
+{
+  __asm__ __volatile__("lock addl $0,0(%%esp)" : : : "memory", "cc");
+}
 
 #endif /* I386_HAL_ATOMIC_H */
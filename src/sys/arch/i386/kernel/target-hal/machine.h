@@ -24,8 +24,17 @@
  * @brief Miscellaneous machine-specific functions.
  */
 
+#include <stdint.h>
 #include <kerninc/ccs.h>
 
+static inline uint64_t
+read_cycle_counter(void)
+{
+  uint32_t lo, hi;
+  GNU_INLINE_ASM("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
 /** @brief Halt the processor without rebooting.
  *
  * Implementation is architecture specific.
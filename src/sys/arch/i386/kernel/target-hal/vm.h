@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <hal/kerntypes.h>
 #include <kerninc/ccs.h>
+#include "../IA32/CR.h"
 
 union IA32_PTE {
   struct {
@@ -106,6 +107,27 @@ local_tlb_flush()
 		 : "ax");
 }
 
+/* Reloading %cr3 leaves global entries alone, but toggling CR4.PGE
+ * flushes them. Without PGE there are no global entries. */
+static inline void
+local_tlb_flush_global()
+{
+  uint32_t cr4;
+  GNU_INLINE_ASM("mov %%cr4,%0\n"
+		 : "=r" (cr4));
+
+  if ((cr4 & CR4_PGE) == 0) {
+    local_tlb_flush();
+    return;
+  }
+
+  GNU_INLINE_ASM("mov %0,%%cr4\n"
+		 "mov %1,%%cr4\n"
+		 : /* No outputs */
+		 : "r" (cr4 & ~CR4_PGE), "r" (cr4)
+		 : "memory");
+}
+
 static inline void
 local_tlb_flushva(kva_t va)
 {
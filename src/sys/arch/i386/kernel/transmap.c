@@ -136,6 +136,7 @@ transmap_map(kpa_t pa)
     uint32_t entry = TRANSMAP_PERCPU_ENTRY(slot);
     MY_CPU(TransReleased) &= ~(1u << slot);
     local_tlb_flushva(TRANSMAP_ENTRY_VA(entry));
+    cpu_count(cst_TransmapFlushes);
   }
 
   assert(ndx);
@@ -37,6 +37,18 @@
 
 #define DEBUG_VM if (0)
 
+/** @brief Return true if the kernel mapping of @p va should be global.
+ *
+ * Global entries survive the %cr3 reload in vm_switch_curcpu_to_map().
+ * The transient map depends on that reload to flush the entries it
+ * has released, so it is never global.
+ */
+static inline bool
+kmap_global(kva_t va)
+{
+  return IA32_HavePGE && va < TRANSMAP_WINDOW_KVA;
+}
+
 void 
 kmap_EnsureCanMap(kva_t va, const char *descrip)
 {
@@ -96,9 +108,7 @@ kmap_EnsureCanMap(kva_t va, const char *descrip)
       upper->bits.DIRTY = 1;
       upper->bits.PGSZ = 0;
 
-      // FIX: This should be set if global mappings are supported
-      // for this architecture:
-      // upper->bits.GLBL = 1;
+      upper->bits.GLBL = kmap_global(va);
     }
 
     assert(upper->bits.USER == 0 &&
@@ -146,9 +156,7 @@ kmap_EnsureCanMap(kva_t va, const char *descrip)
       upper->bits.DIRTY = 1;
       upper->bits.PGSZ = 0;
 
-      // FIX: This should be set if global mappings are supported
-      // for this architecture:
-      // upper->bits.GLBL = 1;
+      upper->bits.GLBL = kmap_global(va);
     }
   }
 }
@@ -198,9 +206,7 @@ kmap_map(kva_t va, kpa_t pa, uint32_t perms)
     pgtbl[lndx].bits.DIRTY = 1;
     pgtbl[lndx].bits.PGSZ = 0;
 
-    // FIX: This should be set if global mappings are supported
-    // for this architecture:
-    // pgtbl[lndx].bits.GLBL = 1;
+    pgtbl[lndx].bits.GLBL = kmap_global(va);
 
     TRANSMAP_UNMAP(pgtbl);
   }
@@ -232,9 +238,7 @@ kmap_map(kva_t va, kpa_t pa, uint32_t perms)
     pgtbl[lndx].bits.DIRTY = 1;
     pgtbl[lndx].bits.PGSZ = 0;
 
-    // FIX: This should be set if global mappings are supported
-    // for this architecture:
-    // pgtbl[lndx].bits.GLBL = 1;
+    pgtbl[lndx].bits.GLBL = kmap_global(va);
 
     TRANSMAP_UNMAP(pgtbl);
   }
@@ -243,6 +247,63 @@ kmap_map(kva_t va, kpa_t pa, uint32_t perms)
     printf("kmap: Mapped va=0x%08x to pa=0x%016x\n", va, pa);
 }
 
+void
+kmap_enable_global(void)
+{
+  if (!IA32_HavePGE)
+    return;
+
+  if (IA32_UsingPAE) {
+    IA32_PAE *dir = (IA32_PAE*) &KernPageDir;
+
+    for (size_t undx = PAE_PGDIR_NDX(KVA); 
+	 undx < PAE_PGDIR_NDX(TRANSMAP_WINDOW_KVA); undx++) {
+      if (!dir[undx].bits.V)
+	continue;
+
+      if (dir[undx].bits.PGSZ) {
+	dir[undx].bits.GLBL = 1;
+	continue;
+      }
+
+      kpa_t lowerTable = PAE_FRAME_TO_KPA(dir[undx].bits.frameno);
+      IA32_PAE *pgtbl = TRANSMAP_MAP(lowerTable, IA32_PAE *);
+
+      for (size_t i = 0; i < NPAE_PER_PAGE; i++)
+	if (pgtbl[i].bits.V)
+	  pgtbl[i].bits.GLBL = 1;
+
+      TRANSMAP_UNMAP(pgtbl);
+    }
+  }
+  else {
+    IA32_PTE *dir = (IA32_PTE*) &KernPageDir;
+
+    for (size_t undx = PTE_PGDIR_NDX(KVA); 
+	 undx < PTE_PGDIR_NDX(TRANSMAP_WINDOW_KVA); undx++) {
+      if (!dir[undx].bits.V)
+	continue;
+
+      if (dir[undx].bits.PGSZ) {
+	dir[undx].bits.GLBL = 1;
+	continue;
+      }
+
+      kpa_t lowerTable = PTE_FRAME_TO_KPA(dir[undx].bits.frameno);
+      IA32_PTE *pgtbl = TRANSMAP_MAP(lowerTable, IA32_PTE *);
+
+      for (size_t i = 0; i < NPTE_PER_PAGE; i++)
+	if (pgtbl[i].bits.V)
+	  pgtbl[i].bits.GLBL = 1;
+
+      TRANSMAP_UNMAP(pgtbl);
+    }
+  }
+
+  /* Entries already in the TLB were loaded as non-global. They are
+   * still correct, and will be reloaded as global once evicted. */
+}
+
 /// @brief Load the specified mapping onto the CPU.
 ///
 /// This does not need to grab locks. If the mapping loaded is
@@ -263,6 +324,8 @@ vm_switch_curcpu_to_map(Mapping *map)
 
   MY_CPU(curMap) = map;
 
+  /* Kernel entries are global (see kmap_enable_global()), and so
+   * are not flushed by this. */
   GNU_INLINE_ASM("mov %0,%%cr3"
 		 : /* No output */
 		 : "r" (map->pa));
@@ -0,0 +1,18 @@
+#include <coyotos/syscall.h>
+
+/* Number of calls made by each client. */
+#define CONTEND_ROUNDS 1000
+
+/* Call the server, sending a reply capability built from our
+ * endpoint in cap register 1. Open wait, and no copyout, because this
+ * block is read-only. */
+const InvParameterBlock_t contend_parameter_block = {
+  .pw[0] = (IPW0_RP|IPW0_RC|IPW0_SP|IPW0_SC|IPW0_MAKE_LSC(0)|IPW0_MAKE_LDW(1)|sc_InvokeCap),
+  .pw[1] = 0,
+  .u.invCap = REG_CAPLOC(2),
+  .sndCap[0] = REG_CAPLOC(1),
+  .epID = 0,
+};
+
+/* Loop state, updated by contend_loop.S. */
+uint32_t contend_remaining __attribute__((section(".data"))) = CONTEND_ROUNDS;
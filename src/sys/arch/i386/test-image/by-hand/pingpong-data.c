@@ -0,0 +1,22 @@
+#include <coyotos/syscall.h>
+
+/* Number of round trips to time. */
+#define PINGPONG_ROUNDS 10000
+
+/* Call pong, sending a reply capability built from our endpoint in
+ * cap register 1. Open wait, and no copyout, because this block is
+ * read-only. */
+const InvParameterBlock_t ping_parameter_block = {
+  .pw[0] = (IPW0_RP|IPW0_RC|IPW0_SP|IPW0_SC|IPW0_MAKE_LSC(0)|IPW0_MAKE_LDW(1)|sc_InvokeCap),
+  .pw[1] = 0,
+  .u.invCap = REG_CAPLOC(2),
+  .sndCap[0] = REG_CAPLOC(1),
+  .epID = 0,
+};
+
+/* Loop state, updated by pingpong_loop.S. When the client halts,
+ * ping_cycles holds the TSC cycles taken by PINGPONG_ROUNDS round
+ * trips. */
+uint32_t ping_remaining __attribute__((section(".data"))) = PINGPONG_ROUNDS;
+uint64_t ping_start __attribute__((section(".data"))) = 0;
+uint64_t ping_cycles __attribute__((section(".data"))) = 0;
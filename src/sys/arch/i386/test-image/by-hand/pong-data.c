@@ -0,0 +1,19 @@
+#include <coyotos/syscall.h>
+
+/* First receive: open wait, accepting the reply capability into cap
+ * register 3. */
+const InvParameterBlock_t pong_rcv_block = {
+  .pw[0] = (IPW0_RP|IPW0_AC|IPW0_MAKE_LRC(0)|sc_InvokeCap),
+  .rcvCap[0] = REG_CAPLOC(3),
+  .epID = 0,
+};
+
+/* Reply through cap register 3 without blocking, then wait for the
+ * next call. */
+const InvParameterBlock_t pong_reply_block = {
+  .pw[0] = (IPW0_SP|IPW0_NB|IPW0_RP|IPW0_AC|IPW0_MAKE_LRC(0)|IPW0_MAKE_LDW(1)|sc_InvokeCap),
+  .pw[1] = 0,
+  .u.invCap = REG_CAPLOC(3),
+  .rcvCap[0] = REG_CAPLOC(3),
+  .epID = 0,
+};
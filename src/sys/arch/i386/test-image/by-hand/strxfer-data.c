@@ -0,0 +1,43 @@
+#include <coyotos/syscall.h>
+
+/* Number of calls to time for each message size. */
+#define STRXFER_ROUNDS 1000
+
+/* Message sizes to time, from one page up to COYOTOS_MAX_SNDLEN. */
+#define STRXFER_NSIZES 5
+
+uint8_t xfer_buffer[COYOTOS_MAX_SNDLEN] __attribute__((aligned(4096)));
+
+/* Call the sink with a string of @p len bytes, sending a reply
+ * capability built from our endpoint in cap register 1. */
+#define XFER_BLOCK(len) {						\
+    .pw[0] = (IPW0_RP|IPW0_RC|IPW0_SP|IPW0_SC|IPW0_MAKE_LSC(0)|IPW0_MAKE_LDW(1)|sc_InvokeCap), \
+    .pw[1] = 0,								\
+    .u.invCap = REG_CAPLOC(2),						\
+    .sndCap[0] = REG_CAPLOC(1),						\
+    .sndLen = (len),							\
+    .sndPtr = xfer_buffer,						\
+    .epID = 0,								\
+  }
+
+const InvParameterBlock_t xfer_parameter_blocks[STRXFER_NSIZES] = {
+  XFER_BLOCK(4096),
+  XFER_BLOCK(8192),
+  XFER_BLOCK(16384),
+  XFER_BLOCK(32768),
+  XFER_BLOCK(65536),
+};
+
+const uint32_t xfer_block_size = sizeof(InvParameterBlock_t);
+const uint32_t xfer_nsizes = STRXFER_NSIZES;
+const uint32_t xfer_rounds = STRXFER_ROUNDS;
+
+/* Loop state, updated by strxfer_loop.S. When the client halts,
+ * xfer_cycles[i] holds the TSC cycles taken by STRXFER_ROUNDS calls
+ * carrying the i'th message size. */
+const InvParameterBlock_t *xfer_cur_block __attribute__((section(".data"))) =
+  &xfer_parameter_blocks[0];
+uint32_t xfer_index __attribute__((section(".data"))) = 0;
+uint32_t xfer_remaining __attribute__((section(".data"))) = 0;
+uint64_t xfer_start __attribute__((section(".data"))) = 0;
+uint64_t xfer_cycles[STRXFER_NSIZES] __attribute__((section(".data"))) = { 0 };
@@ -79,7 +79,7 @@ void cap_AppNotice(InvParam_t *iParam)
 	uintptr_t icw = get_icw(p);
 	if ((icw & IPW0_CW) == 0) {
 	  p->state.runState = PRS_RUNNING;
-	  rq_add(&mainRQ, p, false);
+	  rq_addReady(p, false);
 	}
       }
 
@@ -31,6 +31,11 @@
 #include <hal/vm.h>
 #include <hal/syscall.h>
 #include <idl/coyotos/GPT.h>
+#include <idl/coyotos/Null.h>
+#include <idl/coyotos/Page.h>
+#include <idl/coyotos/CapPage.h>
+#include <idl/coyotos/Window.h>
+#include <idl/coyotos/LocalWindow.h>
 
 extern void cap_AddressSpace(InvParam_t* iParam);
 
@@ -39,6 +44,24 @@ static uintptr_t fc_to_rc(coyotos_Process_FC fc)
   bug("Not handling walk faults yet\n");
 }
 
+/** @brief Alleged type of @p cap, as reported by walk.
+ *
+ * Only memory capabilities are told apart; anything else is reported
+ * as IKT_coyotos_Cap.
+ */
+static uint64_t walk_cap_type(capability *cap)
+{
+  switch (cap->type) {
+  case ct_Null:		return IKT_coyotos_Null;
+  case ct_Page:		return IKT_coyotos_Page;
+  case ct_CapPage:	return IKT_coyotos_CapPage;
+  case ct_GPT:		return IKT_coyotos_GPT;
+  case ct_Window:	return IKT_coyotos_Window;
+  case ct_LocalWindow:	return IKT_coyotos_LocalWindow;
+  default:		return IKT_coyotos_Cap;
+  }
+}
+
 void cap_GPT(InvParam_t *iParam)
 {
   size_t slot = ~0u;		/* intentionally illegal value */
@@ -147,12 +170,12 @@ void cap_GPT(InvParam_t *iParam)
 
       obhdr_dirty(&gpt->mhdr.hdr);
 
+      depend_invalidate_slot(gpt, slot);
+
       sched_commit_point();
 
       iParam->opw[0] = InvResult(iParam, 0);
 
-      depend_invalidate_slot(gpt, slot);
-
       cap_init(&gpt->state.cap[slot]);
       if (opCode == OC_coyotos_GPT_makeLocalWindow) {
 	gpt->state.cap[slot].type = ct_LocalWindow;
@@ -315,9 +338,10 @@ void cap_GPT(InvParam_t *iParam)
       if (toGPT->state.ha && slot == GPT_HANDLER_SLOT)
 	cap_handlerBeingOverwritten(&toGPT->state.cap[slot]);
       
+      depend_invalidate_slot(toGPT, slot);
+
       sched_commit_point();
 
-      depend_invalidate_slot(toGPT, slot);
       cap_set(&toGPT->state.cap[slot], iParam->srcCap[1].cap);
 
       if (opCode == OC_coyotos_AddressSpace_guardedSetSlot) {
@@ -560,9 +584,10 @@ void cap_GPT(InvParam_t *iParam)
       obhdr_dirty(&gpt->mhdr.hdr);
 
       /** @bug Check last->slot for validity. */
+      depend_invalidate_slot(gpt, last->slot);
+
       sched_commit_point();
 
-      depend_invalidate_slot(gpt, last->slot);
       cap_set(&gpt->state.cap[last->slot], iParam->srcCap[1].cap);
       if (l2g != 0) {
 	gpt->state.cap[last->slot].u1.mem.l2g = l2g;
@@ -574,6 +599,114 @@ void cap_GPT(InvParam_t *iParam)
       return;
     }
 
+  case OC_coyotos_AddressSpace_walk:
+    {
+      coyaddr_t offset = get_iparam64(iParam);
+      uint32_t stopRestr = get_iparam32(iParam);
+
+      INV_REQUIRE_ARGS(iParam, 0);
+
+      if (iParam->iCap.cap->restr & CAP_RESTR_OP) {
+	sched_commit_point();
+	InvErrorMessage(iParam, RC_coyotos_AddressSpace_OpaqueSpace);
+	return;
+      }
+
+      /* The walk fails at the first slot we would not descend through
+	 anyway, so the fault code is not interesting. */
+      MemWalkResults mwr;
+      (void) extended_memwalk(iParam->iCap.cap,
+			      offset,
+			      EXTENDED_MEMWALK_L2STOP_TO_PAGE,
+			      false,		/* not for writing */
+			      &mwr);
+
+      coyotos_AddressSpace_walkLevel path[coyotos_AddressSpace_walkMaxLevels];
+      capability *parent = iParam->iCap.cap;
+      capability *leaf = 0;
+      uint8_t aboveRestr = 0;	/* restrictions above parent */
+      size_t n = 0;
+
+      for (size_t i = 0; i < mwr.count; i++) {
+	MemWalkEntry *ent = &mwr.ents[i];
+
+	if (ent->window || ent->entry->hdr.ty != ot_GPT)
+	  break;
+
+	if (leaf) {
+	  aboveRestr |= parent->restr;
+	  parent = leaf;
+	}
+
+	/* memwalk() prepared every slot capability it examined. */
+	GPT *gpt = (GPT *) ent->entry;
+	leaf = &gpt->state.cap[ent->slot];
+
+	path[n].l2v = gpt->state.l2v;
+	path[n].slot = ent->slot;
+	path[n].guard = 0;
+	path[n].restr = 0;
+	path[n].type = walk_cap_type(leaf);
+	if (path[n].type != IKT_coyotos_Null &&
+	    path[n].type != IKT_coyotos_Cap) {
+	  path[n].guard = make_guard(leaf->u1.mem.match, leaf->u1.mem.l2g);
+	  path[n].restr = leaf->restr;
+	}
+	n++;
+
+	if (leaf->type != ct_GPT ||
+	    (leaf->restr & (stopRestr | CAP_RESTR_OP)) ||
+	    n == coyotos_AddressSpace_walkMaxLevels)
+	  break;
+      }
+
+      if (n == 0) {
+	sched_commit_point();
+	InvErrorMessage(iParam, RC_coyotos_AddressSpace_NoSuchSlot);
+	return;
+      }
+
+      size_t len = n * sizeof(path[0]);
+      CopyoutArea area;
+
+      /* A path the caller cannot receive in full is useless to it.
+	 Lock down the receive area now, but write it only after the
+	 commit point. With no invokee, nobody receives the path. */
+      if (iParam->invokee) {
+	uint32_t rbound = get_rcv_pw(iParam->invokee, IPW_RCVBOUND);
+	uintptr_t outVA = get_rcv_pw(iParam->invokee, IPW_RCVPTR);
+
+	mwr.count = 0;
+	if (rbound < len ||
+	    proc_prepare_copyout(iParam->invokee, outVA, len, 
+				 &mwr, &area) != len) {
+	  sched_commit_point();
+	  InvErrorMessage(iParam, RC_coyotos_Cap_RequestError);
+	  return;
+	}
+      }
+
+      sched_commit_point();
+
+      if (iParam->invokee) {
+	proc_copyout_prepared(&area, 0, path, len);
+	set_pw(iParam->invokee, OPW_SNDLEN, len);
+      }
+
+      uint8_t pathRestr = aboveRestr | parent->restr;
+
+      cap_set(&iParam->srcCap[0].theCap, parent);
+      if (aboveRestr & (CAP_RESTR_RO|CAP_RESTR_WK))
+	cap_weaken(&iParam->srcCap[0].theCap);
+      cap_set(&iParam->srcCap[1].theCap, leaf);
+      if (pathRestr & (CAP_RESTR_RO|CAP_RESTR_WK))
+	cap_weaken(&iParam->srcCap[1].theCap);
+
+      put_oparam32(iParam, n);
+      iParam->opw[0] = InvResult(iParam, 2);
+      return;
+    }
+
   default:
     {
       cap_AddressSpace(iParam);
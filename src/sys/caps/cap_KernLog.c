@@ -23,12 +23,20 @@
 #include <kerninc/Process.h>
 #include <kerninc/string.h>
 #include <kerninc/util.h>
+#include <kerninc/CPU.h>
+#include <kerninc/MemWalk.h>
+#include <kerninc/pstring.h>
+#include <kerninc/event.h>
 #include <coyotos/syscall.h>
 #include <hal/syscall.h>
 #include <idl/coyotos/KernLog.h>
 
 extern void cap_Cap(InvParam_t* iParam);
 
+/** @brief Number of trace records staged on the kernel stack at a
+ * time by readTrace. */
+#define TRACE_STAGE_RECORDS 8
+
 void
 cap_KernLog(InvParam_t *iParam)
 {
@@ -83,6 +91,120 @@ cap_KernLog(InvParam_t *iParam)
       return;
     }
 
+  case OC_coyotos_KernLog_getTraceInfo:
+    {
+      INV_REQUIRE_ARGS(iParam, 0);
+
+      sched_commit_point();
+
+      put_oparam32(iParam, cpu_ncpu);
+      put_oparam32(iParam, event_ring_entries());
+      iParam->opw[0] = InvResult(iParam, 0);
+      return;
+    }
+
+  case OC_coyotos_KernLog_readTrace:
+    {
+      uint32_t cpu = get_iparam32(iParam);
+      uint32_t seq = get_iparam32(iParam);
+      INV_REQUIRE_ARGS(iParam, 0);
+
+      /* Lock down the receive area before the commit point, but read
+	 the ring only after it, so that a restarted invocation cannot
+	 have written records it then fails to report. If part of the
+	 area is not mapped, report only what fits in the rest. With
+	 no invokee there is nowhere to put the records. */
+      size_t maxRec = 0;
+      CopyoutArea area;
+
+      if (iParam->invokee) {
+	uint32_t rbound = get_rcv_pw(iParam->invokee, IPW_RCVBOUND);
+	uintptr_t outVA = get_rcv_pw(iParam->invokee, IPW_RCVPTR);
+
+	maxRec = min(rbound / sizeof(EvtTraceRecord),
+		     (size_t) coyotos_KernLog_traceChunkRecords);
+
+	MemWalkResults mwr;
+	mwr.count = 0;
+
+	size_t avail = 
+	  proc_prepare_copyout(iParam->invokee, outVA, 
+			       maxRec * sizeof(EvtTraceRecord), &mwr, &area);
+	maxRec = avail / sizeof(EvtTraceRecord);
+      }
+
+      sched_commit_point();
+
+      uint32_t next = seq;
+      size_t count = 0;
+
+      while (count < maxRec) {
+	EvtTraceRecord stage[TRACE_STAGE_RECORDS];
+	size_t want = min(maxRec - count, (size_t) TRACE_STAGE_RECORDS);
+	uint32_t after;
+	size_t n = event_read(cpu, next, stage, want, &after);
+
+	if (n == 0)
+	  break;
+
+	proc_copyout_prepared(&area, count * sizeof(EvtTraceRecord),
+			      stage, n * sizeof(EvtTraceRecord));
+
+	next = after;
+	count += n;
+      }
+
+      if (iParam->invokee)
+	set_pw(iParam->invokee, OPW_SNDLEN, count * sizeof(EvtTraceRecord));
+
+      put_oparam32(iParam, next);
+      put_oparam32(iParam, count);
+      iParam->opw[0] = InvResult(iParam, 0);
+      return;
+    }
+
+  case OC_coyotos_KernLog_getCpuStats:
+    {
+      uint32_t cpu = get_iparam32(iParam);
+      INV_REQUIRE_ARGS(iParam, 0);
+
+      if (cpu >= cpu_ncpu) {
+	sched_commit_point();
+	InvErrorMessage(iParam, RC_coyotos_Cap_RequestError);
+	return;
+      }
+
+      /* As for readTrace, lock down the receive area first and write
+	 it only after the commit point. */
+      uint64_t stats[cst_NUM_STATS];
+      size_t len = 0;
+      CopyoutArea area;
+
+      if (iParam->invokee) {
+	uint32_t rbound = get_rcv_pw(iParam->invokee, IPW_RCVBOUND);
+	uintptr_t outVA = get_rcv_pw(iParam->invokee, IPW_RCVPTR);
+
+	MemWalkResults mwr;
+	mwr.count = 0;
+
+	len = proc_prepare_copyout(iParam->invokee, outVA,
+				   min((size_t) rbound, sizeof(stats)),
+				   &mwr, &area);
+      }
+
+      sched_commit_point();
+
+      if (iParam->invokee) {
+	/* Copy out of a snapshot, since the owning CPU keeps counting. */
+	memcpy(stats, cpu_vec[cpu].stats, sizeof(stats));
+	proc_copyout_prepared(&area, 0, stats, len);
+	set_pw(iParam->invokee, OPW_SNDLEN, len);
+      }
+
+      iParam->opw[0] = InvResult(iParam, 0);
+      return;
+    }
+
   default:
     cap_Cap(iParam);
     break;
@@ -153,7 +153,7 @@ void cap_ProcessCommon(InvParam_t *iParam)
 	/** @bug: What to do if already enqueued somewhere? */
 
 	/* Stick target on ready queue: */
-	rq_add(&mainRQ, p, false);
+	rq_addReady(p, false);
 
 	/* If target is invokee, invokee now in wrong state for
 	 * response. Suppress reply in this case. */
@@ -468,7 +468,7 @@ void cap_ProcessCommon(InvParam_t *iParam)
 
 	p->state.runState = PRS_RUNNING;
 	/// @bug: What locks do we require here?
-	rq_add(&mainRQ, p, false);
+	rq_addReady(p, false);
       }
 
       if (p == iParam->invokee)
@@ -158,6 +158,8 @@ void cap_Range(InvParam_t *iParam)
 	/** @bug Need to deal with a corner case here. */
 	assert(p != MY_CPU(current));
 
+	proc_release_handoff(p);
+
 	spinlock_grab(&p->rcvWaitQ.qLock);
 	sq_WakeAll(&p->rcvWaitQ, false);
 
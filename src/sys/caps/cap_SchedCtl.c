@@ -20,9 +20,54 @@
 
 #include <kerninc/capability.h>
 #include <kerninc/InvParam.h>
+#include <kerninc/Sched.h>
 #include <kerninc/printf.h>
+#include <hal/syscall.h>
+#include <coyotos/syscall.h>
+#include <idl/coyotos/SchedCtl.h>
+
+extern void cap_Cap(InvParam_t* iParam);
 
 void cap_SchedCtl(InvParam_t *iParam)
 {
-  bug("Unimplemented cap type %d\n", iParam->iCap.cap->type);
+  uintptr_t opCode = iParam->opCode;
+
+  switch(opCode) {
+  case OC_coyotos_Cap_getType:	/* Must override. */
+    {
+      INV_REQUIRE_ARGS(iParam, 0);
+
+      sched_commit_point();
+      InvTypeMessage(iParam, IKT_coyotos_SchedCtl);
+      return;
+    }
+
+  case OC_coyotos_SchedCtl_makeSchedule:
+    {
+      uint32_t prio = get_iparam32(iParam);
+      uint32_t quanta = get_iparam32(iParam);
+
+      INV_REQUIRE_ARGS(iParam, 0);
+
+      if (prio >= SCHED_NBANDS || quanta > SCHED_QUANTA_MAX) {
+	sched_commit_point();
+	InvErrorMessage(iParam, RC_coyotos_Cap_RequestError);
+	return;
+      }
+
+      sched_commit_point();
+
+      cap_init(&iParam->srcCap[0].theCap);
+
+      iParam->srcCap[0].theCap.type = ct_Schedule;
+      iParam->srcCap[0].theCap.u1.protPayload = SCHED_PAYLOAD(prio, quanta);
+
+      iParam->opw[0] = InvResult(iParam, 1);
+      return;
+    }
+
+  default:
+    cap_Cap(iParam);
+    break;
+  }
 }
@@ -41,6 +41,20 @@ void cap_Schedule(InvParam_t *iParam)
       return;
     }
 
+  case OC_coyotos_Schedule_getParams:
+    {
+      uint32_t pp = iParam->iCap.cap->u1.protPayload;
+
+      INV_REQUIRE_ARGS(iParam, 0);
+
+      sched_commit_point();
+
+      put_oparam32(iParam, SCHED_PAYLOAD_PRIO(pp));
+      put_oparam32(iParam, SCHED_PAYLOAD_QUANTA(pp));
+      iParam->opw[0] = InvResult(iParam, 0);
+      return;
+    }
+
   default:
     cap_Cap(iParam);
     break;
@@ -83,12 +83,15 @@ void cap_Sleep(InvParam_t *iParam)
       iParam->invoker->wakeTime.sec += now.sec;
       iParam->invoker->wakeTime.usec += now.usec;
       if (iParam->invoker->wakeTime.usec >= 1000000) {
-	iParam->invoker->wakeTime.usec -= 10000000;
+	iParam->invoker->wakeTime.usec -= 1000000;
 	iParam->invoker->wakeTime.sec ++;
       }
 
-      /* In case this restarts for some reason: */
+      /* The invocation restarts when we are woken, so turn it into
+       * the equivalent sleepTill: */
       set_pw(iParam->invoker, 1, OC_coyotos_Sleep_sleepTill);
+      set_pw(iParam->invoker, 2, iParam->invoker->wakeTime.sec);
+      set_pw(iParam->invoker, 3, iParam->invoker->wakeTime.usec);
 
       interval_delay(iParam->invoker);
 
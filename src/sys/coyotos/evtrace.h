@@ -0,0 +1,79 @@
+#ifndef __COYOTOS_EVTRACE_H__
+#define __COYOTOS_EVTRACE_H__
+/*
+ * Copyright (C) 2007, The EROS Group, LLC.
+ *
+ * This file is part of the Coyotos Operating System.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** @file
+ * @brief Kernel event trace record format.
+ *
+ * Shared by the kernel, by clients of KernLog.readTrace, and by the
+ * host-side trace decoder.
+ */
+
+/* Event types. The meaning of the three values is given for each. */
+
+#define ety_None         0	/* unused record */
+#define ety_Halt         1
+#define ety_Trap         2	/* process, vector, error code */
+#define ety_TrapRet      3	/* kernel save area */
+#define ety_RunProc      4	/* process */
+#define ety_PageFault    5	/* process, error code, address */
+#define ety_MapSwitch    6	/* old map, new map */
+#define ety_RestartTX    7	/* process */
+#define ety_AbandonTX    8	/* process */
+#define ety_UserPreempt  9	/* process */
+#define ety_KernPreempt  10	/* process */
+#define ety_IpcSend      11	/* invoker, invokee, string bytes sent */
+#define ety_IpcRecv      12	/* process entering receive, control word */
+#define ety_ProcFault    13	/* process, fault code, fault info */
+#define ety_Wakeup       14	/* process, target CPU, priority */
+#define ety_LockDefer    15	/* mutex, holding CPU, lock value */
+
+#define ety_NTYPE        16
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+/** @brief One trace record.
+ *
+ * The layout is fixed so that records can be copied out of the kernel
+ * and decoded on a host of any word size.
+ */
+typedef struct EvtTraceRecord {
+  /** @brief Cycle counter at the time of the event. */
+  uint64_t tsc;
+  uint64_t v0;
+  uint64_t v1;
+  uint64_t v2;
+  /** @brief One of the ety_ values. */
+  uint8_t  type;
+  /** @brief CPU that logged the event. */
+  uint8_t  cpu;
+  uint16_t pad0;
+  /** @brief One more than the event number of this record, written
+   * last so that readers can tell whether the record is complete.
+   * Zero if the record has never been written. */
+  uint32_t seq;
+} EvtTraceRecord;
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* __COYOTOS_EVTRACE_H__ */
@@ -68,4 +68,11 @@ static inline void atomic_set_bits(Atomic32_t *a, uint32_t mask);
 /** @brief Atomic clear bits into word. */
 static inline void atomic_clear_bits(Atomic32_t *a, uint32_t mask);
 
+/** @brief Full memory barrier.
+ *
+ * Neither the compiler nor the processor may move loads or stores
+ * across this point. Used by sequence-validated readers that do not
+ * hold the lock protecting the data they examine. */
+static inline void memory_barrier(void);
+
 #endif /* __HAL_ATOMIC_H__ */
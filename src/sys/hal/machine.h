@@ -25,8 +25,16 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <target-hal/machine.h>
 
+/** @brief Return the local processor's free-running cycle counter.
+ *
+ * Used to timestamp trace events. Values are only comparable between
+ * processors if the hardware keeps their counters in step.
+ */
+static inline uint64_t read_cycle_counter(void);
+
 /** @brief Select a (possibly new) process to run.
  *
  * This procedure, when called, performs a non-local return into the
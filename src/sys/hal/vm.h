@@ -95,8 +95,16 @@ void vm_switch_curcpu_to_map(struct Mapping *map);
 struct Process;
 static inline bool vm_valid_uva(struct Process *p, kva_t uva);
 
+/** @brief Flush the user-mode entries of the current CPU's TLB.
+ *
+ * Entries for kernel mappings that the hardware treats as global
+ * survive. */
 static inline void local_tlb_flush();
 
+/** @brief Flush the current CPU's entire TLB, global entries
+ * included. */
+static inline void local_tlb_flush_global();
+
 static inline void local_tlb_flushva(kva_t va);
 
 #endif /* HAL_VM_KMAP_H */
@@ -26,6 +26,7 @@
 #include <stdbool.h>
 #include <kerninc/ccs.h>
 #include <kerninc/CPU.h>
+#include <kerninc/ReadyQueue.h>
 #include <hal/config.h>
 #include <kerninc/mutex.h>
 #include <kerninc/vector.h>
@@ -50,6 +51,8 @@ cpu_construct(cpuid_t ndx)
 
   cpu->procMutexValue = LOCKVALUE(0, LTY_TRAN, cpu->id);
   cpu->wakeVectors = 0;
+
+  rq_init(&rq_vec[ndx]);
 }
 
 /** @brief Wake up the processes that are blocked waiting for pending
@@ -167,6 +167,13 @@ cache_estimate_sizes(size_t pagesPerProc, kpsize_t totPage)
   TWEAK_CACHE(ote);
   ADJUST_CACHE(ote);
 
+  // The object hash is sized from the OTE count:
+  {
+    size_t nBytes = align_up(obhash_estimate_bytes(Cache.ote.count),
+			     COYOTOS_PAGE_SIZE);
+    Cache.c_Page.count -= nBytes / COYOTOS_PAGE_SIZE;
+  }
+
   // Add some fuzz to the page total, because the various align_ups
   // that we have done above can lead to a small number of free pages
   // that we will not have properly accounted for.
@@ -264,10 +271,58 @@ obhdr_findPageFrame(kpa_t pa)
   return 0;
 }
 
+/** @brief Number of page frames handed to the page cache so far,
+ * including frames adopted from the preloaded image. */
+static size_t nPage = 0;
+
+/** @brief Number of data page OIDs covered by the preloaded image.
+ *
+ * Zero pages in the image are not given frames at load time. They
+ * are materialized on first reference by obstore_require_object(),
+ * which will only do so for OIDs below Cache.max_oid[ot_Page].
+ */
+static oid_t preloadPageBound = 0;
+
+/** @brief Allocate a page header for the frame at @p pa and record
+ * it in the physical address index.
+ *
+ * The caller must sort Cache.page_byPhysAddr before anyone searches
+ * it.
+ */
+static Page *
+cache_new_page_frame(kpa_t pa)
+{
+  Page *phdr = cache_alloc_page_header();
+  assert(phdr);
+
+  phdr->pa = pa;
+  Cache.page_byPhysAddr[Cache.page_byPhysAddr_count++] = phdr;
+  nPage++;
+
+  return phdr;
+}
+
+/** @brief Tag a new frame as an unused page and put it up for
+ * allocation.
+ *
+ * Free frames are named by their physical OID, entered into the
+ * obhash table and placed on the aging list.
+ */
+static void
+cache_add_free_frame(Page *phdr)
+{
+  phdr->mhdr.hdr.oid = 
+    coyotos_Range_physOidStart + (phdr->pa / COYOTOS_PAGE_SIZE);
+  phdr->mhdr.hdr.ty = ot_Page;
+
+  obhash_insert_obj(phdr);
+	
+  cache_newobj_setup_aging(&phdr->mhdr.hdr);
+}
+
 void
 cache_add_page_space(bool lastCall)
 {
-  static size_t nPage = 0;
   size_t contigPages = 0;
 
   do {
@@ -297,27 +352,9 @@ cache_add_page_space(bool lastCall)
 
       assert(pa);
 
-      /* We are allocating headers out of the header free list,
-	 initializing the information about the associated frame, and
-	 then adding the result into the obhash table and the aging
-	 linked list. */
       for (size_t i = 0; i < contigPages; i++) {
-	Page *phdr = cache_alloc_page_header();
-	assert(phdr);
-
-	phdr->pa = pa;
-	phdr->mhdr.hdr.oid = 
-	  coyotos_Range_physOidStart + (pa / COYOTOS_PAGE_SIZE);
-	phdr->mhdr.hdr.ty = ot_Page;
-
-	Cache.page_byPhysAddr[Cache.page_byPhysAddr_count++] = phdr;
-
-	obhash_insert_obj(phdr);
-	
-	cache_newobj_setup_aging(&phdr->mhdr.hdr);
-
+	cache_add_free_frame(cache_new_page_frame(pa));
 	pa += COYOTOS_PAGE_SIZE;
-	nPage++;
       }
     }
   } while(contigPages);
@@ -339,6 +376,10 @@ cache_add_page_space(bool lastCall)
   Cache.max_oid[ot_Page] = nPage - (nPage / NPAGE_PER_CAPPAGE);
   Cache.max_oid[ot_CapPage] = (nPage / NPAGE_PER_CAPPAGE);
 
+  /* Elided image pages must remain reachable. */
+  if (Cache.max_oid[ot_Page] < preloadPageBound)
+    Cache.max_oid[ot_Page] = preloadPageBound;
+
   DEBUG_CACHE 
     printf("Page space is %d pages (est. was %d)\n", nPage, Cache.c_Page.count);
 
@@ -403,6 +444,8 @@ cache_add_page_space(bool lastCall)
       Cache.vector[i].hdr.oid = coyotos_Range_physOidStart + i;		\
       link_init(&Cache.vector[i].hdr.ageLink);				\
       link_init(&Cache.vector[i].queue_link);				\
+      Cache.vector[i].priority = SCHED_PRIO_DEFAULT;			\
+      Cache.vector[i].quanta = SCHED_QUANTA_DEFAULT;			\
       sq_Init(&Cache.vector[i].rcvWaitQ);				\
       obhash_insert_obj(&Cache.vector[i]);				\
       cache_newobj_setup_aging(&Cache.vector[i].hdr);			\
@@ -445,6 +488,8 @@ cache_init()
 {
   link_init(&Cache.freePageHeaders);
 
+  obhash_init(Cache.ote.count);
+
 #define DO_CONST(func, type)   func(c_ ## type, v_ ## type, ot_ ##type)
 
   DO_CONST(PROC_OBFRAME_CONSTRUCT,	Process);
@@ -691,6 +736,7 @@ cache_install_new_object(ObjectHeader *hdr)
 #define OTHER_ALLOC(cname, type)				\
   do {								\
     type *ret = (type *) freelist_alloc(&Cache.cname.freeList);	\
+    if (ret)							\
       INIT_TO_ZERO(ret);					\
     return ret;							\
   } while (0)
@@ -718,12 +764,24 @@ cache_alloc_Depend(void)
   OTHER_ALLOC(dep, Depend);
 }
 
+void
+cache_free_Depend(Depend *dep)
+{
+  freelist_insert(&Cache.dep.freeList, dep);
+}
+
 RevMap *
 cache_alloc_RevMap(void)
 {
   OTHER_ALLOC(rmap, RevMap);
 }
 
+void
+cache_free_RevMap(RevMap *rm)
+{
+  freelist_insert(&Cache.rmap.freeList, rm);
+}
+
 Page *
 cache_alloc_page_header(void)
 {
@@ -763,9 +821,13 @@ cache_clear_object(ObjectHeader *ob)
       atomic_write(&p->issues, 0);
       p->lastCPU = 0;		/* doesn't really matter */
       p->readyQ = 0;
+      p->priority = SCHED_PRIO_DEFAULT;
+      p->quanta = SCHED_QUANTA_DEFAULT;
       assert(p->onQ == 0);
       assert(link_isSingleton(&p->queue_link));
       p->mappingTableHdr = 0;
+      memwalk_cache_init(&p->walkCache);
+      proc_release_handoff(p);
       assert(sq_IsEmpty(&p->rcvWaitQ));
       assert(p->ipcPeer == 0);
 
@@ -837,6 +899,22 @@ proc_gc(Process *p)
     cap_gc(&p->state.capReg[i]);
 }
 
+/** @brief Return true if the physical page at @p pa holds only
+ * zero bytes. */
+static bool
+cache_phys_page_is_zero(kpa_t pa)
+{
+  const uint32_t *words = TRANSMAP_MAP(pa, const uint32_t *);
+  uint32_t accum = 0;
+
+  for (size_t i = 0; i < COYOTOS_PAGE_SIZE / sizeof(uint32_t); i++)
+    accum |= words[i];
+
+  TRANSMAP_UNMAP(words);
+
+  return (accum == 0);
+}
+
 Page *
 cache_get_physPage(kpa_t pa)
 {
@@ -913,7 +991,7 @@ cache_get_physPage(kpa_t pa)
   return page;
 }
 
-void
+kpa_t
 cache_preload_image(const char *name, kpa_t base, size_t size)
 {
   static int hasrun = 0;
@@ -944,9 +1022,9 @@ cache_preload_image(const char *name, kpa_t base, size_t size)
     fatal("%s: bad byte order (%d, expected %d)\n", name, 
 	  hdr.endian, BYTE_ORDER);
 
-  if (hdr.version != 1)
-    fatal("%s: bad version (%d, expected %d)\n", name, 
-	  hdr.version, 1);
+  if (hdr.version != 1 && hdr.version != COYIMG_VERSION)
+    fatal("%s: bad version (%d, expected 1 or %d)\n", name, 
+	  hdr.version, COYIMG_VERSION);
 
   if (hdr.target != COYOTOS_ARCH)
     fatal("%s: bad target arch (%d, expected %d)", name,
@@ -960,10 +1038,23 @@ cache_preload_image(const char *name, kpa_t base, size_t size)
     fatal("%s: imgBytes (0x%lx) != size (0x%lx)\n",
 	  name, hdr.imgBytes, size);
 
+  /* A version 1 image stores every page verbatim, which is equivalent
+   * to an identity page table that is not present in the image. */
+  size_t nImgPage = hdr.nPage + hdr.nCapPage;
+  uint32_t nFrame = nImgPage;
+  size_t nTablePages = 0;
+
+  if (hdr.version != 1) {
+    nFrame = hdr.nFrame;
+    nTablePages = 
+      align_up(nImgPage * sizeof(uint32_t), COYOTOS_PAGE_SIZE) / 
+      COYOTOS_PAGE_SIZE;
+  }
+
   /* Sanity check that we don't have a structure size mismatch */
   uint32_t expectedBytes = 
-    hdr.nPage * COYOTOS_PAGE_SIZE +
-    hdr.nCapPage * COYOTOS_PAGE_SIZE +
+    nFrame * COYOTOS_PAGE_SIZE +
+    nTablePages * COYOTOS_PAGE_SIZE +
     hdr.nGPT * sizeof(ExGPT) +
     hdr.nEndpoint * sizeof(ExEndpoint) +
     hdr.nProc * OBSTORE_EXPROCESS_COMMON_SIZE;
@@ -971,41 +1062,82 @@ cache_preload_image(const char *name, kpa_t base, size_t size)
   if (expectedBytes != hdr.imgBytes)
     fatal("%s: Size mismatch in image structures.\n", name);
 
-  uintptr_t cur = base;
+  /* The page frames lead the image, so they can be adopted as page
+   * cache frames in place. Retag that part of the module so that it
+   * is neither handed out again by cache_add_page_space() nor
+   * released with the rest of the module.
+   */
+  kpa_t adopted = base + (kpa_t)nFrame * COYOTOS_PAGE_SIZE;
+  kpa_t pageTable = adopted;
+  uint32_t nextFrame = 0;
+  size_t nZero = 0;
+  size_t nDup = 0;
+
+  pmem_AllocRegion(base, adopted, pmc_RAM, pmu_PAGES, "preloaded pages");
 
+  /* Walk the data pages and then the capability pages. Frames are
+   * numbered in order of first use, so the first page to name a frame
+   * takes it over and later pages naming it get a copy. */
   size_t idx;
-  for (idx = 0; idx < hdr.nPage; idx++) {
-    Page *pg = cache_alloc_page();
+  for (idx = 0; idx < nImgPage; idx++) {
+    bool isCapPage = (idx >= hdr.nPage);
+    uint32_t frame = idx;
+    Page *pg;
+
+    if (hdr.version != 1)
+      memcpy_ptov(&frame, pageTable + idx * sizeof(frame), sizeof(frame));
+
+    /* All-zero pages are indistinguishable from a page that has never
+     * been loaded, so leave them to be materialized on demand. */
+    if (frame == COYIMG_ZERO_PAGE && !isCapPage) {
+      nZero++;
+      continue;
+    }
+
+    if (frame == nextFrame) {
+      pg = cache_new_page_frame(base + (kpa_t)frame * COYOTOS_PAGE_SIZE);
+      nextFrame++;
+
+      /* Version 1 images do not mark zero pages, so find them here
+       * and put their frames up for general use. */
+      if (hdr.version == 1 && !isCapPage && 
+	  cache_phys_page_is_zero(pg->pa)) {
+	cache_add_free_frame(pg);
+	nZero++;
+	continue;
+      }
+    }
+    else if (frame < nextFrame) {
+      pg = cache_alloc_page();
+      memcpy_ptop(pg->pa, base + (kpa_t)frame * COYOTOS_PAGE_SIZE,
+		  COYOTOS_PAGE_SIZE);
+      nDup++;
+    }
+    else
+      fatal("%s: bad frame %d for page %d\n", name, frame, idx);
 
-    pg->mhdr.hdr.ty = ot_Page;
-    pg->mhdr.hdr.oid = idx;
+    pg->mhdr.hdr.ty = isCapPage ? ot_CapPage : ot_Page;
+    pg->mhdr.hdr.oid = isCapPage ? idx - hdr.nPage : idx;
     pg->mhdr.hdr.allocCount = 0;
     pg->mhdr.hdr.current = 1;
 
-    // At the moment, we don't try to elide zero pages.  If we did,
-    // it would effect this code.
-    memcpy_ptop(pg->pa, cur, COYOTOS_PAGE_SIZE);
-    cur += COYOTOS_PAGE_SIZE;
+    // validate capabilities ?
 
     cache_install_new_object(&pg->mhdr.hdr);
     obhash_insert_obj(pg);
   }
 
-  for (idx = 0; idx < hdr.nCapPage; idx++) {
-    Page *pg = cache_alloc_page();
+  if (nextFrame != nFrame)
+    fatal("%s: %d of %d frames used\n", name, nextFrame, nFrame);
 
-    pg->mhdr.hdr.ty = ot_CapPage;
-    pg->mhdr.hdr.oid = idx;
-    pg->mhdr.hdr.allocCount = 0;
-    pg->mhdr.hdr.current = 1;
+  preloadPageBound = hdr.nPage;
 
-    // validate capabilities ?
-    memcpy_ptop(pg->pa, cur, COYOTOS_PAGE_SIZE);
-    cur += COYOTOS_PAGE_SIZE;
+  shellsort(Cache.page_byPhysAddr,
+	    Cache.page_byPhysAddr_count,
+	    sizeof (Cache.page_byPhysAddr),
+	    page_physaddr_cmp);
 
-    cache_install_new_object(&pg->mhdr.hdr);
-    obhash_insert_obj(pg);
-  }
+  kpa_t cur = pageTable + (kpa_t)nTablePages * COYOTOS_PAGE_SIZE;
 
   for (idx = 0; idx < hdr.nGPT; idx++) {
     GPT *gpt = cache_alloc_GPT();
@@ -1049,6 +1181,8 @@ cache_preload_image(const char *name, kpa_t base, size_t size)
     atomic_write(&proc->issues, pi_IssuesOnLoad);
 
     proc->mappingTableHdr = 0;
+    memwalk_cache_init(&proc->walkCache);
+    proc->rcvHandoff = 0;
 
     // The data structure coming from mkimage omits a bunch of the
     // process state. Zero the whole thing before overwriting the
@@ -1066,8 +1200,8 @@ cache_preload_image(const char *name, kpa_t base, size_t size)
     // as having a startup fault.
     if (proc->state.faultCode == coyotos_Process_FC_Startup) {
       proc->state.runState = PRS_RUNNING;
-      atomic_write(&proc->issues, pi_Faulted);
-      rq_add(&mainRQ, proc, false);
+      atomic_write(&proc->issues, pi_IssuesOnLoad | pi_Faulted);
+      rq_addReady(proc, false);
     }
   }
 
@@ -1075,7 +1209,11 @@ cache_preload_image(const char *name, kpa_t base, size_t size)
     fatal("%s: ran over the size\n", name);
 
   printf("%s: loaded "
-	 " nPage=%d nCapPage=%d nGPT=%d nEndpoint=%d nProc=%d\n", name,
-	 hdr.nPage, hdr.nCapPage, hdr.nGPT, hdr.nEndpoint, hdr.nProc);
+	 " nPage=%d (%d zero, %d shared) nCapPage=%d nGPT=%d"
+	 " nEndpoint=%d nProc=%d\n",
+	 name, hdr.nPage, nZero, nDup, hdr.nCapPage, hdr.nGPT,
+	 hdr.nEndpoint, hdr.nProc);
+
+  return adopted;
 }
 
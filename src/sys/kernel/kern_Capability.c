@@ -223,13 +223,31 @@ cap_prepare_for_invocation(InvParam_t *iParam, capability *cap,
   }
 
   Process *p = (Process *)pCap->u2.prepObj.target;
+
+  /* If we were woken by this receiver to retry, we are now acting on
+   * that wakeup. It stays with us until the send commits (see
+   * proc_consume_handoff()). Every exit that does not deliver must
+   * either use it up here or leave it to be passed on by
+   * proc_release_handoff(). */
+  bool handedOff = 
+    (iParam->invoker && iParam->invoker->rcvHandoff == p);
+
   /* We have a prepared process;  check to see if it is receiving */
   bool validState = ((selfOK && p == iParam->invoker)
 		     || p->state.runState == PRS_RECEIVING);
 
   if (!validState) {
-    if (willingToBlock)
-      sq_SleepOn(&p->rcvWaitQ);
+    if (willingToBlock) {
+      /* Someone beat us to the receiver. Go back to sleep at the
+       * head of the line, and the receiver will wake us again when
+       * it next waits. */
+      if (handedOff) {
+	iParam->invoker->rcvHandoff = NULL;
+	sq_ResleepOn(&p->rcvWaitQ);
+      }
+      else
+	sq_SleepOn(&p->rcvWaitQ);
+    }
     
     return NULL;
   }
@@ -245,8 +263,13 @@ cap_prepare_for_invocation(InvParam_t *iParam, capability *cap,
      * unwilling to block, proceed to receive phase. Policy:
      * reply cap has not been successfully invoked, so do not
      * bump PP. */
-    if (willingToBlock)
+    if (willingToBlock) {
+      /* The receiver is waiting, just not for us. Some other sender
+       * may be able to use the wakeup. */
+      if (handedOff)
+	proc_release_handoff(iParam->invoker);
       sq_SleepOn(&p->rcvWaitQ);
+    }
 
     return NULL;
   }
@@ -27,6 +27,7 @@
 #include <kerninc/string.h>
 #include <kerninc/printf.h>
 #include <kerninc/Cache.h>
+#include <kerninc/event.h>
 
 char CommandLine[COMMAND_LINE_LIMIT];
 
@@ -123,6 +124,9 @@ cmdline_option_arg(const char *optName)
   while (*s && *s != '=')
     s++;
 
+  if (*s == '=')
+    s++;
+
   return s;
 }
 
@@ -159,5 +163,6 @@ cmdline_process_options()
   Cache.c_Endpoint.count = cmdline_option_uvalue("nendpt");
   //   Cache.page.count = cmdline_option_uvalue("npage");
   Cache.dep.count = cmdline_option_uvalue("depend");
+  evt_trace_entries = cmdline_option_uvalue("evtrace");
 }
 
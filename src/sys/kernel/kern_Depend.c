@@ -20,6 +20,17 @@
 
 /** @file
  * @brief Depend Table management
+ *
+ * Depend entries hang directly off of the GPT that produced them, in
+ * a chain of Depend blocks rooted at GPT::depend. Each block belongs
+ * to exactly one GPT. Invalidation therefore touches only the
+ * entries of the GPT being modified.
+ *
+ * The chain is protected by the lock on the owning GPT, which is
+ * held by every caller of the depend_* interfaces. When the Depend
+ * cache runs dry, we steal a block from some other GPT whose lock we
+ * can obtain without waiting, invalidating the PTEs that its entries
+ * describe.
  */
 
 #include <kerninc/Depend.h>
@@ -27,26 +38,13 @@
 #include <kerninc/ObjectHeader.h>
 #include <kerninc/GPT.h>
 #include <kerninc/Cache.h>
+#include <kerninc/MemWalk.h>
 #include <kerninc/assert.h>
 #include <kerninc/printf.h>
 #include <hal/machine.h>
 
-#define DEPEND_TABLE_SIZE 1024
-
-typedef struct DependBucket {
-  spinlock_t lock;
-  Depend *list;
-} DependBucket;
-
-DependBucket dependTable[DEPEND_TABLE_SIZE];
-
-static inline DependBucket *
-depend_hash(GPT *gpt)
-{
-  size_t bucket = ((uintptr_t)gpt / sizeof (*gpt)) % DEPEND_TABLE_SIZE;
-
-  return (&dependTable[bucket]);
-}
+/** @brief Clock hand for Depend block reclaim. */
+static Atomic32_t depend_reclaim_hand;
 
 /**
  * @brief Attempt to merge the new depend entry @p n with an existing 
@@ -58,7 +56,8 @@ depend_hash(GPT *gpt)
  * and returns true.
  *
  * In order to be mergable, the l2slotSpans must match, and the
- * implied base PTE must be identical.
+ * implied base PTE must be identical. Large page entries merge only
+ * with large page entries naming the same PTE.
  */
 static inline bool
 depend_merge(DependEntry *e, DependEntry n)
@@ -68,6 +67,19 @@ depend_merge(DependEntry *e, DependEntry n)
     return false;
 
 #if MAPPING_INDEX_BITS
+  if (e->withinPTE != n.withinPTE)
+    return false;
+
+  if (n.withinPTE) {
+    if (e->basePTE != n.basePTE)
+      return false;
+
+    if (n.slotBias < e->slotBias)
+      e->slotBias = n.slotBias;
+    e->slotMask |= n.slotMask;
+    return true;
+  }
+
   if (e->l2slotSpan != n.l2slotSpan ||
       (e->basePTE - (e->slotBias << e->l2slotSpan)) !=
       (n.basePTE - (n.slotBias << n.l2slotSpan)))
@@ -87,96 +99,198 @@ depend_merge(DependEntry *e, DependEntry n)
   return true;
 }
 
-void 
-depend_install(DependEntry arg)
+/** @brief Unlink @p dep from the chain of its owning GPT and return it
+ * to the free list.
+ *
+ * Caller must hold the lock on the owning GPT, and all entries of @p
+ * dep must already have been invalidated.
+ */
+static void
+depend_release_block(Depend *dep)
 {
-  assert(arg.gpt != NULL);
+  GPT *gpt = dep->owner;
+  Depend **pp;
 
-  DependBucket *b = depend_hash(arg.gpt);
-  SpinHoldInfo hi = spinlock_grab(&b->lock);
-  Depend *cur;
-  bool free = false;
+  assert(dep->nvalid == 0);
 
-  for (cur = b->list; cur; cur = cur->next) {
-    if (cur->nvalid < ENTRIES_PER_DEPEND)
-      free = true;
-    for (size_t i = 0; i < ENTRIES_PER_DEPEND; i++) {
-      if (depend_merge(&cur->ents[i], arg)) {
-	spinlock_release(hi);
-	return;
-      }
-    }
-  }
-  if (!free) {
-    Depend *nDep = cache_alloc_Depend();
-    /** @bug we need to invalidate depend entries if this fails */
-    assert(nDep != NULL);
-    nDep->next = b->list;
-    b->list = nDep;
+  for (pp = &gpt->depend; *pp != dep; pp = &(*pp)->next)
+    assert(*pp != NULL);
+
+  *pp = dep->next;
+  dep->owner = 0;
+
+  cache_free_Depend(dep);
+}
+
+/** @brief Invalidate every entry in @p dep. */
+static void
+depend_block_invalidate(Depend *dep)
+{
+  for (size_t i = 0; i < ENTRIES_PER_DEPEND; i++) {
+    if (dep->ents[i].gpt == 0)
+      continue;
+
+    depend_entry_invalidate(&dep->ents[i], DEPEND_INVALIDATE_ALL);
+    dep->ents[i].gpt = 0;
+    assert(dep->nvalid > 0);
+    dep->nvalid--;
   }
-  for (cur = b->list; cur; cur = cur->next) {
-    if (cur->nvalid >= ENTRIES_PER_DEPEND)
+}
+
+/** @brief Reclaim a Depend block from some GPT other than @p self.
+ *
+ * Sweeps the Depend vector from a rotating clock hand, looking for an
+ * in-use block whose owner can be locked without waiting. The
+ * victim's hardware mappings are invalidated, so the only cost to
+ * its owner is a later re-fault.
+ *
+ * Returns NULL if no block could be reclaimed.
+ */
+static Depend *
+depend_reclaim(GPT *self)
+{
+  size_t count = Cache.dep.count;
+
+  for (size_t n = 0; n < count; n++) {
+    size_t ndx;
+    uint32_t hand;
+
+    do {
+      hand = atomic_read(&depend_reclaim_hand);
+    } while (compare_and_swap(&depend_reclaim_hand, hand, hand + 1) != hand);
+    ndx = hand % count;
+
+    Depend *victim = &Cache.dep.vec[ndx];
+    GPT *owner = victim->owner;
+
+    if (owner == 0 || owner == self)
+      continue;
+
+    /* A GPT locked by this transaction may be part of the walk that
+     * is installing depend entries right now. Leave it alone. */
+    if (mutex_isheld(&owner->mhdr.hdr.lock))
       continue;
+
+    HoldInfo hi;
+    if (!mutex_trygrab(&owner->mhdr.hdr.lock, &hi))
+      continue;
+
+    /* Block may have changed hands before we got the lock. */
+    if (victim->owner != owner) {
+      mutex_release(hi);
+      continue;
+    }
+
+    depend_block_invalidate(victim);
+    depend_entry_flush(false);
+    depend_release_block(victim);
+    mutex_release(hi);
+
+    Depend *dep = cache_alloc_Depend();
+    if (dep)
+      return dep;
+  }
+
+  return NULL;
+}
+
+void 
+depend_install(DependEntry arg)
+{
+  GPT *gpt = arg.gpt;
+  Depend *cur;
+  Depend *freeDep = 0;
+  size_t freeNdx = 0;
+
+  assert(gpt != NULL);
+  assert(mutex_isheld(&gpt->mhdr.hdr.lock));
+
+  /* Single pass: merge if we can, remembering the first free entry
+   * in case we cannot. */
+  for (cur = gpt->depend; cur; cur = cur->next) {
     for (size_t i = 0; i < ENTRIES_PER_DEPEND; i++) {
       if (cur->ents[i].gpt == 0) {
-	cur->ents[i] = arg;
-	cur->nvalid++;
-	assert(cur->nvalid <= ENTRIES_PER_DEPEND);
-	spinlock_release(hi);
-	return;
+	if (freeDep == 0) {
+	  freeDep = cur;
+	  freeNdx = i;
+	}
+	continue;
       }
+      if (depend_merge(&cur->ents[i], arg))
+	return;
     }
   }
-  /* this should never be reached */
-  fatal("There should have been at least one free entry in depend bucket");
+
+  if (freeDep == 0) {
+    freeDep = cache_alloc_Depend();
+    if (freeDep == NULL)
+      freeDep = depend_reclaim(gpt);
+    if (freeDep == NULL)
+      fatal("Depend cache exhausted, and nothing is reclaimable\n");
+
+    freeDep->owner = gpt;
+    freeDep->next = gpt->depend;
+    gpt->depend = freeDep;
+    freeNdx = 0;
+  }
+
+  freeDep->ents[freeNdx] = arg;
+  freeDep->nvalid++;
+  assert(freeDep->nvalid <= ENTRIES_PER_DEPEND);
 }
 
 void
 depend_invalidate(GPT *gpt)
 {
-  DependBucket *b = depend_hash(gpt);
-  SpinHoldInfo hi = spinlock_grab(&b->lock);
   Depend *cur;
 
-  for (cur = b->list; cur; cur = cur->next) {
-    for (size_t i = 0; i < ENTRIES_PER_DEPEND; i++) {
-      if (cur->ents[i].gpt == gpt) {
-	depend_entry_invalidate(&cur->ents[i], DEPEND_INVALIDATE_ALL);
-	cur->ents[i].gpt = 0;
-	assert(cur->nvalid > 0);
-	cur->nvalid--;
-      }
-    }
+  assert(mutex_isheld(&gpt->mhdr.hdr.lock));
+
+  memwalk_cache_invalidate(gpt);
+
+  while ((cur = gpt->depend) != NULL) {
+    depend_block_invalidate(cur);
+    depend_release_block(cur);
   }
-  spinlock_release(hi);
+
+  depend_entry_flush(false);
 }
 
 void
 depend_invalidate_slot(GPT *gpt, size_t slot)
 {
+  assert(mutex_isheld(&gpt->mhdr.hdr.lock));
+
+  memwalk_cache_invalidate(gpt);
+
 #if MAPPING_INDEX_BITS
-  DependBucket *b = depend_hash(gpt);
-  SpinHoldInfo hi = spinlock_grab(&b->lock);
   Depend *cur;
+  Depend *next;
   size_t mask = 1u << slot;
 
-  for (cur = b->list; cur; cur = cur->next) {
+  for (cur = gpt->depend; cur; cur = next) {
+    next = cur->next;
+
     for (size_t i = 0; i < ENTRIES_PER_DEPEND; i++) {
-      if (cur->ents[i].gpt == gpt) {
-	if (!(cur->ents[i].slotMask & mask))
-	  continue;
+      if (cur->ents[i].gpt == 0)
+	continue;
+      if (!(cur->ents[i].slotMask & mask))
+	continue;
 
-	depend_entry_invalidate(&cur->ents[i], slot);
-	cur->ents[i].slotMask &= ~mask;
+      depend_entry_invalidate(&cur->ents[i], slot);
+      cur->ents[i].slotMask &= ~mask;
 
-	if (cur->ents[i].slotMask == 0) {
-	  cur->ents[i].gpt = 0;
-	  assert(cur->nvalid > 0);
-	  cur->nvalid--;
-	}
+      if (cur->ents[i].slotMask == 0) {
+	cur->ents[i].gpt = 0;
+	assert(cur->nvalid > 0);
+	cur->nvalid--;
       }
     }
+
+    if (cur->nvalid == 0)
+      depend_release_block(cur);
   }
-  spinlock_release(hi);
+
+  depend_entry_flush(true);
 #endif
 }
@@ -23,59 +23,219 @@
  *
  * This implements a mechanism for logging kernel "events of
  * interest". The idea is to have something we can dump when a kernel
- * bug occurs so that we can see what the heck is going on.
+ * bug occurs so that we can see what the heck is going on, and
+ * something we can pull out of a running system when chasing latency
+ * problems.
+ *
+ * Each CPU has its own ring, so logging never contends across
+ * CPUs. Slots are claimed with compare-and-swap, so an interrupt
+ * that logs while we are logging simply takes the next slot. Records
+ * are stamped with the local cycle counter.
+ *
+ * A claimed slot is filled in after the claim, and may be reused
+ * while a reader on another CPU is copying it. Each record therefore
+ * carries its event number plus one in @p seq, which the writer
+ * clears before filling the record and sets once it is done. A reader
+ * keeps a record only if @p seq is right both before and after the
+ * copy.
  *
  * This subsystem carries a significant performance cost. It is
- * compiled into the kernel only when -DEVT_DEBUG is enabled.
+ * compiled into the kernel only when -DEVT_TRACE is enabled.
  */
 
+#include <stddef.h>
+#include <kerninc/event.h>
+
+size_t evt_trace_entries = 0;
+
 #ifdef EVT_TRACE
 #include <inttypes.h>
 #include <kerninc/printf.h>
-#include <kerninc/event.h>
+#include <kerninc/CPU.h>
+#include <kerninc/malloc.h>
+#include <kerninc/string.h>
+#include <kerninc/util.h>
+#include <hal/atomic.h>
+#include <hal/machine.h>
+
+/** @brief Per-CPU ring size used when none is given on the command
+ * line. Must be a power of two. */
+#define EVT_DEFAULT_ENTRIES 256
 
+/** @brief Largest per-CPU ring size we will allocate. */
+#define EVT_MAX_ENTRIES (1u << 20)
 
-#define MAX_EVENTS 256
 #define NDUMP 16			/* should be even */
 
-struct TraceEvent {
-  uint8_t    evtType;
-  uintptr_t  v0;
-  uintptr_t  v1;
-  uintptr_t  v2;
-} events[MAX_EVENTS];
+/** @brief One CPU's trace ring. */
+typedef struct EvtRing {
+  EvtTraceRecord *buf;
 
-uint8_t nextEvent = 0;
+  /** @brief Number of records in @p buf, less one. The size is a
+   * power of two. */
+  uint32_t        mask;
+
+  /** @brief Number of events ever logged on this CPU.
+   *
+   * The next record goes at (next & mask). */
+  Atomic32_t      next;
+} EvtRing;
+
+/** @brief Ring used by CPU 0 until event_init() runs. */
+static EvtTraceRecord evt_boot_buf[EVT_DEFAULT_ENTRIES];
+
+static EvtRing evt_ring[MAX_NCPU] = {
+  [0] = { evt_boot_buf, EVT_DEFAULT_ENTRIES - 1 },
+};
 
 void
 event(uint8_t evtType, uintptr_t v0, uintptr_t v1, uintptr_t v2)
 {
-  events[nextEvent].evtType = evtType;
-  events[nextEvent].v0 = v0;
-  events[nextEvent].v1 = v1;
-  events[nextEvent].v2 = v2;
-  nextEvent++;			/* May roll over. That is okay. */
+  CPU *cpu = CUR_CPU;
+  EvtRing *ring = &evt_ring[cpu->id];
+
+  if (ring->buf == 0)
+    return;
+
+  uint32_t ndx;
+  do {
+    ndx = atomic_read(&ring->next);
+  } while (compare_and_swap(&ring->next, ndx, ndx + 1) != ndx);
+
+  EvtTraceRecord *rec = &ring->buf[ndx & ring->mask];
+
+  /* ndx is never the stamp of an event in this slot. */
+  rec->seq = ndx;
+  memory_barrier();
+
+  rec->tsc = read_cycle_counter();
+  rec->v0 = v0;
+  rec->v1 = v1;
+  rec->v2 = v2;
+  rec->cpu = cpu->id;
+  rec->type = evtType;
+
+  memory_barrier();
+  rec->seq = ndx + 1;
+}
+
+size_t
+event_init(void)
+{
+  size_t nEnt = evt_trace_entries;
+  if (nEnt == 0)
+    nEnt = EVT_DEFAULT_ENTRIES;
+  nEnt = min(nEnt, (size_t) EVT_MAX_ENTRIES);
+
+  size_t n = 1;
+  while (n < nEnt)
+    n <<= 1;
+
+  size_t nBytes = 0;
+
+  for (size_t i = 0; i < cpu_ncpu; i++) {
+    EvtRing *ring = &evt_ring[i];
+
+    if (ring->buf && ring->mask + 1 == n)
+      continue;
+
+    EvtTraceRecord *buf = CALLOC(EvtTraceRecord, n);
+    nBytes += n * sizeof(EvtTraceRecord);
+
+    /* Carry over whatever CPU 0 logged during boot. Interrupts are
+       still disabled, so nothing else is logging. */
+    if (ring->buf) {
+      uint32_t next = atomic_read(&ring->next);
+      uint32_t keep = min(next, ring->mask + 1);
+      keep = min(keep, (uint32_t) n);
+
+      for (uint32_t seq = next - keep; seq != next; seq++)
+	buf[seq & (n - 1)] = ring->buf[seq & ring->mask];
+    }
+
+    ring->buf = buf;
+    ring->mask = n - 1;
+  }
+
+  printf("Event trace: %d records per CPU\n", n);
+
+  return align_up(nBytes, COYOTOS_PAGE_SIZE) / COYOTOS_PAGE_SIZE;
+}
+
+size_t
+event_ring_entries(void)
+{
+  return evt_ring[0].mask + 1;
+}
+
+size_t
+event_read(size_t cpu, uint32_t seq, EvtTraceRecord *out, size_t max, 
+	   uint32_t *next)
+{
+  if (cpu >= cpu_ncpu || evt_ring[cpu].buf == 0) {
+    *next = seq;
+    return 0;
+  }
+
+  EvtRing *ring = &evt_ring[cpu];
+  uint32_t last = atomic_read(&ring->next);
+  uint32_t oldest = (last > ring->mask) ? last - ring->mask - 1 : 0;
+
+  /* Sequence numbers wrap, so compare distances rather than values. */
+  if ((last - seq) > (last - oldest))
+    seq = oldest;
+
+  size_t want = min(max, (size_t) (last - seq));
+  size_t count;
+
+  /* A record may still be being written at the new end, or be
+     overwritten at the old end while we copy it. Stop at the first
+     one that is not intact. A caller that tries again later either
+     finds the new record finished or skips past the overwritten
+     one. */
+  for (count = 0; count < want; count++) {
+    volatile EvtTraceRecord *rec = &ring->buf[(seq + count) & ring->mask];
+    uint32_t stamp = seq + count + 1;
+
+    if (rec->seq != stamp)
+      break;
+    memory_barrier();
+    out[count] = *(EvtTraceRecord *) rec;
+    memory_barrier();
+    if (rec->seq != stamp)
+      break;
+  }
+
+  *next = seq + count;
+  return count;
 }
 
 void
 event_log_dump()
 {
-  if (events[nextEvent-1].evtType == ety_None)
+  EvtRing *ring = &evt_ring[CUR_CPU->id];
+  if (ring->buf == 0)
+    return;
+
+  uint32_t next = atomic_read(&ring->next);
+  uint32_t ndump = min(next, ring->mask + 1);
+  ndump = min(ndump, (uint32_t) NDUMP);
+
+  if (ndump == 0)
     return;
 
-  printf("KERNEL EVENT TRACE DUMP:\n");
-  /* This loop relies on rollover in the 'ndx' position, which is why
-   * the termination condition checks equality rather than magnitude.
-   */
-  for (uint8_t ndx = nextEvent - NDUMP; ndx != nextEvent; ndx++) {
-    if (events[ndx].evtType == ety_None)
+  printf("KERNEL EVENT TRACE DUMP (CPU %d):\n", CUR_CPU->id);
+  for (uint32_t seq = next - ndump; seq != next; seq++) {
+    EvtTraceRecord *rec = &ring->buf[seq & ring->mask];
+    if (rec->type == ety_None)
       continue;
 
-    printf("Evt 0x%02x 0x%0p 0x%0p 0x%0p\n", 
-	   events[ndx].evtType,
-	   events[ndx].v0,
-	   events[ndx].v1,
-	   events[ndx].v2);
+    printf("Evt 0x%02x %llu 0x%0p 0x%0p 0x%0p\n", 
+	   rec->type,
+	   rec->tsc,
+	   (uintptr_t) rec->v0,
+	   (uintptr_t) rec->v1,
+	   (uintptr_t) rec->v2);
   }
   printf("KERNEL EVENT TRACE ENDS:\n");
 }
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2007, The EROS Group, LLC.
+ *
+ * This file is part of the Coyotos Operating System.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** @file
+ * @brief Inter-processor requests and TLB shootdown.
+ *
+ * The only request at present is "carry out my TlbBatch". The
+ * sender posts its bit in each target's ipiFrom, raises the IPI,
+ * and spins until every target has cleared its bit in the sender's
+ * tlbWaiting. A target carries out the request from its IPI handler
+ * if interrupts are enabled, and otherwise at its next convenient
+ * point: while spinning for a lock, while waiting on a shootdown
+ * of its own, or just before returning to user mode. See IPI.h for
+ * the rules this follows.
+ */
+
+#include <kerninc/IPI.h>
+#include <kerninc/CPU.h>
+#include <kerninc/Mapping.h>
+#include <kerninc/Sched.h>
+#include <kerninc/assert.h>
+#include <hal/vm.h>
+
+/** @brief Carry out @p tb on the current CPU. */
+static void
+tlb_batch_run(const TlbBatch *tb)
+{
+  if (tb->count == TLB_BATCH_FULL) {
+    if (tb->global)
+      local_tlb_flush_global();
+    else
+      local_tlb_flush();
+    return;
+  }
+
+  for (size_t i = 0; i < tb->count; i++)
+    local_tlb_flushva(tb->va[i]);
+}
+
+void
+ipi_process(void)
+{
+  CPU *self = CUR_CPU;
+  uint32_t from;
+
+  while ((from = atomic_read(&self->ipiFrom)) != 0) {
+    for (cpuid_t i = 0; i < cpu_ncpu; i++) {
+      uint32_t bit = 1u << i;
+      if ((from & bit) == 0)
+	continue;
+
+      atomic_clear_bits(&self->ipiFrom, bit);
+      tlb_batch_run(&cpu_vec[i].tlbBatch);
+      atomic_clear_bits(&cpu_vec[i].tlbWaiting, 1u << self->id);
+    }
+  }
+}
+
+void
+ipi_tlb_shootdown(bool mayAbandon)
+{
+  CPU *self = CUR_CPU;
+  TlbBatch *tb = &self->tlbBatch;
+
+  if (tb->count == 0)
+    return;
+
+  tlb_batch_run(tb);
+
+#if MAX_NCPU > 1
+  /* The cleared PTEs must be visible before we sample curMap. A CPU
+   * that loads a new map after we look stores curMap before writing
+   * %cr3, so its table walks will see the cleared entries. */
+  memory_barrier();
+
+  uint32_t targets = 0;
+
+  for (cpuid_t i = 0; i < cpu_ncpu; i++) {
+    CPU *cpu = &cpu_vec[i];
+    Mapping *m = cpu->curMap;
+
+    if (cpu == self || !cpu->active)
+      continue;
+    if (!tb->global && m == &KernMapping)
+      continue;
+    if (!tb->anyMap && m != tb->map)
+      continue;
+
+    targets |= (1u << i);
+  }
+
+  if (targets) {
+    atomic_write(&self->tlbWaiting, targets);
+
+    for (cpuid_t i = 0; i < cpu_ncpu; i++) {
+      if (targets & (1u << i)) {
+	atomic_set_bits(&cpu_vec[i].ipiFrom, 1u << self->id);
+	ipi_send(i);
+      }
+    }
+
+    /* Someone we are waiting for may be waiting for us. */
+    while (atomic_read(&self->tlbWaiting))
+      ipi_process();
+  }
+#endif
+
+  tb->count = 0;
+  tb->anyMap = false;
+  tb->map = NULL;
+  tb->global = false;
+
+  /* A CPU that wanted one of our locks asked us to defer while we
+   * waited. We could not leave the loop above with the batch still
+   * in use, but now that it is done we can back out if our caller
+   * has not committed. */
+  if (mayAbandon &&
+      atomic_read(&self->shouldDefer) == self->procMutexValue)
+    sched_abandon_transaction();
+}
@@ -19,19 +19,36 @@
  */
 
 /** @file
+ * @brief Sleep/wakeup management.
  *
- * This is about the lamest sleep/wakeup implementation imaginable. We
- * make no attempt whatsoever to sort the sleepers by wake time. We
- * simply stick them on a stall queue, and whenever one is due to wake
- * up we wake all of them up and allow the hurd to thunder away.
+ * Sleepers are kept on a hashed timing wheel. Each slot of the wheel
+ * is a stall queue covering INTERVAL_SLOT_USEC microseconds of wake
+ * time, and a sleeper goes on the slot for its wake time modulo the
+ * size of the wheel. A slot may therefore hold sleepers from several
+ * revolutions of the wheel; wakeup processing checks each one and
+ * wakes only those whose time has come.
  *
- * Needless to say, this implementation is a placeholder.
+ * When time advances, only the slots that have come due since the
+ * last pass are examined, so a tick costs time proportional to the
+ * number of expired sleepers rather than the number of sleepers.
  */
 
 #include <coyotos/coytypes.h>
 #include <kerninc/Process.h>
+#include <kerninc/ReadyQueue.h>
 
-/** @brief Guards manipulations of interval_now and interval_wakeup.
+/** @brief Number of slots in the timing wheel. Must be a power of
+ * two. */
+#define INTERVAL_WHEEL_SLOTS  256
+
+/** @brief Span of wake time covered by one slot, in microseconds. */
+#define INTERVAL_SLOT_USEC    1000
+
+/** @brief Wake time meaning "no sleepers". */
+#define INTERVAL_NEVER        UINT64_MAX
+
+/** @brief Guards manipulations of interval_now, the wheel and
+ * nextWake.
  *
  * A holder of this stall queue must lock out local interrupts as well as
  * grabbing the stall queue, so the correct protocol is to disable
@@ -42,10 +59,41 @@ static irqlock_t interval_irql = IRQLOCK_INIT;
 /** @brief Current epoch, seconds and microseconds since boot. */
 static Interval now = {0, 0, 0};
 
-/** @brief Time when next wakeup needs to occur. */
-static Interval wakeTime;
+/** @brief The timing wheel. */
+static StallQueue wheel[INTERVAL_WHEEL_SLOTS];
+
+/** @brief Absolute slot number up to which wakeups have been
+ * processed. */
+static uint64_t wheelPos;
+
+/** @brief Earliest time at which some sleeper may be due, in
+ * microseconds since boot.
+ *
+ * This is a lower bound, not an exact answer: after a pass over the
+ * wheel it is set to the earliest deadline in the current slot or the
+ * start of the next non-empty slot, whichever is sooner, and the
+ * sleepers in that slot may belong to a later revolution.
+ */
+static uint64_t nextWake = INTERVAL_NEVER;
+
+static inline uint64_t
+interval_to_usec(Interval i)
+{
+  return ((uint64_t) i.sec * 1000000ull) + i.usec;
+}
 
-static DEFQUEUE(sleepers);
+static inline StallQueue *
+interval_slot(uint64_t absSlot)
+{
+  return &wheel[absSlot & (INTERVAL_WHEEL_SLOTS - 1)];
+}
+
+void
+interval_init(void)
+{
+  for (size_t i = 0; i < INTERVAL_WHEEL_SLOTS; i++)
+    sq_Init(&wheel[i]);
+}
 
 Interval
 interval_now()
@@ -68,16 +116,71 @@ interval_update_now(Interval i)
 
   now = i;
 
-  if (now.sec < wakeTime.sec ||
-      (now.sec == wakeTime.sec && now.usec < wakeTime.usec)) {
-    wakeTime.sec = 0;
-    wakeTime.usec = 0;
+  if (interval_to_usec(now) >= nextWake)
     atomic_set_bits(&CUR_CPU->flags, CPUFL_NEED_WAKEUP);
-  }
 
   irqlock_release(ihi);
 }
 
+bool
+interval_next_wakeup(Interval *when)
+{
+  IrqHoldInfo ihi = irqlock_grab(&interval_irql);
+
+  uint64_t usec = nextWake;
+
+  irqlock_release(ihi);
+
+  if (usec == INTERVAL_NEVER)
+    return false;
+
+  when->epoch = now.epoch;
+  when->sec = usec / 1000000ull;
+  when->usec = usec % 1000000ull;
+  return true;
+}
+
+/** @brief Wake every sleeper on @p sq whose wake time is at or
+ * before @p curUsec. */
+static void
+interval_wake_slot(StallQueue *sq, uint64_t curUsec)
+{
+  SpinHoldInfo shi = spinlock_grab(&sq->qLock);
+
+  Link *cur = sq->q_head.next;
+  while (cur != &sq->q_head) {
+    Link *next = cur->next;
+    Process *p = process_from_link(cur);
+
+    if (interval_to_usec(p->wakeTime) <= curUsec)
+      sq_UnsleepLocked(sq, p);
+
+    cur = next;
+  }
+
+  spinlock_release(shi);
+}
+
+/** @brief Return the earliest wake time of any sleeper on @p sq, or
+ * INTERVAL_NEVER if it is empty. */
+static uint64_t
+interval_slot_earliest(StallQueue *sq)
+{
+  uint64_t earliest = INTERVAL_NEVER;
+
+  SpinHoldInfo shi = spinlock_grab(&sq->qLock);
+
+  for (Link *cur = sq->q_head.next; cur != &sq->q_head; cur = cur->next) {
+    uint64_t wake = interval_to_usec(process_from_link(cur)->wakeTime);
+    if (wake < earliest)
+      earliest = wake;
+  }
+
+  spinlock_release(shi);
+
+  return earliest;
+}
+
 void 
 interval_do_wakeups()
 {
@@ -85,7 +188,37 @@ interval_do_wakeups()
      into a livelock with interval_delay. */
   IrqHoldInfo ihi = irqlock_grab(&interval_irql);
 
-  sq_WakeAll(&sleepers, false);
+  uint64_t curUsec = interval_to_usec(now);
+  uint64_t curSlot = curUsec / INTERVAL_SLOT_USEC;
+
+  /* Visit each slot that has come due since the last pass, but never
+   * more than one full revolution. */
+  uint64_t first = wheelPos;
+  if (curSlot - first >= INTERVAL_WHEEL_SLOTS)
+    first = curSlot - INTERVAL_WHEEL_SLOTS + 1;
+
+  for (uint64_t s = first; s <= curSlot; s++)
+    interval_wake_slot(interval_slot(s), curUsec);
+
+  /* The current slot may still hold sleepers due later in this slot
+   * or in a later revolution, so it is visited again next time. */
+  wheelPos = curSlot;
+
+  /* Everything left in the current slot is due later, so use its
+   * real earliest deadline rather than forcing a pass on every
+   * tick. If those sleepers belong to a later revolution, the next
+   * non-empty slot will usually come due first. */
+  nextWake = interval_slot_earliest(interval_slot(curSlot));
+  for (uint64_t s = curSlot + 1; s < curSlot + INTERVAL_WHEEL_SLOTS; s++) {
+    uint64_t slotStart = s * INTERVAL_SLOT_USEC;
+    if (slotStart >= nextWake)
+      break;
+    if (!sq_IsEmpty(interval_slot(s))) {
+      nextWake = slotStart;
+      break;
+    }
+  }
+
   atomic_clear_bits(&CUR_CPU->flags, CPUFL_NEED_WAKEUP);
 
   irqlock_release(ihi);
@@ -98,23 +231,27 @@ interval_delay(Process *p)
 
   assert (p->wakeTime.epoch <= now.epoch);
 
-  if (p->wakeTime.epoch >= now.epoch &&
-      (p->wakeTime.sec > now.sec ||
-       (p->wakeTime.sec == now.sec && p->wakeTime.usec > now.usec))) {
-
-    if (p->wakeTime.sec < wakeTime.sec ||
-	(p->wakeTime.sec == wakeTime.sec && p->wakeTime.usec < wakeTime.usec)) {
-      
-      wakeTime = p->wakeTime;
-
-      /* Note that the following call involves a spinlock acquisition
-       * that is technically unnecessary, because the sleeper stall
-       * queue is already guarded by the irqlock. It isn't worth
-       * optimizing until we have cause to do so.
-       */
-      sq_EnqueueOn(&sleepers);
-    }
+  uint64_t wakeUsec = interval_to_usec(p->wakeTime);
 
+  if (p->wakeTime.epoch < now.epoch || wakeUsec <= interval_to_usec(now)) {
+    /* Already due. */
     irqlock_release(ihi);
+    return;
   }
+
+  if (wakeUsec < nextWake)
+    nextWake = wakeUsec;
+
+  /* Note that the following call involves a spinlock acquisition
+   * that is technically unnecessary, because the wheel is already
+   * guarded by the irqlock. It isn't worth optimizing until we have
+   * cause to do so.
+   */
+  sq_EnqueueOn(interval_slot(wakeUsec / INTERVAL_SLOT_USEC));
+
+  irqlock_release(ihi);
+
+  /* When we are woken, the invocation restarts and finds that the
+   * wake time has passed. */
+  sched_abandon_transaction();
 }
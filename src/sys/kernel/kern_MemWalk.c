@@ -27,6 +27,7 @@
 #include <kerninc/capability.h>
 #include <kerninc/assert.h>
 #include <kerninc/util.h>
+#include <kerninc/string.h>
 
 /** @brief Generate a mask for the low @p bits bits of a <tt>coyaddr_t</tt>.
  *
@@ -76,16 +77,19 @@ ca_highbits(coyaddr_t addr, size_t bits)
   return (addr & ~ca_bitmask(bits));
 }
 
-coyotos_Process_FC
-memwalk(capability *cap, coyaddr_t addr, bool forWrite,
-	MemWalkResults *results /* OUT */)
+/** @brief Walk from @p cap, appending to the first @p idx entries of
+ * @p results.
+ *
+ * @p cum_restr, @p gpt and @p bggpt must describe the state of the
+ * walk after those @p idx entries, and @p addr must be the address
+ * remaining at that point.
+ */
+static coyotos_Process_FC
+memwalk_from(capability *cap, coyaddr_t addr, bool forWrite,
+	     MemWalkResults *results, size_t idx, uint8_t cum_restr,
+	     GPT *gpt, GPT *bggpt)
 {
   MemWalkEntry *ent = results->ents;
-  size_t idx = 0;
-  uint8_t cum_restr = 0;
-
-  GPT *gpt = 0;
-  GPT *bggpt = 0;
 
   while (idx < MEMWALK_MAX) {
     cap_prepare(cap);
@@ -257,6 +261,188 @@ memwalk(capability *cap, coyaddr_t addr, bool forWrite,
   return 0;
 }
 
+coyotos_Process_FC
+memwalk(capability *cap, coyaddr_t addr, bool forWrite,
+	MemWalkResults *results /* OUT */)
+{
+  results->addr = addr;
+  return memwalk_from(cap, addr, forWrite, results, 0, 0, 0, 0);
+}
+
+/** @brief Return the number of leading entries of @p ents that a walk
+ * for an address differing from theirs by @p diff would traverse
+ * identically.
+ *
+ * An entry can be kept if every address bit it (or anything above
+ * it) consumed is the same for both addresses. Each level only XORs
+ * in a guard and strips the slot bits, so if those bits agree the
+ * guard checks and slot choices are identical. Stop at windows:
+ * their offsets make the remaining address harder to recover, and
+ * they are rare on the paths we care about.
+ */
+static size_t
+memwalk_shared_prefix(const MemWalkEntry *ents, size_t count, coyaddr_t diff)
+{
+  size_t keep = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    const MemWalkEntry *e = &ents[i];
+    if (e->window || e->entry->hdr.ty != ot_GPT)
+      break;
+
+    size_t l2consumed = min(e->l2g, e->l2v);
+    if (l2consumed == 0 || ca_highbits(diff, l2consumed) != 0)
+      break;
+
+    keep = i + 1;
+  }
+
+  return keep;
+}
+
+/** @brief Resume the walk recorded in @p results for @p addr, keeping
+ * its first @p keep entries.
+ *
+ * @p keep must be non-zero and no larger than
+ * memwalk_shared_prefix() allows for @p addr.
+ */
+static coyotos_Process_FC
+memwalk_resume(coyaddr_t addr, bool forWrite, MemWalkResults *results,
+	       size_t keep)
+{
+  coyaddr_t diff = addr ^ results->addr;
+  uint8_t cum_restr = 0;
+  GPT *gpt = 0;
+  GPT *bggpt = 0;
+
+  for (size_t i = 0; i < keep; i++) {
+    cum_restr |= results->ents[i].restr;
+    gpt = (GPT *)results->ents[i].entry;
+    if (gpt->state.bg)
+      bggpt = gpt;
+  }
+
+  MemWalkEntry *last = &results->ents[keep - 1];
+  coyaddr_t remAddr = ca_lowbits(last->remAddr ^ diff, last->l2v);
+
+  results->addr = addr;
+
+  return memwalk_from(&gpt->state.cap[last->slot], remAddr, forWrite,
+		      results, keep, cum_restr, gpt, bggpt);
+}
+
+coyotos_Process_FC
+memwalk_next(capability *cap, coyaddr_t addr, bool forWrite,
+	     MemWalkResults *results /* IN/OUT */)
+{
+  size_t keep = memwalk_shared_prefix(results->ents, results->count,
+				      addr ^ results->addr);
+
+  if (keep == 0)
+    return memwalk(cap, addr, forWrite, results);
+
+  return memwalk_resume(addr, forWrite, results, keep);
+}
+
+void
+memwalk_cache_init(MemWalkCache *mwc)
+{
+  INIT_TO_ZERO(mwc);
+}
+
+void
+memwalk_cache_invalidate(GPT *gpt)
+{
+  assert(mutex_isheld(&gpt->mhdr.hdr.lock));
+  gpt->walkGen++;
+}
+
+/** @brief Return the walk generation of the GPT traversed by @p mwe. */
+static inline uint32_t
+memwalk_entry_gen(MemWalkEntry *mwe)
+{
+  return ((GPT *)mwe->entry)->walkGen;
+}
+
+coyotos_Process_FC
+memwalk_cached(MemWalkCache *mwc, capability *cap, coyaddr_t addr,
+	       bool forWrite, MemWalkResults *results /* OUT */)
+{
+  MemWalkCacheEntry *hit = 0;
+  size_t keep = 0;
+
+  cap_prepare(cap);
+
+  if (cap->type == ct_GPT) {
+    coyaddr_t guard = (coyaddr_t)cap->u1.mem.match << cap->u1.mem.l2g;
+
+    for (size_t i = 0; i < MEMWALK_CACHE_NENT; i++) {
+      MemWalkCacheEntry *mce = &mwc->ent[i];
+
+      if (mce->count == 0)
+	continue;
+      if (mce->ents[0].entry != (MemHeader *)cap->u2.prepObj.target ||
+	  mce->rootl2g != cap->u1.mem.l2g ||
+	  mce->ents[0].guard != guard ||
+	  mce->ents[0].restr != cap->restr)
+	continue;
+
+      size_t n = memwalk_shared_prefix(mce->ents, mce->count, 
+				       addr ^ mce->addr);
+      if (n > keep) {
+	keep = n;
+	hit = mce;
+      }
+    }
+  }
+
+  if (hit) {
+    memcpy(results->ents, hit->ents, keep * sizeof(results->ents[0]));
+    results->addr = hit->addr;
+
+    /* The root was locked by cap_prepare() above. Lock the rest of
+     * the prefix as memwalk() would have, then make sure none of
+     * those GPTs changed while we were not holding the locks. Once
+     * we hold them, any further change must wait for this
+     * transaction. */
+    for (size_t i = 1; i < keep; i++)
+      mutex_grab(&results->ents[i].entry->hdr.lock);
+
+    for (size_t i = 0; i < keep; i++) {
+      if (memwalk_entry_gen(&results->ents[i]) != hit->gen[i]) {
+	hit = 0;
+	break;
+      }
+    }
+  }
+
+  coyotos_Process_FC fc = hit 
+    ? memwalk_resume(addr, forWrite, results, keep)
+    : memwalk(cap, addr, forWrite, results);
+
+  /* Remember the GPT prefix of this walk. */
+  MemWalkCacheEntry *mce = hit;
+  if (mce == 0) {
+    mce = &mwc->ent[mwc->victim];
+    mwc->victim = (mwc->victim + 1) % MEMWALK_CACHE_NENT;
+  }
+
+  size_t n = 0;
+  while (n < results->count && n < MEMWALK_CACHE_DEPTH &&
+	 !results->ents[n].window &&
+	 results->ents[n].entry->hdr.ty == ot_GPT)
+    n++;
+
+  for (size_t i = 0; i < n; i++)
+    mce->gen[i] = memwalk_entry_gen(&results->ents[i]);
+  mce->count = n;
+  mce->rootl2g = cap->u1.mem.l2g;
+  mce->addr = addr;
+  memcpy(mce->ents, results->ents, n * sizeof(mce->ents[0]));
+
+  return fc;
+}
+
 /**
  * @brief support routine for extended fetch/store.  Interface is identical
  * to @p memwalk, with the addition of the @p l2stop field.
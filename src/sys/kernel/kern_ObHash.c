@@ -28,70 +28,227 @@
  */
 
 #include <coyotos/coytypes.h>
+#include <hal/atomic.h>
 #include <kerninc/assert.h>
+#include <kerninc/printf.h>
 #include <kerninc/ObjectHeader.h>
+#include <kerninc/ObjectHash.h>
 #include <kerninc/mutex.h>
 #include <kerninc/malloc.h>
 
-/* this should really be dynamically sized. */
+/* The table is sized once, from the number of OT entries computed by
+ * cache_estimate_sizes(). Since every hashed object holds an OT entry
+ * while it is in active use, this keeps the expected chain length
+ * near OBHASH_LOAD_FACTOR no matter how large the object cache is.
+ *
+ * Bucket heads are protected by a smaller array of stripe locks. Each
+ * stripe also carries a sequence number that is odd while a writer is
+ * modifying a chain under that stripe. Lookups walk the chain without
+ * taking the stripe lock, and validate against the sequence number
+ * afterwards. This is safe because ObjectHeaders are never freed:
+ * they live in the per-type cache vectors for the life of the
+ * system, so a reader that wanders onto an object that has just been
+ * removed still sees a well-formed (if stale) ObjectHeader, and will
+ * notice the sequence change and retry.
+ */
 
-#define OBHASH_BITS 12
-#define OBHASH_SIZE (1u << OBHASH_BITS)
+#define OBHASH_MIN_BITS 10
+#define OBHASH_LOAD_FACTOR 2
+#define OBHASH_BUCKETS_PER_STRIPE 8
 
-struct obhash_bucket {
+/** @brief Number of optimistic passes before falling back to a
+ * locked walk. */
+#define OBHASH_MAX_RETRY 4
+
+struct obhash_stripe {
   mutex_t lock;
-  ObjectHeader *head;
+  Atomic32_t seq;
 };
 
-static struct obhash_bucket obhash[OBHASH_SIZE];
+static size_t obhash_bits;
+static size_t obhash_size;
+static ObjectHeader **obhash;
+static struct obhash_stripe *obhash_stripes;
+
+static size_t
+obhash_bits_for(size_t nObjects)
+{
+  size_t bits = OBHASH_MIN_BITS;
+
+  while ((1u << bits) * OBHASH_LOAD_FACTOR < nObjects)
+    bits++;
+
+  return bits;
+}
+
+size_t
+obhash_estimate_bytes(size_t nObjects)
+{
+  size_t nBucket = 1u << obhash_bits_for(nObjects);
+
+  return (nBucket * sizeof (*obhash) +
+	  (nBucket / OBHASH_BUCKETS_PER_STRIPE) * sizeof (*obhash_stripes));
+}
+
+void
+obhash_init(size_t nObjects)
+{
+  assert(obhash == 0);
+
+  obhash_bits = obhash_bits_for(nObjects);
+  obhash_size = 1u << obhash_bits;
 
-static inline struct obhash_bucket *
+  obhash = CALLOC(ObjectHeader *, obhash_size);
+  obhash_stripes = 
+    CALLOC(struct obhash_stripe, obhash_size / OBHASH_BUCKETS_PER_STRIPE);
+
+  printf("Object hash: %d buckets, %d stripes\n",
+	 obhash_size, obhash_size / OBHASH_BUCKETS_PER_STRIPE);
+}
+
+static inline size_t
 obhash_hash(ObType ty, oid_t oid)
 {
-  size_t hash = (ty << (OBHASH_BITS - 3)) ^ oid ^ (oid >> OBHASH_BITS);
+  size_t hash = (ty << (obhash_bits - 3)) ^ oid ^ (oid >> obhash_bits);
+
+  return hash & (obhash_size - 1);
+}
+
+static inline struct obhash_stripe *
+obhash_stripe(size_t ndx)
+{
+  return &obhash_stripes[ndx / OBHASH_BUCKETS_PER_STRIPE];
+}
 
-  return &obhash[hash & (OBHASH_SIZE - 1)];
+/** @brief Mark the start of a chain update. Stripe lock must be held. */
+static inline void
+obhash_write_begin(struct obhash_stripe *stripe)
+{
+  atomic_write(&stripe->seq, atomic_read(&stripe->seq) + 1);
+  memory_barrier();
+}
+
+/** @brief Mark the end of a chain update. Stripe lock must be held. */
+static inline void
+obhash_write_end(struct obhash_stripe *stripe)
+{
+  memory_barrier();
+  atomic_write(&stripe->seq, atomic_read(&stripe->seq) + 1);
+}
+
+static inline bool
+obhash_matches(ObjectHeader *ob, ObType ty, oid_t oid, bool wantSnapshot)
+{
+  if (ob->ty != ty || ob->oid != oid)
+    return false;
+
+  return wantSnapshot ? ob->snapshot : ob->current;
 }
 
 HoldInfo
 obhash_grabMutex(ObType ty, oid_t oid)
 {
-  struct obhash_bucket *bucket = obhash_hash(ty, oid);
-  return mutex_grab(&bucket->lock);
+  return mutex_grab(&obhash_stripe(obhash_hash(ty, oid))->lock);
 }
 
 void
 obhash_insert(ObjectHeader *ob)
 {
-  struct obhash_bucket *bucket = obhash_hash(ob->ty, ob->oid);
-  HoldInfo hi = mutex_grab(&bucket->lock);
+  size_t ndx = obhash_hash(ob->ty, ob->oid);
+  struct obhash_stripe *stripe = obhash_stripe(ndx);
+  HoldInfo hi = mutex_grab(&stripe->lock);
+
+  obhash_write_begin(stripe);
+  ob->next = obhash[ndx];
+  memory_barrier();
+  obhash[ndx] = ob;
+  obhash_write_end(stripe);
 
-  ob->next = bucket->head;
-  bucket->head = ob;
   mutex_release(hi);
 }
 
+/** @brief Walk a chain without holding the stripe lock.
+ *
+ * Returns true if the walk completed without interference from a
+ * writer, in which case *@p found holds the (locked) match, or NULL
+ * if there was none. Returns false if the walk must be retried.
+ */
+static bool
+obhash_optimistic_lookup(size_t ndx, ObType ty, oid_t oid, bool wantSnapshot,
+			 ObjectHeader **found, HoldInfo *out)
+{
+  struct obhash_stripe *stripe = obhash_stripe(ndx);
+  uint32_t seq = atomic_read(&stripe->seq);
+  ObjectHeader *cur;
+
+  if (seq & 1)
+    return false;
+
+  memory_barrier();
+
+  for (cur = obhash[ndx]; cur != NULL; cur = cur->next) {
+    /* A chain we are walking may be relinked under us, so bail out as
+     * soon as a writer shows up rather than risk following a stale
+     * next pointer indefinitely. */
+    if (atomic_read(&stripe->seq) != seq)
+      return false;
+
+    if (obhash_matches(cur, ty, oid, wantSnapshot))
+      break;
+  }
+
+  if (cur == NULL) {
+    memory_barrier();
+    if (atomic_read(&stripe->seq) != seq)
+      return false;
+    *found = NULL;
+    return true;
+  }
+
+  // Acquire object lock. This may yield, which is fine, since we
+  // hold nothing else.
+  HoldInfo hi_cur = mutex_grab(&cur->lock);
+
+  memory_barrier();
+  if (atomic_read(&stripe->seq) != seq) {
+    mutex_release(hi_cur);
+    return false;
+  }
+
+  assert(cur->snapshot || cur->current);
+
+  // OUT holdinfo may not be passed if caller plans to exploit
+  // gang-release. It may turn out that we never need to use it.
+  if (out)
+    *out = hi_cur;
+
+  *found = cur;
+  return true;
+}
+
 ObjectHeader *
 obhash_lookup(ObType ty, oid_t oid, bool wantSnapshot, HoldInfo *out)
 {
-  struct obhash_bucket *bucket = obhash_hash(ty, oid);
+  size_t ndx = obhash_hash(ty, oid);
+  struct obhash_stripe *stripe = obhash_stripe(ndx);
   ObjectHeader *cur;
 
-  HoldInfo hi = mutex_grab(&bucket->lock);
+  for (size_t retry = 0; retry < OBHASH_MAX_RETRY; retry++) {
+    if (obhash_optimistic_lookup(ndx, ty, oid, wantSnapshot, &cur, out))
+      return cur;
+  }
+
+  /* Writers keep getting in the way. Fall back to walking the chain
+   * under the stripe lock. */
+  HoldInfo hi = mutex_grab(&stripe->lock);
 
-  for (cur = bucket->head; cur != NULL; cur = cur->next) {
-    if (cur->ty == ty && cur->oid == oid) {
+  for (cur = obhash[ndx]; cur != NULL; cur = cur->next) {
+    if (obhash_matches(cur, ty, oid, wantSnapshot)) {
       assert(cur->snapshot || cur->current);
-      if (wantSnapshot && !cur->snapshot)
-	continue;
-      if (!wantSnapshot && !cur->current)
-	continue;
 
       // Acquire object lock
       HoldInfo hi_cur = mutex_grab(&cur->lock);
 
-      // OUT holdinfo may not be passed if caller plans to exploit
-      // gang-release. It may turn out that we never need to use it.
       if (out)
 	*out = hi_cur;
       break;
@@ -105,14 +262,19 @@ obhash_lookup(ObType ty, oid_t oid, bool wantSnapshot, HoldInfo *out)
 void
 obhash_remove(ObjectHeader *ob)
 {
-  struct obhash_bucket *bucket = obhash_hash(ob->ty, ob->oid);
+  size_t ndx = obhash_hash(ob->ty, ob->oid);
+  struct obhash_stripe *stripe = obhash_stripe(ndx);
   ObjectHeader **cur;
 
-  HoldInfo hi = mutex_grab(&bucket->lock);
+  HoldInfo hi = mutex_grab(&stripe->lock);
 
-  for (cur = &bucket->head; *cur != NULL; cur = &(*cur)->next) {
+  for (cur = &obhash[ndx]; *cur != NULL; cur = &(*cur)->next) {
     if (*cur == ob) {
+      /* Leave ob->next alone: a concurrent reader may be standing on
+       * ob, and must still be able to reach the rest of the chain. */
+      obhash_write_begin(stripe);
       *cur = ob->next;
+      obhash_write_end(stripe);
       mutex_release(hi);
       return;
     }
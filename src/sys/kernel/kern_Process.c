@@ -37,6 +37,8 @@
 #include <kerninc/string.h>
 #include <kerninc/util.h>
 #include <kerninc/vector.h>
+#include <kerninc/event.h>
+#include <kerninc/IPI.h>
 #include <kerninc/assert.h>
 #include <hal/transmap.h>
 #include <hal/irq.h>
@@ -55,6 +57,10 @@
 
 #define DEBUG_DISPATCH if (0)
 
+/** @brief Number of destination pages resolved per batch during IPC
+ * string transfer. */
+#define STRXFER_BATCH 16
+
 static void cap_UndefinedType(InvParam_t *iParam);
 
 typedef void (*CapHandlerProc)(InvParam_t *);
@@ -132,8 +138,9 @@ proc_do_upcall(InvParam_t *iParam)
   set_icw(iParam->invokee, opw0);
 
   /* Invocation is complete. Set invokee running and donate our slice. */
+  proc_consume_handoff(iParam->invoker, iParam->invokee);
   iParam->invokee->state.runState = PRS_RUNNING;
-  rq_add(&mainRQ, iParam->invokee, true);
+  rq_addReady(iParam->invokee, true);
 
   return true;
 }
@@ -183,7 +190,7 @@ proc_DeliverSoftNotices(Process *p)
 
   /* Invocation is complete. Set invokee running and donate our slice. */
   p->state.runState = PRS_RUNNING;
-  rq_add(&mainRQ, p, true);
+  rq_addReady(p, true);
 
   sched_abandon_transaction();
 }
@@ -272,6 +279,7 @@ proc_handle_process_fault()
 void 
 proc_deliver_memory_fault(Process *p,
 			  coyotos_Process_FC fc, uintptr_t addr, 
+			  bool forWrite,
 			  const MemWalkResults * const mwr)
 {
   bool isCurrent = (p == MY_CPU(current));
@@ -347,6 +355,7 @@ proc_deliver_memory_fault(Process *p,
     put_oparam32(&invParam, OC_coyotos_MemoryHandler_handle);
     put_oparam32(&invParam, fc);
     put_oparam64(&invParam, keptEntry->remAddr);
+    put_oparam32(&invParam, forWrite);
     invParam.opw[0] = InvResult(&invParam, 3);
 
     if (proc_do_upcall(&invParam)) {
@@ -388,7 +397,7 @@ proc_deliver_memory_fault(Process *p,
        get it onto the ready queue so that it can recognize that it
        has incurred a fault. */
     p->state.runState = PRS_RUNNING;
-    rq_add(&mainRQ, p, true);
+    rq_addReady(p, true);
   }
 
   /* if p == current, restarting will cause it to self-deliver the
@@ -406,8 +415,11 @@ proc_dispatch_current()
 {
   Process *p = MY_CPU(current);
 
-  if (p->lastCPU != CUR_CPU->id || p->mappingTableHdr == 0)
+  if (p->lastCPU != CUR_CPU->id || p->mappingTableHdr == 0) {
     proc_migrate_to_current_cpu();
+    /* Remember where we ran, so that rq_choose() sends us back here. */
+    p->lastCPU = CUR_CPU->id;
+  }
 
   vm_switch_curcpu_to_map(p->mappingTableHdr);
 
@@ -415,8 +427,7 @@ proc_dispatch_current()
   if (issues) {
     if (issues & pi_Schedule) {
       cap_prepare(&p->state.schedule);
-
-      // ??? Set Priority ???
+      sched_load_schedule(p);
 
       atomic_clear_bits(&p->issues, pi_Schedule);
       issues &= ~pi_Schedule;
@@ -430,7 +441,7 @@ proc_dispatch_current()
       assert(atomic_read(&CUR_CPU->flags) & CPUFL_WAS_PREEMPTED);
 
       /* Stick current at back of ready queue. */
-      rq_add(&mainRQ, p, false);
+      rq_addReady(p, false);
       sched_abandon_transaction();
     }
 
@@ -464,13 +475,15 @@ if (atomic_read(&p->issues) & pi_Preempted) {
 
     /* Stick current at back of ready queue. */
     assert(atomic_read(&CUR_CPU->flags) & CPUFL_WAS_PREEMPTED);
-    rq_add(&mainRQ, p, false);
+    rq_addReady(p, false);
     sched_abandon_transaction();
   }
 
   atomic_clear_bits(&CUR_CPU->flags, CPUFL_WAS_PREEMPTED);
 
   // Last check for IPI response obligations
+  ipi_process();
+
   // Set interval timer for preemption
 
   proc_resume(p);
@@ -486,10 +499,11 @@ proc_findCapPageSlot(Process *p, uintptr_t addr, bool forWriting,
   assert(mutex_isheld(&p->hdr.lock));
 
   coyotos_Process_FC fc =
-    memwalk(&p->state.addrSpace,
-	    addr,
-	    forWriting,
-	    &mwr);
+    memwalk_cached(&p->walkCache,
+		   &p->state.addrSpace,
+		   addr,
+		   forWriting,
+		   &mwr);
 
   if (fc == coyotos_Process_FC_InvalidDataReference)
     fc = coyotos_Process_FC_InvalidCapReference;
@@ -498,7 +512,7 @@ proc_findCapPageSlot(Process *p, uintptr_t addr, bool forWriting,
     return (fc);
 
   if (fc)
-    proc_deliver_memory_fault(p, fc, addr, &mwr);
+    proc_deliver_memory_fault(p, fc, addr, forWriting, &mwr);
 
   MemWalkEntry *last = &mwr.ents[mwr.count - 1];
 
@@ -522,22 +536,31 @@ proc_findDataPage(Process *p, uintptr_t addr, bool forWriting,
 		  struct FoundPage * /*OUT*/ results)
 {
   MemWalkResults mwr;
-  
+  mwr.count = 0;
+
+  return proc_findNextDataPage(p, addr, forWriting, nonBlock, &mwr, results);
+}
+
+coyotos_Process_FC
+proc_findNextDataPage(Process *p, uintptr_t addr, bool forWriting,
+		      bool nonBlock,
+		      struct MemWalkResults *mwr /* IN/OUT */,
+		      struct FoundPage * /*OUT*/ results)
+{
   assert(mutex_isheld(&p->hdr.lock));
 
-  coyotos_Process_FC fc =
-    memwalk(&p->state.addrSpace,
-	    addr,
-	    forWriting,
-	    &mwr);
+  coyotos_Process_FC fc = (mwr->count == 0)
+    ? memwalk_cached(&p->walkCache, &p->state.addrSpace, addr, 
+		     forWriting, mwr)
+    : memwalk_next(&p->state.addrSpace, addr, forWriting, mwr);
 
   if (fc && nonBlock)
     return (fc);
 
   if (fc)
-    proc_deliver_memory_fault(p, fc, addr, &mwr);
+    proc_deliver_memory_fault(p, fc, addr, forWriting, mwr);
 
-  MemWalkEntry *last = &mwr.ents[mwr.count - 1];
+  MemWalkEntry *last = &mwr->ents[mwr->count - 1];
 
   /* If the walk completed, we hold the lock on the target CapPage
    * because we prepared a capability to it on the way down. It is
@@ -548,11 +571,60 @@ proc_findDataPage(Process *p, uintptr_t addr, bool forWriting,
 
   results->pgHdr = (Page *) last->entry;
   results->slot = 0;
-  results->restr = mwr.cum_restr;
+  results->restr = mwr->cum_restr;
 
   return (0);
 }
 
+size_t
+proc_prepare_copyout(Process *p, uintptr_t va, size_t len,
+		     struct MemWalkResults *mwr, CopyoutArea *area)
+{
+  size_t avail = 0;
+
+  area->va = va;
+  area->npage = 0;
+
+  while (avail < len && area->npage < COPYOUT_MAX_PAGES) {
+    struct FoundPage fp;
+    uintptr_t offset = (va + avail) & COYOTOS_PAGE_ADDR_MASK;
+
+    if (proc_findNextDataPage(p, va + avail - offset, true, true, mwr, &fp))
+      break;
+
+    obhdr_dirty(&fp.pgHdr->mhdr.hdr);
+    area->pg[area->npage++] = fp.pgHdr;
+
+    avail += COYOTOS_PAGE_SIZE - offset;
+  }
+
+  return min(avail, len);
+}
+
+void
+proc_copyout_prepared(CopyoutArea *area, size_t offset, 
+		      const void *src, size_t len)
+{
+  const uint8_t *from = src;
+  uintptr_t firstPage = area->va & ~COYOTOS_PAGE_ADDR_MASK;
+
+  while (len) {
+    uintptr_t va = area->va + offset;
+    size_t ndx = ((va & ~COYOTOS_PAGE_ADDR_MASK) - firstPage) 
+      / COYOTOS_PAGE_SIZE;
+    uintptr_t pgOffset = va & COYOTOS_PAGE_ADDR_MASK;
+
+    assert(ndx < area->npage);
+
+    size_t count = min(len, COYOTOS_PAGE_SIZE - pgOffset);
+    memcpy_vtop(area->pg[ndx]->pa + pgOffset, (void *) from, count);
+
+    offset += count;
+    from += count;
+    len -= count;
+  }
+}
+
 void
 proc_ensure_exclusive(Process *p)
 {
@@ -718,6 +790,143 @@ proc_copy_cap(Process *p, caploc_t source, caploc_t dest)
   return;
 }
 
+/** @brief Fast path for register-only IPC.
+ *
+ * Handles the send phase of the common case: an entry capability
+ * invoked from a capability register, sending only data words and
+ * (optionally) capabilities from capability registers, no string, to
+ * a process that is ready to receive into capability registers. This
+ * is the shape of nearly every call and reply, and none of it needs
+ * the general marshalling done in proc_invoke_cap().
+ *
+ * Returns false, having done nothing beyond preparing and locking
+ * objects, if the invocation is not of this shape. The caller then
+ * takes the general path, which repeats those steps harmlessly.
+ * Returns true if the send phase has been completed. In that case
+ * the invokee is not the invoker, and @p ipw0 is still current.
+ *
+ * Invoker-side parameter validation is done by the caller before
+ * this is called, except for checks that this path makes redundant.
+ */
+static bool
+proc_invoke_fast(Process *p, uintptr_t ipw0, InvParam_t *iParam)
+{
+  caploc_t invCap = get_invoke_cap(p);
+  if (invCap.fld.ty != CAPLOC_TY_REG || invCap.fld.loc >= NUM_CAP_REGS)
+    return false;
+
+  capability *iCap = &p->state.capReg[invCap.fld.loc];
+  if (iCap->type != ct_Entry)
+    return false;
+
+  if (get_pw(p, IPW_SNDLEN) != 0)
+    return false;
+
+  size_t nSnd = (ipw0 & IPW0_SC) ? IPW0_LSC(ipw0) + 1 : 0;
+  capability *sndCap[4];
+  capability replyCap;
+
+  for (size_t i = 0; i < nSnd; i++) {
+    caploc_t loc = get_snd_cap(p, i);
+    if (loc.fld.ty != CAPLOC_TY_REG || loc.fld.loc >= NUM_CAP_REGS)
+      return false;
+    sndCap[i] = &p->state.capReg[loc.fld.loc];
+  }
+
+  /* Receive area must be valid even though no string is sent to
+   * us here, because we may receive one later. */
+  uint32_t rbound = get_rcv_pw(p, IPW_RCVBOUND);
+  if (rbound > COYOTOS_MAX_SNDLEN)
+    return false;
+  if (rbound) {
+    uva_t base = get_rcv_pw(p, IPW_RCVPTR);
+    if (! (vm_valid_uva(p, base) && vm_valid_uva(p, base + rbound - 1)) )
+      return false;
+  }
+
+  /* Reply capability fabrication, as in proc_invoke_cap(), but into
+   * a local copy since the source is always a register. */
+  if ((ipw0 & IPW0_SC) && (ipw0 & IPW0_RC)) {
+    cap_prepare(sndCap[0]);
+
+    if (sndCap[0]->type == ct_Endpoint) {
+      cap_set(&replyCap, sndCap[0]);
+      Endpoint *replyEP = (Endpoint *)replyCap.u2.prepObj.target;
+      replyCap.u1.protPayload = replyEP->state.protPayload;
+      replyCap.type = ct_Entry;
+      sndCap[0] = &replyCap;
+    }
+  }
+
+  iParam->invoker = p;
+  iParam->invokee = 0;
+
+  Endpoint *ep = 
+    cap_prepare_for_invocation(iParam, iCap, !(ipw0 & IPW0_NB), false);
+  if (ep == 0)
+    return false;
+
+  Process *invokee = iParam->invokee;
+  assert(invokee && invokee != p);
+
+  uintptr_t invokee_ipw0 = get_icw(invokee);
+
+  size_t nRcv = 0;
+  if ((ipw0 & IPW0_SC) && (invokee_ipw0 & IPW0_AC))
+    nRcv = min(nSnd, IPW0_LRC(invokee_ipw0) + 1);
+
+  capability *rcvCap[4];
+  for (size_t i = 0; i < nRcv; i++) {
+    caploc_t loc = get_rcv_cap(invokee, i);
+    if (loc.fld.ty != CAPLOC_TY_REG || loc.fld.loc >= NUM_CAP_REGS)
+      return false;
+    rcvCap[i] = 
+      loc.fld.loc ? &invokee->state.capReg[loc.fld.loc] : &NullTargetCap;
+  }
+
+  obhdr_dirty(&invokee->hdr);
+
+  sched_commit_point();
+
+  switch(IPW0_LDW(ipw0)) {
+  case 7: set_pw(invokee, IPW_DW0+7, get_pw(p, IPW_DW0+7));
+  case 6: set_pw(invokee, IPW_DW0+6, get_pw(p, IPW_DW0+6));
+  case 5: set_pw(invokee, IPW_DW0+5, get_pw(p, IPW_DW0+5));
+  case 4: set_pw(invokee, IPW_DW0+4, get_pw(p, IPW_DW0+4));
+  case 3: set_pw(invokee, IPW_DW0+3, get_pw(p, IPW_DW0+3));
+  case 2: set_pw(invokee, IPW_DW0+2, get_pw(p, IPW_DW0+2));
+  case 1: set_pw(invokee, IPW_DW0+1, get_pw(p, IPW_DW0+1));
+    break;
+  }
+
+  set_pw(invokee, OPW_SNDLEN, 0);
+
+  for (size_t i = 0; i < nRcv; i++)
+    cap_set(rcvCap[i], sndCap[i]);
+
+  if (ep->state.pm)
+    ep->state.protPayload++;
+
+  set_pw(invokee, OPW_PP, iCap->u1.protPayload);
+  set_epID(invokee, ep->state.endpointID);
+
+  uintptr_t opw0 = invokee_ipw0 & IPW0_PRESERVE;
+  opw0 |= ((ipw0 & IPW0_LDW_MASK) |
+	   (ipw0 & IPW0_LSC_MASK) |
+	   (ipw0 & (IPW0_SC|IPW0_EX)));
+  set_pw(invokee, 0, opw0);
+
+  LOG_EVENT(ety_IpcSend, p, invokee, 0);
+
+  proc_consume_handoff(p, invokee);
+  invokee->state.runState = PRS_RUNNING;
+
+  /* Donate our slice iff we are going on to receive. */
+  rq_addReady(invokee, (ipw0 & IPW0_RP) ? true : false);
+
+  return true;
+}
+
 static void
 proc_invoke_cap(void)
 {
@@ -727,6 +936,8 @@ proc_invoke_cap(void)
      to fetch it before validating the incoming parameter block. */
   uintptr_t ipw0 = get_icw(p);
 
+  cpu_count(cst_Invocations);
+
   /*******************************************************************
    *
    *                 PHASE 0
@@ -758,6 +969,14 @@ proc_invoke_cap(void)
    * At some point, we could just zero the "cap" fields.
    */
   InvParam_t invParam;
+
+  if ((ipw0 & IPW0_SP) && proc_invoke_fast(p, ipw0, &invParam)) {
+    /* Same exits as the general IPC path below. */
+    if ((ipw0 & IPW0_RP) == 0)
+      return;
+    goto receive_phase;
+  }
+
   INIT_TO_ZERO(&invParam);
   invParam.invoker = p;
   
@@ -921,19 +1140,51 @@ proc_invoke_cap(void)
 	slen = min(slen, bound);
 
 	uva_t dest = get_rcv_pw(invParam.invokee, IPW_RCVPTR);
+	uint32_t xfer_len = slen;
+
+	/* Destination pages are resolved a batch at a time before any
+	   copying is done. Successive lookups reuse the walk of the
+	   invokee's address space, so only the bottom of the tree is
+	   revisited per page. */
+	MemWalkResults mwr;
+	mwr.count = 0;
 
 	while (slen) {
-	  uva_t target_page_offset = dest & COYOTOS_PAGE_ADDR_MASK;
-	  uva_t target_page_va = dest - target_page_offset;
-	  uva_t next_target_page_start = target_page_va + COYOTOS_PAGE_SIZE;
-	  size_t count = min(next_target_page_start - dest, slen);
+	  kpa_t dest_pa[STRXFER_BATCH];
+	  size_t dest_len[STRXFER_BATCH];
+	  size_t npage = 0;
+	  size_t resolved = 0;
+	  uva_t target_page_va = 0;
+	  coyotos_Process_FC fc = 0;
+
+	  while (npage < STRXFER_BATCH && resolved < slen) {
+	    uva_t target_va = dest + resolved;
+	    uva_t target_page_offset = target_va & COYOTOS_PAGE_ADDR_MASK;
+	    target_page_va = target_va - target_page_offset;
+
+	    FoundPage pgInfo;
+	    fc = proc_findNextDataPage(invParam.invokee, target_page_va, 
+				       true, false, &mwr, &pgInfo);
+	    assert(fc == 0);
+	    if (fc)
+	      break;
+
+	    obhdr_dirty(&pgInfo.pgHdr->mhdr.hdr);
+
+	    dest_pa[npage] = pgInfo.pgHdr->pa + target_page_offset;
+	    dest_len[npage] = min(COYOTOS_PAGE_SIZE - target_page_offset,
+				  slen - resolved);
+	    resolved += dest_len[npage];
+	    npage++;
+	  }
 
-	  FoundPage pgInfo;
-	  coyotos_Process_FC fc = 
-	    proc_findDataPage(invParam.invokee, target_page_va, true, false, &pgInfo);
-	  assert(fc == 0);
+	  for (size_t i = 0; i < npage; i++) {
+	    memcpy_vtop(dest_pa[i], (void *) src, dest_len[i]);
+	    src += dest_len[i];
+	  }
 
-	  obhdr_dirty(&pgInfo.pgHdr->mhdr.hdr);
+	  dest += resolved;
+	  slen -= resolved;
 
 	  if (fc) {
 	    if (ipw0 & IPW0_NB) {
@@ -944,8 +1195,7 @@ proc_invoke_cap(void)
 		 NB=1 to a client with CW=1, and if we back out
 		 there is no way the client will ever run again. */
 	      opw0 |= IPW0_NB;
-	      set_pw(invParam.invokee, OPW_SNDLEN, 
-		     (target_page_va > dest) ? target_page_va : 0);
+	      set_pw(invParam.invokee, OPW_SNDLEN, xfer_len - slen);
 	      goto xfer_caps;
 	    }
 
@@ -956,19 +1206,12 @@ proc_invoke_cap(void)
 	       donating our slice in order to let them clear their
 	       fault. */
 	    p->state.runState = PRS_RUNNING;
-	    rq_add(&mainRQ, invParam.invokee, true);
+	    rq_addReady(invParam.invokee, true);
 
 	    /* Restart the transaction so that we will end up placed
 	       on their rcvWaitQ queue. */
 	    sched_restart_transaction();
 	  }
-
-	  kpa_t dest_pa = pgInfo.pgHdr->pa + target_page_offset;
-	  memcpy_vtop(dest_pa, (void *) src, count);
-
-	  dest += count;
-	  src += count;
-	  slen -= count;
 	}
       }
 
@@ -1008,11 +1251,15 @@ proc_invoke_cap(void)
 	 here because we did not set it above. */
       set_pw(invParam.invokee, 0, opw0);
 
+      LOG_EVENT(ety_IpcSend, p, invParam.invokee, 
+		get_pw(invParam.invokee, OPW_SNDLEN));
+
       /* Careful! The local variable 'ipw0' is now stale if
 	 invokee==p, but we still need it if invokee != p */
 
       /* Invocation is complete. Set invokee running. If
 	 invokee==invoker, this is a no-op. */
+      proc_consume_handoff(p, invParam.invokee);
       invParam.invokee->state.runState = PRS_RUNNING;
 
       assert((ipw0 & IPW0_RP) || (invParam.invokee != p));
@@ -1023,7 +1270,7 @@ proc_invoke_cap(void)
 	 * donate our slice to them.
 	 *
 	 * Note we know in this case that invParam.invokee!=p */
-	rq_add(&mainRQ, invParam.invokee, false);
+	rq_addReady(invParam.invokee, false);
 	return;
       }
       else if (invParam.invokee == p) {
@@ -1036,7 +1283,7 @@ proc_invoke_cap(void)
 	 *
 	 * Note this is the ONLY case that actually goes to
 	 * receive_phase, and in this case 'ipw0' is still good. */
-	rq_add(&mainRQ, invParam.invokee, true);
+	rq_addReady(invParam.invokee, true);
 	goto receive_phase;
       }
     }
@@ -1162,8 +1409,9 @@ proc_invoke_cap(void)
 	    donate = false;
 	}
 
+	proc_consume_handoff(invParam.invoker, invParam.invokee);
 	invParam.invokee->state.runState = PRS_RUNNING;
-	rq_add(&mainRQ, invParam.invokee, donate);
+	rq_addReady(invParam.invokee, donate);
       }
 
       if (invParam.invoker == 0)
@@ -1187,6 +1435,10 @@ proc_invoke_cap(void)
    *
    *******************************************************************/
 
+  /* A receiver wakeup that the send phase did not use must be passed
+   * on before we go to sleep. */
+  proc_release_handoff(p);
+
   if (invParam.invoker == 0)
     return;
 
@@ -1199,10 +1451,19 @@ proc_invoke_cap(void)
 
     invParam.invoker->state.runState = PRS_RECEIVING;
 
+    LOG_EVENT(ety_IpcRecv, invParam.invoker, ipw0, 0);
+
     if (((ipw0 & IPW0_CW) == 0) && invParam.invoker->state.notices)
       proc_DeliverSoftNotices(invParam.invoker);
 
-    sq_WakeAll(&invParam.invoker->rcvWaitQ, false);
+    /* Any single sender can satisfy an open wait, so wake only the
+     * one that has waited longest. A closed wait can only be
+     * satisfied by a sender on one endpoint, and we cannot tell which
+     * sleepers those are, so they all must retry. */
+    if (ipw0 & IPW0_CW)
+      sq_WakeAll(&invParam.invoker->rcvWaitQ, false);
+    else
+      sq_WakeOne(&invParam.invoker->rcvWaitQ, invParam.invoker);
 
     /* Let someone else run. */
     sched_abandon_transaction();
@@ -1275,7 +1536,9 @@ proc_syscall(void)
     }
 
   case sc_InvokeCap:
-    return proc_invoke_cap();
+    proc_invoke_cap();
+    proc_release_handoff(p);
+    return;
 
   default:
     {
@@ -24,8 +24,90 @@
  */
 
 #include <kerninc/ReadyQueue.h>
+#include <kerninc/CPU.h>
+#include <kerninc/assert.h>
+#include <kerninc/event.h>
 
-DEFREADYQUEUE(mainRQ);
+ReadyQueue rq_vec[MAX_NCPU];
+
+void
+rq_init(ReadyQueue *queue)
+{
+  for (size_t i = 0; i < SCHED_NBANDS; i++)
+    sq_Init(&queue->band[i]);
+  atomic_write(&queue->nonEmpty, 0);
+  atomic_write(&queue->count, 0);
+}
+
+ReadyQueue *
+rq_choose(Process *process, bool at_front)
+{
+  cpuid_t last = process->lastCPU;
+
+  /* A handoff runs next on this CPU. Otherwise prefer the CPU the
+   * process last ran on. If that CPU is idle it may be halted, and
+   * nobody will look at its queue until it takes an interrupt, so
+   * keep the process here where it will be run or stolen. The
+   * check of current is unlocked, and is only a hint. */
+  if (!at_front && last < cpu_ncpu && last != CUR_CPU->id &&
+      cpu_vec[last].active && cpu_vec[last].current != NULL)
+    return &rq_vec[last];
+
+  return &rq_vec[CUR_CPU->id];
+}
+
+/** @brief Return the CPU that owns @p queue. */
+static inline CPU *
+rq_cpu(ReadyQueue *queue)
+{
+  return &cpu_vec[queue - rq_vec];
+}
+
+/** @brief Return the band of @p queue that @p process belongs on. */
+static inline StallQueue *
+rq_band(ReadyQueue *queue, Process *process)
+{
+  assert(process->priority < SCHED_NBANDS);
+  return &queue->band[process->priority];
+}
+
+/** @brief Link @p process onto its band of @p queue.
+ *
+ * Caller must hold the band lock, and must already have unlinked
+ * @p process from wherever it was.
+ */
+static void
+rq_link(ReadyQueue *queue, Process *process, bool at_front)
+{
+  StallQueue *sq = rq_band(queue, process);
+  Link *cur = process_to_link(process);
+
+  process->onQ = sq;
+  if (at_front)
+    link_insertAfter(&sq->q_head, cur);
+  else
+    link_insertBefore(&sq->q_head, cur);
+
+  atomic_set_bits(&queue->nonEmpty, 1u << process->priority);
+  atomic_write(&queue->count, atomic_read(&queue->count) + 1);
+}
+
+/** @brief Unlink @p cur from band @p bandNo of @p queue.
+ *
+ * Caller must hold the band lock.
+ */
+static void
+rq_unlink(ReadyQueue *queue, uint32_t bandNo, Link *cur)
+{
+  StallQueue *sq = &queue->band[bandNo];
+
+  link_unlink(cur);
+  process_from_link(cur)->onQ = NULL;
+
+  if (link_isSingleton(&sq->q_head))
+    atomic_clear_bits(&queue->nonEmpty, 1u << bandNo);
+  atomic_write(&queue->count, atomic_read(&queue->count) - 1);
+}
 
 bool 
 sq_IsEmpty(StallQueue* sq)
@@ -36,44 +118,79 @@ sq_IsEmpty(StallQueue* sq)
   return result;
 }
 
+/** @brief Remove the front (or back) member of the highest
+ * non-empty band of a ready queue. */
 static Process *
-sq_removeFront(StallQueue *sq)
+rq_removeEnd(ReadyQueue *rq, bool from_back)
 {
-  Process *p = NULL;
-  SpinHoldInfo shi = spinlock_grab(&sq->qLock);
-  if (!sq_IsEmpty(sq)) {
-    Link *ptr = sq->q_head.next;
-    link_unlink(ptr);
+  for (;;) {
+    int bandNo = rq_topBand(rq);
+    if (bandNo < 0)
+      return NULL;
 
-    p = process_from_link(ptr);
-    p->onQ = NULL;
+    StallQueue *sq = &rq->band[bandNo];
+    SpinHoldInfo shi = spinlock_grab(&sq->qLock);
+
+    /* The band may have been drained since we read the bitmap. Its
+     * bit will have been cleared when it was, so just look again. */
+    if (!link_isSingleton(&sq->q_head)) {
+      Link *ptr = from_back ? sq->q_head.prev : sq->q_head.next;
+      rq_unlink(rq, bandNo, ptr);
+      spinlock_release(shi);
+      return process_from_link(ptr);
+    }
+
+    spinlock_release(shi);
   }
-  spinlock_release(shi);
-  return p;
+}
+
+/** @brief Move a sleeper from its stall queue to a ready queue.
+ *
+ * Caller must hold the stall queue lock. */
+static void
+sq_wake_link(Link *ptr)
+{
+  Process *p = process_from_link(ptr);
+  ReadyQueue *rq = rq_choose(p, false);
+
+  SpinHoldInfo rshi = spinlock_grab(&rq_band(rq, p)->qLock);
+  link_unlink(ptr);
+  rq_link(rq, p, false);
+  spinlock_release(rshi);
+
+  sched_wakeup_preempt(rq_cpu(rq), p->priority);
 }
 
 void 
 sq_WakeAll(StallQueue* sq, bool verbose /*@ default false @*/)
 {
-  ReadyQueue *rq = &mainRQ;
+  SpinHoldInfo shi = spinlock_grab(&sq->qLock);
+  /* Each sleeper may belong on a different CPU's ready queue, so
+   * move them one at a time. */
+  while (!link_isSingleton(&sq->q_head))
+    sq_wake_link(sq->q_head.next);
+
+  spinlock_release(shi);
+  return;
+
+}
+
+/* Sleepers are inserted at the head, so the longest waiter is at the
+ * tail. */
+Process *
+sq_WakeOne(StallQueue *sq, Process *handoff)
+{
+  Process *p = NULL;
 
   SpinHoldInfo shi = spinlock_grab(&sq->qLock);
   if (!link_isSingleton(&sq->q_head)) {
-    SpinHoldInfo rshi = spinlock_grab(&rq->queue.qLock);
-    /* we could move them in a gang, but this is easier to understand */
-    while (!link_isSingleton(&sq->q_head)) {
-      Link *ptr = sq->q_head.next;
-      link_unlink(ptr);
-
-      Process *p = process_from_link(ptr);
-      p->onQ = &rq->queue;
-      link_insertBefore(&rq->queue.q_head, ptr);
-    }
-    spinlock_release(rshi);
+    p = process_from_link(sq->q_head.prev);
+    p->rcvHandoff = handoff;
+    sq_wake_link(sq->q_head.prev);
   }
   spinlock_release(shi);
-  return;
 
+  return p;
 }
 
 void
@@ -87,6 +204,17 @@ sq_EnqueueOn(StallQueue *sq)
   spinlock_release(shi);
 }
 
+void
+sq_RequeueOn(StallQueue *sq)
+{
+  Process *p = MY_CPU(current);
+
+  SpinHoldInfo shi = spinlock_grab(&sq->qLock);
+  p->onQ = sq;
+  link_insertBefore(&sq->q_head, process_to_link(p));
+  spinlock_release(shi);
+}
+
 void
 sq_Unsleep(Process *process)
 {
@@ -96,35 +224,44 @@ sq_Unsleep(Process *process)
   SpinHoldInfo shi;
   for (;;) {
     sq = process->onQ;
-    if (sq == 0 || sq == &mainRQ.queue)
+    if (sq == 0 || rq_isReadyQueue(sq))
       return;
     shi = spinlock_grab(&sq->qLock);
     if (sq == process->onQ)
       break;
     spinlock_release(shi);
   }
-  SpinHoldInfo rshi = spinlock_grab(&mainRQ.queue.qLock);
+  ReadyQueue *rq = rq_choose(process, false);
+  SpinHoldInfo rshi = spinlock_grab(&rq_band(rq, process)->qLock);
 
-  Link *cur = process_to_link(process);
-  link_unlink(cur);
-  process->onQ = &mainRQ.queue;
-  link_insertBefore(&mainRQ.queue.q_head, cur);
+  link_unlink(process_to_link(process));
+  rq_link(rq, process, false);
 
   spinlock_release(rshi);
   spinlock_release(shi);
+
+  sched_wakeup_preempt(rq_cpu(rq), process->priority);
+}
+
+void
+sq_UnsleepLocked(StallQueue *sq, Process *process)
+{
+  assert(spinlock_isheld(&sq->qLock));
+  assert(process->onQ == sq);
+
+  sq_wake_link(process_to_link(process));
 }
 
 void 
 rq_add(ReadyQueue *queue, Process *process, bool at_front)
 {
-  Link *cur = process_to_link(process);
-  SpinHoldInfo shi = spinlock_grab(&queue->queue.qLock);
-  process->onQ = &queue->queue;
-  if (at_front)
-    link_insertAfter(&queue->queue.q_head, cur);
-  else
-    link_insertBefore(&queue->queue.q_head, cur);
+  SpinHoldInfo shi = spinlock_grab(&rq_band(queue, process)->qLock);
+  rq_link(queue, process, at_front);
   spinlock_release(shi);
+
+  LOG_EVENT(ety_Wakeup, process, rq_cpu(queue)->id, process->priority);
+
+  sched_wakeup_preempt(rq_cpu(queue), process->priority);
 }
 
 /** @brief remove process from queue
@@ -139,17 +276,52 @@ rq_add(ReadyQueue *queue, Process *process, bool at_front)
 void 
 rq_remove(ReadyQueue *queue, Process *process)
 {
-  assert(process->onQ == &queue->queue);
+  StallQueue *sq = process->onQ;
+  assert(sq >= &queue->band[0] && sq <= &queue->band[SCHED_NBANDS-1]);
 
-  SpinHoldInfo shi = spinlock_grab(&queue->queue.qLock);
+  SpinHoldInfo shi = spinlock_grab(&sq->qLock);
   Link *cur = process_to_link(process);
   assert(!link_isSingleton(cur));
-  process->onQ = NULL;
-  link_unlink(cur);
+  rq_unlink(queue, sq - &queue->band[0], cur);
   spinlock_release(shi);
 }
 
 Process *rq_removeFront(ReadyQueue *queue)
 {
-  return (sq_removeFront(&queue->queue));
+  return (rq_removeEnd(queue, false));
+}
+
+Process *
+rq_steal(void)
+{
+  cpuid_t self = CUR_CPU->id;
+
+  /* Retry a bounded number of times: the victim we pick may be
+   * drained by its owner before we get its lock. */
+  for (size_t tries = 0; tries < cpu_ncpu; tries++) {
+    ReadyQueue *victim = NULL;
+    int topBand = -1;
+    uint32_t most = 0;
+
+    for (cpuid_t i = 0; i < cpu_ncpu; i++) {
+      if (i == self)
+	continue;
+      int band = rq_topBand(&rq_vec[i]);
+      uint32_t n = atomic_read(&rq_vec[i].count);
+      if (band > topBand || (band == topBand && band >= 0 && n > most)) {
+	topBand = band;
+	most = n;
+	victim = &rq_vec[i];
+      }
+    }
+
+    if (victim == NULL)
+      return NULL;
+
+    Process *p = rq_removeEnd(victim, true);
+    if (p)
+      return p;
+  }
+
+  return NULL;
 }
@@ -20,6 +20,16 @@
 
 /** @file
  * @brief Reverse map management.
+ *
+ * Reverse map entries hang directly off the Page or Mapping that the
+ * recorded PTE points at, in a chain of RevMap blocks. Each block
+ * belongs to a single target, so installing an entry only needs to
+ * check the target's own entries for duplicates, and whacking a
+ * target visits only its own entries.
+ *
+ * Chains are protected by a striped array of spinlocks hashed on the
+ * target address. Whacking detaches the whole chain under the lock,
+ * then clears the PTEs and performs a single TLB flush for the batch.
  */
 
 #include <kerninc/RevMap.h>
@@ -30,107 +40,233 @@
 #include <kerninc/ObjectHeader.h>
 #include <kerninc/printf.h>
 
-#define REVMAP_TABLE_SIZE 1024
+#define REVMAP_LOCK_STRIPES 256
 
-typedef struct RevMapBucket {
-  spinlock_t lock;
-  RevMap *list;
-} RevMapBucket;
+static spinlock_t revMapLock[REVMAP_LOCK_STRIPES];
 
-RevMapBucket revMapTable[REVMAP_TABLE_SIZE];
+/** @brief Clock hand for RevMap block reclaim. */
+static Atomic32_t rm_reclaim_hand;
 
-static inline RevMapBucket *
-rm_hash_page(Page *pg)
+static inline spinlock_t *
+rm_lock_for(uintptr_t owner)
 {
-  size_t bucket = ((uintptr_t)pg / sizeof (*pg)) % REVMAP_TABLE_SIZE;
-
-  return (&revMapTable[bucket]);
+  owner &= REVMAP_OWNER_PTR_MASK;
+  return &revMapLock[(owner / sizeof (void *)) % REVMAP_LOCK_STRIPES];
 }
 
-static inline RevMapBucket *
-rm_hash_mapping(Mapping *map)
+/** @brief Return the head of the chain for the tagged @p owner. */
+static inline RevMap **
+rm_chain_for(uintptr_t owner)
 {
-  size_t bucket = ((uintptr_t)map / sizeof (*map)) % REVMAP_TABLE_SIZE;
-
-  return (&revMapTable[bucket]);
+  if ((owner & REVMAP_OWNER_TYPE_MASK) == REVMAP_OWNER_MAPPING)
+    return &((Mapping *)(owner & REVMAP_OWNER_PTR_MASK))->rmap;
+  else
+    return &((Page *)(owner & REVMAP_OWNER_PTR_MASK))->rmap;
 }
 
 static inline bool
-rm_match_page(RevMapEntry ent, Page *pg)
+rm_same_entry(const RevMapEntry *ent, const RevMapEntry *e)
 {
-  return (ent.target.raw & REVMAP_TARGET_PTR_MASK) == (uintptr_t)pg;
-}
+  if (ent->target.raw != e->target.raw)
+    return false;
 
-static inline bool
-rm_match_mapping(RevMapEntry ent, Mapping *map)
-{
-  return (ent.target.raw & REVMAP_TARGET_PTR_MASK) == (uintptr_t)map;
+  switch (e->target.raw & REVMAP_TARGET_TYPE_MASK) {
+  case REVMAP_TARGET_PAGE:
+  case REVMAP_TARGET_MAP_PTE:
+    return (ent->whackee.pte.tbl == e->whackee.pte.tbl &&
+	    ent->whackee.pte.slot == e->whackee.pte.slot);
+
+  case REVMAP_TARGET_MAP_PROC:
+    return (ent->whackee.proc_va == e->whackee.proc_va);
+
+  default:
+    assert(0);
+    return false;
+  }
 }
 
-/** @brief Underlying implementation for all of the rm_install_*() routines.
+/** @brief Try to record @p e in the chain at @p chain.
+ *
+ * Returns true if @p e was already present or has been placed in a
+ * free entry. Caller must hold the stripe lock for the chain.
  */
-static inline void
-rm_install_entry(RevMapBucket *b, RevMapEntry e)
+static bool
+rm_try_install(RevMap *chain, RevMapEntry e)
 {
-  SpinHoldInfo shi = spinlock_grab(&b->lock);
-
-  RevMap *ent;
-  bool free = false;
-
-  for (ent = b->list; ent != NULL; ent = ent->next) {
-    if (ent->nvalid < ENTRIES_PER_REVMAP)
-      free = true;
-    for (int x = 0; x < ENTRIES_PER_REVMAP; x++) {
-      if (ent->ents[x].target.raw == e.target.raw) {
-	switch (e.target.raw & REVMAP_TARGET_TYPE_MASK) {
-	case REVMAP_TARGET_PAGE:
-	case REVMAP_TARGET_MAP_PTE:
-	  if (ent->ents[x].whackee.pte.tbl == e.whackee.pte.tbl &&
-	      ent->ents[x].whackee.pte.slot == e.whackee.pte.slot) {
-	    spinlock_release(shi);
-	    return;
-	  }
-	  break;
-
-	case REVMAP_TARGET_MAP_PROC:
-	  if (ent->ents[x].whackee.proc_va == e.whackee.proc_va) {
-	    spinlock_release(shi);
-	    return;
-	  }
-	  break;
-
-	default:
-	  assert(0);
-	  break;
+  RevMapEntry *free = 0;
+  RevMap *freeBlk = 0;
+
+  for (RevMap *blk = chain; blk != NULL; blk = blk->next) {
+    for (size_t x = 0; x < ENTRIES_PER_REVMAP; x++) {
+      if (blk->ents[x].target.raw == 0) {
+	if (!free) {
+	  free = &blk->ents[x];
+	  freeBlk = blk;
 	}
+	continue;
       }
+      if (rm_same_entry(&blk->ents[x], &e))
+	return true;
     }
   }
 
-  if (!free) {
-    RevMap *nRev = cache_alloc_RevMap();
-    /** @bug we need to invalidate revmap entries if this fails */
-    assert(nRev != NULL);
-    nRev->next = b->list;
-    b->list = nRev;
+  if (!free)
+    return false;
+
+  *free = e;
+  freeBlk->nvalid++;
+  assert(freeBlk->nvalid <= ENTRIES_PER_REVMAP);
+  return true;
+}
+
+static inline void
+rm_do_whack(RevMapEntry e)
+{
+  switch (e.target.raw & REVMAP_TARGET_TYPE_MASK) {
+  case REVMAP_TARGET_PAGE:
+  case REVMAP_TARGET_MAP_PTE:
+    rm_whack_pte(e.whackee.pte.tbl, e.whackee.pte.slot);
+    break;
+  case REVMAP_TARGET_MAP_PROC:
+    rm_whack_process(e.whackee.proc_va);
+    break;
+  default:
+    assert(0);
+    break;
   }
+}
+
+/** @brief Whack every entry on a detached chain and free its blocks.
+ *
+ * The caller must have cleared the owner of each block while holding
+ * the stripe lock. Returns true if any PTE was cleared, in which case
+ * the caller must flush.
+ */
+static bool
+rm_whack_chain(RevMap *chain)
+{
+  bool needFlush = false;
+  RevMap *next;
+
+  for (RevMap *blk = chain; blk != NULL; blk = next) {
+    next = blk->next;
+
+    for (size_t x = 0; x < ENTRIES_PER_REVMAP; x++) {
+      RevMapEntry e = blk->ents[x];
+      if (e.target.raw == 0)
+	continue;
+
+      if ((e.target.raw & REVMAP_TARGET_TYPE_MASK) != REVMAP_TARGET_MAP_PROC)
+	needFlush = true;
+
+      rm_do_whack(e);
+    }
 
-  for (ent = b->list; ent != NULL; ent = ent->next) {
-    if (ent->nvalid >= ENTRIES_PER_REVMAP)
+    cache_free_RevMap(blk);
+  }
+
+  return needFlush;
+}
+
+/** @brief Reclaim a RevMap block from some other page.
+ *
+ * Only blocks hanging off Pages are considered. Whacking those only
+ * clears PTEs, which the owner will re-fault, whereas Mapping blocks
+ * may need to whack Process mapping pointers, which takes a mutex.
+ * Pages locked by the current transaction are skipped, since one of
+ * them may be the page we are in the middle of mapping.
+ */
+static RevMap *
+rm_reclaim(void)
+{
+  size_t count = Cache.rmap.count;
+
+  for (size_t n = 0; n < count; n++) {
+    uint32_t hand;
+
+    do {
+      hand = atomic_read(&rm_reclaim_hand);
+    } while (compare_and_swap(&rm_reclaim_hand, hand, hand + 1) != hand);
+
+    RevMap *victim = &Cache.rmap.vec[hand % count];
+    uintptr_t owner = victim->owner;
+
+    if (owner == 0 ||
+	(owner & REVMAP_OWNER_TYPE_MASK) != REVMAP_OWNER_PAGE)
+      continue;
+
+    Page *pg = (Page *)(owner & REVMAP_OWNER_PTR_MASK);
+    if (mutex_isheld(&pg->mhdr.hdr.lock))
+      continue;
+
+    SpinHoldInfo shi = spinlock_grab(rm_lock_for(owner));
+
+    /* Block may have changed hands before we got the lock. */
+    if (victim->owner != owner) {
+      spinlock_release(shi);
       continue;
-    for (size_t i = 0; i < ENTRIES_PER_REVMAP; i++) {
-      if (ent->ents[i].target.raw == 0) {
-	ent->ents[i] = e;
-	ent->nvalid++;
-	assert(ent->nvalid <= ENTRIES_PER_REVMAP);
-	spinlock_release(shi);
-	return;
-      }
     }
+
+    RevMap **pp;
+    for (pp = &pg->rmap; *pp != victim; pp = &(*pp)->next)
+      assert(*pp != NULL);
+    *pp = victim->next;
+    victim->next = 0;
+    /* Once off the chain, nobody else may treat it as a victim. */
+    victim->owner = 0;
+
+    spinlock_release(shi);
+
+    if (rm_whack_chain(victim))
+      rm_whack_flush();
+
+    RevMap *rm = cache_alloc_RevMap();
+    if (rm)
+      return rm;
   }
-  /* this should never be reached */
-  fatal("There should have been at least one free entry in revmap bucket");
 
+  return NULL;
+}
+
+/** @brief Underlying implementation for all of the rm_install_*() routines.
+ */
+static void
+rm_install_entry(uintptr_t owner, RevMapEntry e)
+{
+  spinlock_t *lock = rm_lock_for(owner);
+  RevMap **chain = rm_chain_for(owner);
+
+  SpinHoldInfo shi = spinlock_grab(lock);
+  bool done = rm_try_install(*chain, e);
+  spinlock_release(shi);
+
+  if (done)
+    return;
+
+  /* Need a new block. Get it without holding the stripe lock, since
+   * reclaiming one may need to take some other stripe's lock. */
+  RevMap *nRev = cache_alloc_RevMap();
+  if (nRev == NULL)
+    nRev = rm_reclaim();
+  if (nRev == NULL)
+    fatal("RevMap cache exhausted, and nothing is reclaimable\n");
+
+  shi = spinlock_grab(lock);
+
+  if (rm_try_install(*chain, e)) {
+    /* Someone made room (or installed e) while we were away. */
+    spinlock_release(shi);
+    cache_free_RevMap(nRev);
+    return;
+  }
+
+  nRev->owner = owner;
+  nRev->ents[0] = e;
+  nRev->nvalid = 1;
+  nRev->next = *chain;
+  *chain = nRev;
+
+  spinlock_release(shi);
 }
 
 void
@@ -140,7 +276,7 @@ rm_install_process_mapping(Mapping *map, Process *proc)
   e.target.raw = (uintptr_t)map | REVMAP_TARGET_MAP_PROC;
   e.whackee.proc_va = proc;
 
-  rm_install_entry(rm_hash_mapping(map), e);
+  rm_install_entry((uintptr_t)map | REVMAP_OWNER_MAPPING, e);
 }
 
 void
@@ -151,7 +287,7 @@ rm_install_pte_mapping(Mapping *map, Mapping *tbl, size_t slot)
   e.whackee.pte.tbl = tbl;
   e.whackee.pte.slot = slot;
 
-  rm_install_entry(rm_hash_mapping(map), e);
+  rm_install_entry((uintptr_t)map | REVMAP_OWNER_MAPPING, e);
 }
 
 void
@@ -162,70 +298,65 @@ rm_install_pte_page(Page *pg, Mapping *tbl, size_t slot)
   e.whackee.pte.tbl = tbl;
   e.whackee.pte.slot = slot;
 
-  rm_install_entry(rm_hash_page(pg), e);
-}
-
-static inline void
-rm_do_whack(RevMapEntry e)
-{
-  switch (e.target.raw & REVMAP_TARGET_TYPE_MASK) {
-  case REVMAP_TARGET_PAGE:
-  case REVMAP_TARGET_MAP_PTE:
-    rm_whack_pte(e.whackee.pte.tbl, e.whackee.pte.slot);
-    break;
-  case REVMAP_TARGET_MAP_PROC:
-    rm_whack_process(e.whackee.proc_va);
-    break;
-  default:
-    assert(0);
-    break;
-  }
+  rm_install_entry((uintptr_t)pg | REVMAP_OWNER_PAGE, e);
 }
 
-void 
-rm_whack_mapping(struct Mapping *m)
+size_t
+rm_mapping_parents(Mapping *m, size_t max, Mapping **tbl, size_t *slot)
 {
-  RevMapBucket *b = rm_hash_mapping(m);
+  uintptr_t owner = (uintptr_t)m | REVMAP_OWNER_MAPPING;
+  size_t n = 0;
 
-  SpinHoldInfo shi = spinlock_grab(&b->lock);
+  SpinHoldInfo shi = spinlock_grab(rm_lock_for(owner));
 
-  RevMap *ent;
+  for (RevMap *blk = m->rmap; blk != NULL; blk = blk->next) {
+    for (size_t x = 0; x < ENTRIES_PER_REVMAP; x++) {
+      RevMapEntry *e = &blk->ents[x];
+      if ((e->target.raw & REVMAP_TARGET_TYPE_MASK) != REVMAP_TARGET_MAP_PTE)
+	continue;
 
-  for (ent = b->list; ent != NULL; ent = ent->next) {
-    for (int x = 0; x < ENTRIES_PER_REVMAP; x++) {
-      if (rm_match_mapping(ent->ents[x], m)) {
-	rm_do_whack(ent->ents[x]);
-	ent->ents[x].target.raw = 0;
-	ent->ents[x].whackee.pte.tbl = 0;
-	ent->ents[x].whackee.pte.slot = 0;
-	assert(ent->nvalid > 0);
-	ent->nvalid--;
+      if (n < max) {
+	tbl[n] = e->whackee.pte.tbl;
+	slot[n] = e->whackee.pte.slot;
       }
+      n++;
     }
   }
+
   spinlock_release(shi);
+  return n;
 }
 
-void 
-rm_whack_page(struct Page *pg)
+/** @brief Detach the chain for @p owner, whack it, and flush once. */
+static void
+rm_whack_owner(uintptr_t owner)
 {
-  RevMapBucket *b = rm_hash_page(pg);
+  RevMap **chain = rm_chain_for(owner);
 
-  SpinHoldInfo shi = spinlock_grab(&b->lock);
+  SpinHoldInfo shi = spinlock_grab(rm_lock_for(owner));
+  RevMap *detached = *chain;
+  *chain = 0;
 
-  RevMap *ent;
+  /* rm_reclaim() trusts a block that still names its owner to be on
+   * that owner's chain, so disown the blocks before dropping the
+   * lock. */
+  for (RevMap *blk = detached; blk != NULL; blk = blk->next)
+    blk->owner = 0;
 
-  for (ent = b->list; ent != NULL; ent = ent->next) {
-    for (int x = 0; x < ENTRIES_PER_REVMAP; x++) {
-      if (rm_match_page(ent->ents[x], pg)) {
-	rm_do_whack(ent->ents[x]);
-	ent->ents[x].target.raw = 0;
-	ent->ents[x].whackee.pte.tbl = 0;
-	ent->ents[x].whackee.pte.slot = 0;
-	assert(ent->nvalid > 0);
-	ent->nvalid--;
-      }
-    }
-  }
   spinlock_release(shi);
+
+  if (rm_whack_chain(detached))
+    rm_whack_flush();
+}
+
+void 
+rm_whack_mapping(struct Mapping *m)
+{
+  rm_whack_owner((uintptr_t)m | REVMAP_OWNER_MAPPING);
+}
+
+void 
+rm_whack_page(struct Page *pg)
+{
+  rm_whack_owner((uintptr_t)pg | REVMAP_OWNER_PAGE);
 }
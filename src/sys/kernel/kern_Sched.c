@@ -90,6 +90,7 @@ sched_abandon_transaction()
 
   /* It's official. Process is no longer running on this CPU. */
   MY_CPU(current) = 0;
+  atomic_write(&CUR_CPU->priority, 0);
 
   /// Call the HAL layer to find something useful to do.
   sched_low_level_yield();
@@ -116,15 +117,100 @@ sched_choose_next()
 {
   if (MY_CPU(current))
     return MY_CPU(current);
-  Process *p = rq_removeFront(&mainRQ);
+  Process *p = rq_removeFront(&rq_vec[CUR_CPU->id]);
+
+  /* Our own queue is empty. Before idling, see whether some other
+   * CPU has more work than it can get to. */
+  if (p == NULL)
+    p = rq_steal();
+
   if (p) {
     mutex_grab(&p->hdr.lock);
     p->onCPU = CUR_CPU;
+    atomic_write(&CUR_CPU->priority, p->priority);
   }
 
   return p;
 }
 
+void
+sched_load_schedule(Process *p)
+{
+  capability *cap = &p->state.schedule;
+  uint32_t prio = SCHED_PRIO_DEFAULT;
+  uint32_t quanta = SCHED_QUANTA_DEFAULT;
+
+  if (cap->type == ct_Schedule) {
+    uint32_t pp = cap->u1.protPayload;
+    prio = SCHED_PAYLOAD_PRIO(pp);
+    if (SCHED_PAYLOAD_QUANTA(pp))
+      quanta = SCHED_PAYLOAD_QUANTA(pp);
+  }
+
+  /* SchedCtl never fabricates an out of range band, but the
+   * capability may have come from a damaged image. */
+  if (prio >= SCHED_NBANDS)
+    prio = SCHED_NBANDS - 1;
+
+  p->priority = prio;
+  p->quanta = quanta;
+  p->sliceLeft = quanta;
+
+  if (p->onCPU)
+    atomic_write(&p->onCPU->priority, prio);
+}
+
+bool
+sched_tick(void)
+{
+  Process *p = MY_CPU(current);
+
+  if (atomic_read(&CUR_CPU->flags) & CPUFL_NEED_RESCHED) {
+    atomic_clear_bits(&CUR_CPU->flags, CPUFL_NEED_RESCHED);
+    if (p)
+      p->sliceLeft = p->quanta;
+    return true;
+  }
+
+  if (p == NULL)
+    return true;
+
+  if (p->sliceLeft > 1) {
+    p->sliceLeft--;
+    return false;
+  }
+
+  p->sliceLeft = p->quanta;
+  return true;
+}
+
+void
+sched_wakeup_preempt(CPU *cpu, uint32_t prio)
+{
+  if (prio <= atomic_read(&cpu->priority) || cpu->current == NULL)
+    return;
+
+  if (cpu != CUR_CPU) {
+    /// @bug This should send a reschedule IPI rather than waiting
+    /// for the remote CPU's next tick.
+    atomic_set_bits(&cpu->flags, CPUFL_NEED_RESCHED);
+    return;
+  }
+
+  /* Same treatment as a timer interrupt taken in the kernel: the
+   * current process goes to the back of its band when it next tries
+   * to return to user mode. */
+  if ((atomic_read(&cpu->flags) & CPUFL_WAS_PREEMPTED) == 0) {
+    atomic_set_bits(&cpu->current->issues, pi_Preempted);
+    atomic_set_bits(&cpu->flags, CPUFL_WAS_PREEMPTED);
+  }
+  else {
+    /* A preemption is already in flight, so this one would be
+     * lost. Catch it at the next tick instead. */
+    atomic_set_bits(&cpu->flags, CPUFL_NEED_RESCHED);
+  }
+}
+
 void
 sched_dispatch_something()
 {
@@ -143,6 +229,14 @@ sched_dispatch_something()
   // dispatch fails we will try again with the next candidate until we
   // manage to dispatch something.
 
+  // An interrupt that ends an idle period also brings us back here,
+  // so this is where idle time is charged.
+  if (MY_CPU(idleSince)) {
+    CUR_CPU->stats[cst_IdleCycles] += 
+      read_cycle_counter() - MY_CPU(idleSince);
+    MY_CPU(idleSince) = 0;
+  }
+
   for ( ;; ) {
     assert(local_interrupts_enabled());
     MY_CPU(current) = sched_choose_next();
@@ -150,6 +244,7 @@ sched_dispatch_something()
       proc_dispatch_current();
     else {
       printf("Idling current CPU\n");
+      MY_CPU(idleSince) = read_cycle_counter();
       IdleThisProcessor();
     }
   }
@@ -50,6 +50,8 @@ kernel_main(void)
 
   obhdr_stallQueueInit();
 
+  interval_init();
+
   assert(local_interrupts_enabled());
 
   cache_init();
@@ -28,6 +28,8 @@
 #include <kerninc/mutex.h>
 #include <kerninc/CPU.h>
 #include <kerninc/Sched.h>
+#include <kerninc/event.h>
+#include <kerninc/IPI.h>
 #include <stdbool.h>
 
 /**
@@ -118,9 +120,17 @@ mutex_grab(mutex_t *mtx)
 	  (atomic_read(&cpu->priority) == atomic_read(&CUR_CPU->priority) &&
 	  cpu->id > CUR_CPU->id)) {
 	/// @bug need to be more fair in same-priority case
-	atomic_write(&cpu->shouldDefer, oldval);
+	if (atomic_read(&cpu->shouldDefer) != oldval) {
+	  LOG_EVENT(ety_LockDefer, mtx, cpu->id, oldval);
+	  cpu_count(cst_LockDefers);
+	  atomic_write(&cpu->shouldDefer, oldval);
+	}
       }
     }
+
+    /* The holder may be waiting for us to answer a TLB shootdown,
+     * and we may have come here with interrupts disabled. */
+    ipi_process();
   }
 }
 
@@ -184,5 +194,8 @@ spinlock_grab(spinlock_t *spl)
 
       return shi;
     }
+
+    /* The holder may be waiting for us to answer a TLB shootdown. */
+    ipi_process();
   }
 }
@@ -31,6 +31,7 @@
 #include <hal/kerntypes.h>
 #include <hal/cpu.h>
 #include <kerninc/ccs.h>
+#include <kerninc/IPI.h>
 
 /** @brief Process executing on current CPU has been preempted. */
 #define CPUFL_WAS_PREEMPTED 0x1
@@ -44,8 +45,41 @@
  */
 #define CPUFL_NEED_WAKEUP  0x2
 
+/** @brief A process that outranks the current one has been made
+ * ready on this CPU.
+ *
+ * Set by sched_wakeup_preempt() and consumed by sched_tick().
+ */
+#define CPUFL_NEED_RESCHED 0x4
+
+/** @brief Indices of the per-CPU event counters.
+ *
+ * These must match the KernLog.cpuStat enumeration.
+ */
+enum CpuStat {
+  /** @brief Capability invocations started on this CPU. */
+  cst_Invocations,
+  /** @brief Page faults taken on this CPU. */
+  cst_PageFaults,
+  /** @brief Requests by this CPU that another CPU defer a lock. */
+  cst_LockDefers,
+  /** @brief Single transmap entries flushed from the TLB. */
+  cst_TransmapFlushes,
+  /** @brief Cycle counter ticks spent idle. */
+  cst_IdleCycles,
+  cst_NUM_STATS
+};
+
 struct Process;
 
+/** @brief Per-CPU state.
+ *
+ * Each CPU structure starts on a cache line of its own. The fields
+ * that other CPUs write, or that they poll while this CPU is busy,
+ * are gathered at the end on separate lines, so that a lock deferral
+ * or a preemption request does not take the line holding the fields
+ * this CPU uses on every trap.
+ */
 typedef struct CPU {
   /** @brief Mutex value for locks held by current process on this
    * CPU.
@@ -71,28 +105,12 @@ typedef struct CPU {
   /** @brief Per-CPU kernel stack reload address. */
   kva_t     topOfStack;
 
-  /** @brief If shouldDefer matches procMutexValue, this CPU has been
-   * asked to get out of the way if it cannot aquire a mutex immediately.
-   */
-  Atomic32_t shouldDefer;
-
   /** @brief true iff this CPU is present. */
   bool       present;
 
   /** @brief true iff this CPU has been started. */
   bool       active;
 
-  /** @brief Priority of current process on CPU */
-  Atomic32_t   priority;
-
-  /** @brief Per-CPU action flags for this CPU.
-   * 
-   * Zero on kernel entry. Bits set in various places if the
-   * preemption timer goes off, and/or if we need to do wakeup
-   * processing on the sleeping process queue.
-   */
-  Atomic32_t  flags;
-
   /** @brief Mapping context currently loaded on this CPU.
    *
    * Corner case: if the CPU has not yet been IPL'd, this is the map
@@ -122,7 +140,52 @@ typedef struct CPU {
    * This needs to be manipulated with interrupts disabled.
    */
   struct VectorInfo *wakeVectors;
-} CPU;
+
+  /** @brief TLB invalidations queued by this CPU.
+   *
+   * Other CPUs read this while tlbWaiting is non-zero, so it must not
+   * change until they are done. */
+  TlbBatch tlbBatch;
+
+  /** @brief Cycle counter value when this CPU last went idle, or
+   * zero if it is not idle. */
+  uint64_t idleSince;
+
+  /** @brief Event counters, indexed by CpuStat.
+   *
+   * Only this CPU updates them, so no atomics are used. Readers on
+   * other CPUs may see a slightly stale value. */
+  uint64_t stats[cst_NUM_STATS];
+
+  /* Fields below this point are written by other CPUs. */
+
+  /** @brief If shouldDefer matches procMutexValue, this CPU has been
+   * asked to get out of the way if it cannot aquire a mutex immediately.
+   */
+  Atomic32_t shouldDefer CACHE_LINE_ALIGNED;
+
+  /** @brief Priority of current process on CPU.
+   *
+   * Written by this CPU, but read by every CPU contending for a lock
+   * that this CPU holds, so it lives with shouldDefer. */
+  Atomic32_t   priority;
+
+  /** @brief Per-CPU action flags for this CPU.
+   * 
+   * Zero on kernel entry. Bits set in various places if the
+   * preemption timer goes off, and/or if we need to do wakeup
+   * processing on the sleeping process queue.
+   */
+  Atomic32_t  flags;
+
+  /** @brief Bitmap of CPUs that have posted an IPI request to this
+   * CPU which it has not yet carried out. */
+  Atomic32_t ipiFrom;
+
+  /** @brief Bitmap of CPUs that have not yet carried out this CPU's
+   * tlbBatch. */
+  Atomic32_t tlbWaiting;
+} CACHE_LINE_ALIGNED CPU;
 
 /* Guaranteed <= MAX_NCPU, defined in hal/machine.h */
 extern size_t cpu_ncpu;
@@ -148,6 +211,13 @@ void cpu_wake_vectors();
 
 #define MY_CPU(id) CUR_CPU->id
 
+/** @brief Count one occurrence of event @p which on the current CPU. */
+static inline void
+cpu_count(enum CpuStat which)
+{
+  CUR_CPU->stats[which]++;
+}
+
 /** @brief Return the CPU structure pointer (entry in cpu vector) of
  * the currently executing processor.
  *
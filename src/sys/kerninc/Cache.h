@@ -106,9 +106,6 @@ typedef struct Cache_s {
 
 extern Cache_s Cache;
 
-enum { NUM_OBHASH_BUCKETS = 1024 };
-ObjectHeader *obhash[NUM_OBHASH_BUCKETS];
-
 /** @brief Estimate the sizes on the various kernel object caches for
  * all caches that have not already been sized by the machine
  * dependent initialization code, returning results by side-effecting
@@ -171,8 +168,13 @@ extern void cache_init(void);
 /**
  * @brief Preload a mkimage-generated image at physaddr @p base with
  * size @p size.  If image loading fails, we will panic.
+ *
+ * The frames holding the image's data and capability pages are
+ * adopted into the page cache in place rather than copied. Returns
+ * the physical address just past the adopted frames. The caller
+ * should release only the module memory from that point on.
  */
-extern void cache_preload_image(const char *name, kpa_t base, size_t size);
+extern kpa_t cache_preload_image(const char *name, kpa_t base, size_t size);
 
 /** @brief Allocate a Page Header Frame */
 extern struct Page *cache_alloc_page_header(void);
@@ -188,8 +190,12 @@ extern struct Process *cache_alloc_process(void);
 extern struct OTEntry *cache_alloc_OTEntry(void);
 /** @brief Allocate a Depend structure */
 extern struct Depend *cache_alloc_Depend(void);
+/** @brief Return a Depend structure to the free list */
+extern void cache_free_Depend(struct Depend *);
 /** @brief Allocate a RevMap structure */
 extern struct RevMap *cache_alloc_RevMap(void);
+/** @brief Return a RevMap structure to the free list */
+extern void cache_free_RevMap(struct RevMap *);
 
 extern struct ObjectHeader *cache_alloc(ObType ty);
 
@@ -84,6 +84,15 @@
  * Are implicated by this depend entry. That is: each slot in this
  * GPT potentially defines 2^l2slotSpan PTEs.
  *
+ * @section LargeDepends Behavior with Large Pages
+ *
+ * A large page PTE is produced by a whole subtree of GPTs, each of
+ * whose slots defines only part of one PTE. Such entries set @p
+ * withinPTE, and every slot in @p slotMask then implicates the single
+ * PTE at @p basePTE. One entry per GPT covers all of its slots that
+ * lie within the large page, so the bookkeeping is per large page
+ * rather than per small page.
+ *
  * @section SoftDepends Behavior with Soft Translation
  *
  * If MAPPING_INDEX_BITS is zero, then the target
@@ -146,6 +155,9 @@ struct DependEntry {
   /** @brief Number of PTEs generated from each GPT slot. */
   uint32_t   l2slotSpan : L2_MAPPING_INDEX_BITS;
   uint32_t   basePTE : MAPPING_INDEX_BITS;
+  /** @brief Every slot in slotMask implicates just the PTE at @p
+   * basePTE, which is a large page. @p l2slotSpan is zero. */
+  uint32_t   withinPTE : 1;
 #else
   /**
    * If HIEARCHICAL_MAP_INDEX_BITS is zero, we have a soft-translated
@@ -159,8 +171,14 @@ typedef struct DependEntry DependEntry;
 
 enum { ENTRIES_PER_DEPEND = 15 };
 
+/** @brief A block of depend entries, all produced by a single GPT.
+ *
+ * Blocks are chained from GPT::depend, and are protected by the lock
+ * of the owning GPT.
+ */
 struct Depend {
-  struct Depend *next;	/**< @brief Next depend entry in chain */
+  struct Depend *next;	/**< @brief Next block for the same GPT */
+  struct GPT	*owner;	/**< @brief Owning GPT, or NULL if free */
   size_t	nvalid; /**< @brief number of valid entries */
   DependEntry	ents[ENTRIES_PER_DEPEND]; /**< @brief entries */
 };
@@ -173,17 +191,27 @@ typedef struct Depend Depend;
  * Preconditions: The GPT referenced in @p toInstall must be locked.
  *
  * Postcondition: The requested depend entry is in the depend table.
+ *
+ * If no Depend block is free, a block is reclaimed from some other
+ * GPT, invalidating the mappings it describes.
  */
 void depend_install(DependEntry toInstall);
 
 /**
  * @brief Invalidate all depend entries associated with the GPT @p gpt.
+ *
+ * The GPT must be locked. Its Depend blocks are returned to the free
+ * list. Remembered memory walks are discarded as well.
  */
 void depend_invalidate(struct GPT *gpt);
 
 /**
  * @brief Invalidate all depend entries associated with slot @p slot in 
  * the GPT @p gpt.
+ *
+ * The GPT must be locked. Remembered memory walks are discarded as
+ * well. May abandon the current transaction, so this must be called
+ * before the commit point.
  */
 void depend_invalidate_slot(struct GPT *gpt, size_t slot);
 
@@ -193,7 +221,18 @@ void depend_invalidate_slot(struct GPT *gpt, size_t slot);
  * a particular @p slot in a DependEntry.
  *
  * If @p slot is DEPEND_INVALIDATE_ALL, all slots are invalidated.
+ *
+ * This does @em not flush the TLB. Callers must follow a batch of
+ * depend_entry_invalidate() calls with depend_entry_flush().
  */
 __hal void depend_entry_invalidate(const DependEntry *entry, int slot);
 
+/** @brief HAL function to flush stale translations after a batch of
+ * depend_entry_invalidate() calls, on every CPU that may hold them.
+ *
+ * If @p mayAbandon is true, the current transaction may be abandoned
+ * once the flush is done. See ipi_tlb_shootdown().
+ */
+__hal void depend_entry_flush(bool mayAbandon);
+
 #endif /* __KERNINC_DEPEND_H__ */
@@ -47,6 +47,9 @@ freelist_alloc(FreeListHeader *flh)
   FreeListElem *next = atomic_read_ptr(&flh->next);
 
   for(;;) {
+    if (next == 0)
+      return 0;
+
     FreeListElem *was = CAS_PTR(FreeListElem *, &flh->next, next, next->next);
     if (was == next) {
       if (next) next->next = 0;
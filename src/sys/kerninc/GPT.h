@@ -34,6 +34,17 @@
 struct GPT {
   MemHeader         mhdr;
 
+  /** @brief Chain of depend blocks produced by this GPT.
+   *
+   * Protected by the GPT's lock. See kern_Depend.c. */
+  struct Depend     *depend;
+
+  /** @brief Advanced whenever a walk through this GPT may have
+   * changed.
+   *
+   * Protected by the GPT's lock. See memwalk_cached(). */
+  uint32_t          walkGen;
+
   ExGPT             state;
 };
 typedef struct GPT GPT;
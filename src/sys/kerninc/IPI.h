@@ -24,6 +24,13 @@
  * @brief Inter-processor interrupt messages
  */
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <hal/kerntypes.h>
+
+struct Mapping;
+
 /* Invalidate TLB */
 /* Invalidate VA in TLB */
 /* Relinquish running process */
@@ -59,6 +66,7 @@
  *
  * REQUIREMENTS:
  *   CPU X may only send IPIs when it is permissable for X to Yield.
+ *   (Relaxed for TLB shootdown: see below.)
  *
  *   No IPI processing action may send an IPI.
  *
@@ -93,6 +101,17 @@
  *  the time A gets an incoming IPI hardware interrupt and the time A
  *  processes the IPI request and responds.
  *
+ *  TLB shootdown is sent from a few places that cannot yield: while
+ *  pgtable_alloc() holds ageListLock and a productsLock, and while
+ *  memhdr_invalidate_products() and memhdr_destroy_products() hold a
+ *  productsLock. This is tolerated because the shootdown wait never
+ *  yields and takes no locks, and because every CPU spinning for a
+ *  mutex or a spinlock answers pending IPIs from its spin loop even
+ *  with interrupts disabled, so whoever wants the lock we hold will
+ *  still acknowledge us. Such senders pass mayAbandon = false.
+ *  Shootdowns on behalf of GPT slot changes are issued before the
+ *  commit point and may abandon.
+ *
  *  In the case of the "relinquish running process" IPI, completion
  *  implies that the requestor now has exclusive dominion over the
  *  requested process structure. It is incumbent upon the requestor to
@@ -101,4 +120,111 @@
  *  IPI completion wait loop if we are yielding from within the
  *  completion loop.
  */
+
+/** @brief Number of addresses a TLB batch will invalidate one at a
+ * time before it gives up and flushes the whole TLB. */
+#define TLB_BATCH_MAX  32
+
+/** @brief TlbBatch::count value meaning "flush the whole TLB". */
+#define TLB_BATCH_FULL (TLB_BATCH_MAX + 1)
+
+/** @brief TLB invalidations queued by one CPU.
+ *
+ * PTE clears made while whacking a RevMap chain or a set of depend
+ * entries are recorded here, and the TLB flush is deferred until the
+ * end of the operation. ipi_tlb_shootdown() then carries out the
+ * batch on the current CPU and on every CPU that might have cached
+ * one of the cleared entries.
+ *
+ * The batch also remembers which top-level Mapping the cleared
+ * entries were reachable from, so that CPUs running some other
+ * address space are left alone.
+ */
+typedef struct TlbBatch {
+  /** @brief Number of valid entries in va[], or TLB_BATCH_FULL. */
+  uint32_t count;
+
+  /** @brief True if the queued entries may be reachable from more
+   * than one top-level Mapping, or from one we could not identify. */
+  bool anyMap;
+
+  /** @brief Top-level Mapping the queued entries are reachable from,
+   * if anyMap is false. */
+  struct Mapping *map;
+
+  /** @brief The full flush must include global entries, and must be
+   * run on every CPU whatever it has loaded. */
+  bool global;
+
+  /** @brief Addresses to invalidate. */
+  kva_t va[TLB_BATCH_MAX];
+} TlbBatch;
+
+/** @brief Note that queued entries are reachable from @p top.
+ *
+ * A NULL @p top means the caller could not tell. */
+static inline void
+tlb_batch_addmap(TlbBatch *tb, struct Mapping *top)
+{
+  if (top == NULL || (tb->map != NULL && tb->map != top))
+    tb->anyMap = true;
+  else
+    tb->map = top;
+}
+
+/** @brief Queue invalidation of @p va, reached through @p top. */
+static inline void
+tlb_batch_addva(TlbBatch *tb, struct Mapping *top, kva_t va)
+{
+  if (tb->count < TLB_BATCH_MAX)
+    tb->va[tb->count++] = va;
+  else
+    tb->count = TLB_BATCH_FULL;
+
+  tlb_batch_addmap(tb, top);
+}
+
+/** @brief Queue a whole-TLB flush on CPUs that have @p top loaded. */
+static inline void
+tlb_batch_addall(TlbBatch *tb, struct Mapping *top)
+{
+  tb->count = TLB_BATCH_FULL;
+  tlb_batch_addmap(tb, top);
+}
+
+/** @brief Queue a flush of every TLB entry, kernel entries included,
+ * on all CPUs. */
+static inline void
+tlb_batch_addglobal(TlbBatch *tb)
+{
+  tb->count = TLB_BATCH_FULL;
+  tb->anyMap = true;
+  tb->global = true;
+}
+
+/** @brief Carry out the current CPU's TlbBatch and empty it.
+ *
+ * The batch is run locally, and then on every other active CPU whose
+ * curMap might hold one of the stale translations. Does not return
+ * until all of them have acknowledged.
+ *
+ * The wait cannot be cut short, since the targets read the batch in
+ * place and may still hold the stale translations. If some other
+ * CPU asked us to give up our locks while we waited and @p
+ * mayAbandon is true, the current transaction is abandoned once the
+ * batch is done. Callers that are past their commit point, or that
+ * hold a spinlock, must pass false.
+ */
+void ipi_tlb_shootdown(bool mayAbandon);
+
+/** @brief Carry out the requests other CPUs have posted to the
+ * current CPU.
+ *
+ * Takes no locks and never yields, so this is safe to call from the
+ * IPI interrupt handler and from spin loops. */
+void ipi_process(void);
+
+/** @brief Raise the IPI interrupt on CPU @p cpu. */
+__hal void ipi_send(cpuid_t cpu);
+
 #endif /* __KERNINC_IPI_H__ */
@@ -26,6 +26,7 @@
 
 #include <coyotos/coytypes.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 struct Process;
 
@@ -41,8 +42,29 @@ typedef struct Interval {
  * run the wakeup processing logic on the way out of the kernel.
  */
 void interval_update_now(Interval);
+
+/** @brief Wake every sleeper whose wake time has passed. */
 void interval_do_wakeups();
 Interval interval_now();
+
+/** @brief Put @p p to sleep until its wakeTime.
+ *
+ * Returns if the wake time has already passed. Otherwise @p p is
+ * placed on the sleep queue and the current transaction is
+ * abandoned; the invocation is restarted once @p p is woken.
+ */
 void interval_delay(struct Process *p);
 
+/** @brief Return in @p when the earliest time at which a sleeper may
+ * be due.
+ *
+ * Returns false if nobody is sleeping. A timer that can be programmed
+ * in one-shot mode may use this to avoid taking ticks that have
+ * nothing to do. The answer may be early, but is never late.
+ */
+bool interval_next_wakeup(Interval *when);
+
+/** @brief Initialize the sleep queues. */
+void interval_init(void);
+
 #endif /* __KERNINC_INTERVALCLOCK_H__ */
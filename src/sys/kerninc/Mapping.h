@@ -60,9 +60,19 @@ typedef struct Mapping {
    * linkage structure to facilitate removal. */
   struct Mapping *nextProduct;
 
+  /** @brief Next mapping structure in the same bucket of the HAL's
+   * product index, if it has one. */
+  struct Mapping *nextHash;
+
   /** @brief Pointer to the object that produced this page table. */
   MemHeader *producer;
 
+  /** @brief Reverse map entries for PTEs and Processes that name
+   * this mapping.
+   *
+   * Protected by the revmap stripe lock. See kern_RevMap.c. */
+  struct RevMap *rmap;
+
   /** @brief Virtual address bits that must match in order for this
    * table to be appropriate for use.
    */
@@ -93,14 +103,20 @@ typedef struct Mapping {
 #endif /* MAPPING_INDEX_BITS */
 } Mapping;
 
-/** @brief Flush the TLB on all processors */
+/** @brief Flush user-mode entries from the TLB on all processors.
+ *
+ * Kernel mappings that the hardware treats as global survive. */
 __hal void global_tlb_flush();
 
+/** @brief Flush the entire TLB on all processors, including global
+ * kernel entries.
+ *
+ * Needed only when a kernel mapping is changed or removed. */
+__hal void global_tlb_flush_kernel();
+
 /** @brief Flush @p va from the TLB on all processors */
 __hal void global_tlb_flushva(kva_t va);
 
 __hal extern Mapping KernMapping;
 
-__hal extern spinlock_t mappingListLock;
-
 #endif /* __KERNINC_MAPPING_H__ */
@@ -89,6 +89,12 @@ typedef struct MemWalkResults {
    * collected here because most callers need to know them.
    */
   uint8_t cum_restr;
+  /** @brief Address the walk was performed for.
+   *
+   * Used by memwalk_next() to decide how much of the walk can be
+   * reused for a nearby address.
+   */
+  coyaddr_t addr;
   /** @brief Array of MemWalkEntrys describing the results of the walk.  
    * 
    * Only the first @p count entries are valid.  Each describes a
@@ -100,6 +106,53 @@ typedef struct MemWalkResults {
   MemWalkEntry ents[MEMWALK_MAX];
 } MemWalkResults;
 
+struct GPT;
+
+/** @brief Number of recent walks remembered per MemWalkCache. */
+#define MEMWALK_CACHE_NENT  2
+
+/** @brief Number of leading GPT traversals remembered per walk. */
+#define MEMWALK_CACHE_DEPTH 4
+
+/** @brief A remembered walk prefix.
+ *
+ * Holds the leading GPT traversals of an earlier walk. A traversal
+ * is valid only while the walkGen of its GPT still matches the value
+ * recorded in @p gen.
+ */
+typedef struct MemWalkCacheEntry {
+  /** @brief walkGen of the GPT in each of ents when the entry was
+   * filled. */
+  uint32_t gen[MEMWALK_CACHE_DEPTH];
+
+  /** @brief Number of valid entries in ents. */
+  uint8_t count;
+
+  /** @brief l2g of the base capability (unclipped). */
+  uint8_t rootl2g;
+
+  /** @brief Address of the walk that filled the entry. */
+  coyaddr_t addr;
+
+  MemWalkEntry ents[MEMWALK_CACHE_DEPTH];
+} MemWalkCacheEntry;
+
+/** @brief Software translation cache for memwalk_cached().
+ *
+ * Each Process carries one of these for its address space. Entries
+ * name GPTs directly, so each traversal is only trusted while its
+ * GPT's walk generation is unchanged. The generation is advanced by
+ * memwalk_cache_invalidate(), which the depend_invalidate*() hooks
+ * call whenever that GPT is altered or removed. A change to one GPT
+ * therefore leaves walks that do not pass through it alone.
+ */
+typedef struct MemWalkCache {
+  /** @brief Entry to replace on the next miss. */
+  uint32_t victim;
+
+  MemWalkCacheEntry ent[MEMWALK_CACHE_NENT];
+} MemWalkCache;
+
 /** l2stop value to walk the memory tree to a leaf Page or CapPage */
 #define EXTENDED_MEMWALK_L2STOP_TO_PAGE 0
 
@@ -116,6 +169,44 @@ extern coyotos_Process_FC memwalk(capability *base,
 				  bool forWrite,
 				  MemWalkResults *results /* OUT */);
 
+/**
+ * @brief Walk the memory tree rooted at @p base for offset @p addr,
+ * reusing the prefix of the previous walk recorded in @p results.
+ *
+ * @p results must either have a zero @p count or hold the results of
+ * an earlier memwalk() of the same @p base within the current
+ * transaction. Leading GPT traversals that must be identical for
+ * @p addr are kept, and the walk is restarted from the deepest such
+ * GPT. Callers touching consecutive pages of one address space
+ * (string transfer, in particular) therefore re-prepare only the
+ * last level or two of the tree per page.
+ */
+extern coyotos_Process_FC memwalk_next(capability *base,
+				       coyaddr_t addr,
+				       bool forWrite,
+				       MemWalkResults *results /* IN/OUT */);
+
+/**
+ * @brief Walk the memory tree rooted at @p base for offset @p addr,
+ * starting from a prefix remembered in @p mwc where possible.
+ *
+ * Results are identical to memwalk(). The objects along any reused
+ * prefix are locked exactly as memwalk() would have locked them. On
+ * return, @p mwc has been updated to remember this walk.
+ */
+extern coyotos_Process_FC memwalk_cached(MemWalkCache *mwc,
+					 capability *base,
+					 coyaddr_t addr,
+					 bool forWrite,
+					 MemWalkResults *results /* OUT */);
+
+/** @brief Discard every remembered walk prefix that passes through
+ * @p gpt, which must be locked. */
+extern void memwalk_cache_invalidate(struct GPT *gpt);
+
+/** @brief Initialize an empty walk cache. */
+extern void memwalk_cache_init(MemWalkCache *mwc);
+
 /**
  * @brief Variant of memwalk that knows how to stop early. 
  * 
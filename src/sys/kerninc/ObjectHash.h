@@ -22,6 +22,21 @@
 
 #include <kerninc/ObjectHeader.h>
 
+/** @brief Return the number of bytes of heap that obhash_init() will
+ * need for a table sized to hold @p nObjects objects.
+ *
+ * Called from cache_estimate_sizes() so that the table storage can be
+ * accounted for before page space is allocated.
+ */
+extern size_t obhash_estimate_bytes(size_t nObjects);
+
+/** @brief Allocate and initialize the object hash table.
+ *
+ * The table is sized for @p nObjects objects. This must be called
+ * before the first call to obhash_insert().
+ */
+extern void obhash_init(size_t nObjects);
+
 /** @brief Grab the appropriate bucket mutex for the object type and
  * OID. */
 HoldInfo
@@ -65,6 +80,10 @@ extern void obhash_insert(ObjectHeader *ob);
  * table if found, returning the current or snapshot version as
  * indicated by @p wantSnapshot.
  *
+ * The caller need not hold the bucket mutex. The chain is walked
+ * without it, and the walk is validated against concurrent inserts
+ * and removes before the result is returned.
+ *
  * If @p wantSnapshot is set, the @em first matching object marked
  * "snapshot" will be returned, else the @em first matching object
  * marked "current" will be returned.
@@ -57,7 +57,9 @@ enum {
  * @li
  *    @p ageLink, which is protected by the ObFrameCache lock field.
  * @li
- *    @p next, which is protected by the obhash mutex for (@p ty, @p oid)
+ *    @p next, which is protected by the obhash mutex for (@p ty, @p
+ *    oid). It is read without that mutex by obhash_lookup(), which
+ *    validates the walk afterwards.
  * @li
  *    @p ty and @p oid, which are protected by @p lock, but cannot change
  *    as long as the object is on an obhash chain.
@@ -138,17 +140,26 @@ typedef struct ObjectHeader {
  *
  * @section Locking.
  * 
- * The @p products field is protected by a global products lock.
+ * The @p products field, and the producer linkage of every Mapping
+ * on it, are protected by @p productsLock.
  */
 typedef struct MemHeader {
   ObjectHeader hdr;
 
+  /** @brief Protects @p products. */
+  spinlock_t productsLock;
+
   struct Mapping *products;
 } MemHeader ;
 
 typedef struct Page {
   MemHeader mhdr;
 
+  /** @brief Reverse map entries for PTEs that name this page.
+   *
+   * Protected by the revmap stripe lock. See kern_RevMap.c. */
+  struct RevMap *rmap;
+
   /** @brief Physical address of page */
   kpa_t  pa;
 } Page;
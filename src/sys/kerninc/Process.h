@@ -33,6 +33,8 @@
 #include <kerninc/CPU.h>
 #include <kerninc/Sched.h>
 #include <kerninc/Interval.h>
+#include <kerninc/MemWalk.h>
+#include <kerninc/event.h>
 #include <obstore/Process.h>
 #include <idl/coyotos/Process.h>
 
@@ -137,6 +139,22 @@ struct Process {
 
   cpuid_t           lastCPU;
 
+  /** @brief Priority band, taken from the Schedule capability.
+   *
+   * Selects which band of a ReadyQueue this process goes on. Always
+   * less than SCHED_NBANDS.
+   */
+  uint32_t          priority;
+
+  /** @brief Time slice length in ticks, from the Schedule capability. */
+  uint32_t          quanta;
+
+  /** @brief Ticks left in the current time slice.
+   *
+   * Only touched by the CPU that the process is running on.
+   */
+  uint32_t          sliceLeft;
+
   /** @brief Ready queue to go on when we wake up.
    *
    * A process can have different scheduling clases. Depending on the
@@ -173,10 +191,26 @@ struct Process {
 
   struct Mapping    *mappingTableHdr;
 
+  /** @brief Recent walks of this process's address space.
+   *
+   * Protected by the process lock. The page fault path also uses it
+   * while running as this process. */
+  MemWalkCache      walkCache;
+
   /** @brief Stall queue for all processes waiting to send to this
    * one. */
   StallQueue        rcvWaitQ;
 
+  /** @brief Receiver whose wakeup this process is holding, if any.
+   *
+   * When a receiver enters an open wait it wakes only its longest
+   * waiting sender, and records itself here. The sender clears this
+   * once a send to that receiver commits (see
+   * proc_consume_handoff()). If the sender gives up on the send for
+   * any other reason, the wakeup is passed on to the next sender (see
+   * proc_release_handoff()). */
+  struct Process   *rcvHandoff;
+
   /** @brief Non-zero when we are in an extended IPC transaction with
    * a peer.
    *
@@ -210,9 +244,42 @@ process_from_link(Link *l)
 
 extern Process *proc_ProcessCache;
 
+/** @brief Pass on a receiver wakeup that @p p did not use.
+ *
+ * Waking one sender too many is harmless, since it will just go back
+ * to sleep, so this need not check whether the receiver is still
+ * receiving.
+ */
+static inline void
+proc_release_handoff(Process *p)
+{
+  Process *rcvr = p->rcvHandoff;
+
+  if (rcvr) {
+    p->rcvHandoff = NULL;
+    sq_WakeOne(&rcvr->rcvWaitQ, rcvr);
+  }
+}
+
+/** @brief Note that @p p has delivered a message to @p rcvr.
+ *
+ * Called once the send has committed. If @p p was holding a wakeup
+ * from @p rcvr, that wakeup has now been used.
+ */
+static inline void
+proc_consume_handoff(Process *p, Process *rcvr)
+{
+  if (p && p->rcvHandoff == rcvr)
+    p->rcvHandoff = NULL;
+}
+
 static inline void
 proc_SetFault(Process *p, uint32_t code, uva_t faultInfo)
 {
+  LOG_EVENT(ety_ProcFault, p, code, faultInfo);
+
+  proc_release_handoff(p);
+
   p->state.faultCode = code;
   p->state.faultInfo = faultInfo;
   atomic_set_bits(&p->issues, pi_Faulted);
@@ -280,6 +347,7 @@ struct MemWalkResults;
 
 void proc_deliver_memory_fault(Process *p,
 			       coyotos_Process_FC fc, uintptr_t addr, 
+			       bool forWrite,
 			       const struct MemWalkResults * const mwr);
 
 /** @brief Ensure that it is safe to manipulate state of an already-locked
@@ -346,6 +414,54 @@ proc_findDataPage(Process *p, uintptr_t addr, bool forWriting,
 		  bool nonBlock,
 		  struct FoundPage * /*OUT*/ results);
 
+/** @brief Locate the Page in Process @p p's address space at
+ * address @p addr, reusing the walk left in @p mwr by a previous
+ * call.
+ *
+ * Behaves as proc_findDataPage(). @p mwr must have a zero @p count on
+ * the first call; later calls within the same transaction revisit
+ * only the part of the memory tree that differs for @p addr. Use this
+ * when touching several pages of the same address space in a row.
+ */
+coyotos_Process_FC
+proc_findNextDataPage(Process *p, uintptr_t addr, bool forWriting,
+		      bool nonBlock,
+		      struct MemWalkResults *mwr /* IN/OUT */,
+		      struct FoundPage * /*OUT*/ results);
+
+/** @brief Most pages a CopyoutArea can describe. */
+#define COPYOUT_MAX_PAGES 2
+
+/** @brief Destination of a copyout whose pages have been located,
+ * locked and dirtied ahead of the commit point.
+ */
+typedef struct CopyoutArea {
+  uintptr_t va;
+  size_t npage;
+  struct Page *pg[COPYOUT_MAX_PAGES];
+} CopyoutArea;
+
+/** @brief Prepare up to @p len bytes at @p va in the address space
+ * of @p p to be written after the commit point.
+ *
+ * Used by kernel operations that return bulk data at the receiver's
+ * rcvPtr. Returns the number of leading bytes that can be written,
+ * which is less than @p len if some page is not present and writable
+ * or does not fit in @p area. Never faults. @p mwr is passed to
+ * proc_findNextDataPage(), and must have a zero @p count on the first
+ * call.
+ */
+size_t
+proc_prepare_copyout(Process *p, uintptr_t va, size_t len,
+		     struct MemWalkResults *mwr /* IN/OUT */,
+		     CopyoutArea *area /* OUT */);
+
+/** @brief Copy @p len bytes from @p src to @p offset bytes into a
+ * prepared @p area. Safe after the commit point. */
+void
+proc_copyout_prepared(CopyoutArea *area, size_t offset, 
+		      const void *src, size_t len);
+
 /** @brief Resume execution of the current process.
  *
  * Returns to user land executing the current process. This is a
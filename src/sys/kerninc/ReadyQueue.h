@@ -32,20 +32,83 @@
 /**
  * @brief Ready queue structure.
  *
- * Ready Queues are simply Stall Queues with additional state.
+ * Ready Queues are simply Stall Queues with additional state. There
+ * is one ready queue per CPU, in rq_vec[] at the CPU's id. Each
+ * ready queue has one Stall Queue per priority band, and a bitmap of
+ * the bands that are non-empty so that the highest ready band can be
+ * found in constant time.
  */
 struct ReadyQueue {
-  StallQueue queue;
+  StallQueue band[SCHED_NBANDS];
+
+  /** @brief Bit N is set iff band[N] is non-empty.
+   *
+   * Bit N is only changed while holding band[N].qLock.
+   */
+  Atomic32_t nonEmpty;
+
+  /** @brief Number of processes on all bands.
+   *
+   * Updated under the lock of the band being changed, but read
+   * without any lock by idle CPUs looking for work to steal.
+   */
+  Atomic32_t count;
 };
 typedef struct ReadyQueue ReadyQueue;
 
-extern ReadyQueue mainRQ;
+/** @brief Per-CPU ready queues, indexed by CPU id. */
+extern ReadyQueue rq_vec[MAX_NCPU];
+
+/** @brief Initialize a ready queue. */
+extern void rq_init(ReadyQueue *queue);
+
+/** @brief Return true iff @p sq is the StallQueue of some ReadyQueue. */
+static inline bool
+rq_isReadyQueue(StallQueue *sq)
+{
+  return (sq >= &rq_vec[0].band[0] &&
+	  sq <= &rq_vec[MAX_NCPU-1].band[SCHED_NBANDS-1]);
+}
 
 extern void rq_add(ReadyQueue *queue, Process *process, bool at_front);
 extern void rq_remove(ReadyQueue *queue, Process *process);
 extern Process *rq_removeFront(ReadyQueue *queue);
 
-#define DEFREADYQUEUE(name) \
-  struct ReadyQueue name = { STALLQUEUE_INIT(name.queue) }
+/** @brief Pick the ready queue that @p process should go on.
+ *
+ * If @p at_front is set, the caller is handing its slice to @p
+ * process, and the current CPU's queue is chosen. Otherwise @p
+ * process goes back to the CPU it last ran on, provided that CPU is
+ * up and busy, so that it finds its cache and TLB state warm.
+ */
+extern ReadyQueue *rq_choose(Process *process, bool at_front);
+
+/** @brief Make @p process ready, on the queue chosen by rq_choose(). */
+static inline void
+rq_addReady(Process *process, bool at_front)
+{
+  rq_add(rq_choose(process, at_front), process, at_front);
+}
+
+/** @brief Return the highest non-empty band of @p queue, or -1 if
+ * @p queue is empty.
+ *
+ * The answer is unlocked, and may be stale by the time it is used.
+ */
+static inline int
+rq_topBand(ReadyQueue *queue)
+{
+  uint32_t bits = atomic_read(&queue->nonEmpty);
+  return bits ? (31 - __builtin_clz(bits)) : -1;
+}
+
+/** @brief Steal a process from some other CPU's ready queue.
+ *
+ * Called by a CPU whose own queue is empty. Picks the queue with the
+ * highest ready band, preferring the longest queue among equals, and
+ * takes from the back of that band. Returns NULL if there is nothing
+ * to steal.
+ */
+extern Process *rq_steal(void);
 
 #endif /* __KERNINC_STALLQUEUE_H__ */
@@ -38,9 +38,9 @@ struct Process;
  * compensates for the absence of the KeyKOS/EROS keychain, which
  * would have allowed us to use the depend table for this purpose.
  *
- * This data structure appears in the reverse map hash table, and is
- * indexed by the ObjectHeader address. If a PTE points to an object,
- * there is a corresponding (ObHdr *, pte *) pair in the reverse map.
+ * These entries are chained from the Page or Mapping structure that
+ * the PTE points at. If a PTE points to an object, there is a
+ * corresponding (ObHdr *, pte *) pair on that object's chain.
  */
 struct RevMapEntry {
   /** Pointer to either a Mapping structure or an ObjectHeader
@@ -93,8 +93,20 @@ typedef struct RevMapEntry RevMapEntry;
 
 enum { ENTRIES_PER_REVMAP = 15 };
 
+#define REVMAP_OWNER_TYPE_MASK	(uintptr_t)1
+#define REVMAP_OWNER_PTR_MASK	(~REVMAP_OWNER_TYPE_MASK)
+#define REVMAP_OWNER_PAGE	0
+#define REVMAP_OWNER_MAPPING	1
+
+/** @brief A block of reverse map entries for a single target.
+ *
+ * Blocks are chained from Page::rmap or Mapping::rmap.
+ */
 struct RevMap {
-  struct RevMap *next;  /**< @brief Next RevMap in chain */
+  struct RevMap *next;  /**< @brief Next RevMap for the same target */
+  /** @brief Tagged pointer to the owning Page or Mapping, or 0 if
+   * free. Low bit is REVMAP_OWNER_PAGE or REVMAP_OWNER_MAPPING. */
+  uintptr_t	owner;
   size_t	nvalid; /**< @brief number of valid entries */
   RevMapEntry	ents[ENTRIES_PER_REVMAP]; /**< @brief entries */
 };
@@ -124,13 +136,34 @@ void rm_install_pte_mapping(struct Mapping *map,
 void rm_install_pte_page(struct Page *page,
 			 struct Mapping *tbl, size_t slot);
 
-/** @brief Whack all of the revmap entries for a Mapping */
+/** @brief Whack all of the revmap entries for a Mapping.
+ *
+ * All of the PTEs are cleared first, followed by a single TLB flush. */
 void rm_whack_mapping(struct Mapping *);
-/** @brief Whack all of the revmap entries for a Page */
+/** @brief Whack all of the revmap entries for a Page
+ *
+ * All of the PTEs are cleared first, followed by a single TLB flush. */
 void rm_whack_page(struct Page *);
 
-/** @brief Whack the specified PTE. */
+/** @brief Find the PTEs that point at Mapping @p m.
+ *
+ * Stores the table and slot of up to @p max of them in @p tbl and @p
+ * slot, and returns how many there are in all, which may be more
+ * than @p max. Process top pointers are not counted.
+ */
+size_t rm_mapping_parents(struct Mapping *m, size_t max,
+			  struct Mapping **tbl, size_t *slot);
+
+/** @brief Whack the specified PTE.
+ *
+ * This does @em not flush the TLB. The invalidation is queued on the
+ * current CPU's TlbBatch, and callers must follow a batch of
+ * rm_whack_pte() calls with rm_whack_flush().
+ */
 __hal void rm_whack_pte(struct Mapping *, size_t slot);
+/** @brief Flush stale translations after a batch of rm_whack_pte(),
+ * on every CPU that may hold them. */
+__hal void rm_whack_flush(void);
 /** @brief Whack the specified Process top Mapping pointer. */
 __hal void rm_whack_process(struct Process *);
 
@@ -23,8 +23,37 @@
 /** @file 
  * @brief Interface to the kernel scheduler. */
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <kerninc/ccs.h>
 
+/** @brief Number of priority bands.
+ *
+ * Band 0 is the lowest priority. The per-queue band bitmap is a
+ * single Atomic32_t, so this can be at most 32.
+ */
+#define SCHED_NBANDS          32
+
+/** @brief Band used by processes that have no Schedule capability. */
+#define SCHED_PRIO_DEFAULT    8
+
+/** @brief Time slice, in ticks, used when the Schedule capability
+ * does not give one. */
+#define SCHED_QUANTA_DEFAULT  1
+
+/** @brief Largest time slice a Schedule capability can name. */
+#define SCHED_QUANTA_MAX      0xffffffu
+
+/* A Schedule capability carries its parameters in u1.protPayload:
+ * the band in the low 8 bits, and the slice length in the upper 24
+ * bits. A slice length of zero means SCHED_QUANTA_DEFAULT. */
+#define SCHED_PAYLOAD(prio, quanta) ((prio) | ((quanta) << 8))
+#define SCHED_PAYLOAD_PRIO(pp)      ((pp) & 0xffu)
+#define SCHED_PAYLOAD_QUANTA(pp)    ((pp) >> 8)
+
+struct Process;
+struct CPU;
+
 /** @brief Abandon kernel path and find something useful to do.
  *
  * Causes the current kernel path to be abandoned by forcibly
@@ -73,4 +102,30 @@ struct Process *sched_choose_next();
  */
 void sched_dispatch_something() NORETURN;
 
+/** @brief Load the priority and time slice of @p p from its Schedule
+ * capability.
+ *
+ * Called when the pi_Schedule issue is cleared. @p p must not be on
+ * a ready queue.
+ */
+void sched_load_schedule(struct Process *p);
+
+/** @brief Charge one timer tick to the current process.
+ *
+ * Returns true if the current process should be preempted, either
+ * because its time slice is used up or because a higher priority
+ * process has been made ready on this CPU.
+ */
+bool sched_tick(void);
+
+/** @brief Note that a process of priority @p prio has been made
+ * ready on @p cpu.
+ *
+ * If that outranks what @p cpu is running, arrange for the running
+ * process to be preempted. On the current CPU this takes effect at
+ * the end of the current transaction; a remote CPU notices at its
+ * next tick.
+ */
+void sched_wakeup_preempt(struct CPU *cpu, uint32_t prio);
+
 #endif /* __KERNINC_SCHED_H__ */
@@ -55,8 +55,20 @@ bool sq_IsEmpty(StallQueue* sq);
 /** @brief Wake all processes on this stall queue. */
 void sq_WakeAll(StallQueue* sq, bool verbose /*@ default false @*/);
 
+/** @brief Wake the process that has waited longest on this stall
+ * queue, if any, and return it.
+ *
+ * @p handoff is stored in the woken process's rcvHandoff field before
+ * it becomes runnable.
+ */
+struct Process *sq_WakeOne(StallQueue *sq, struct Process *handoff);
+
 void sq_EnqueueOn(StallQueue *sq);
 
+/** @brief Enqueue the current process as the longest waiter on the
+ * queue, so that it keeps its turn. */
+void sq_RequeueOn(StallQueue *sq);
+
 /** @brief remove a Process from the queue it is on, and put it on the
  * runqueue.
  *
@@ -65,11 +77,23 @@ void sq_EnqueueOn(StallQueue *sq);
  */
 void sq_Unsleep(struct Process *process);
 
+/** @brief Move @p process, which is asleep on @p sq, to the runqueue.
+ *
+ * For callers walking @p sq themselves. The caller must hold the
+ * qLock of @p sq.
+ */
+void sq_UnsleepLocked(StallQueue *sq, struct Process *process);
+
 static inline void sq_SleepOn(StallQueue *sq) {
   sq_EnqueueOn(sq);
   sched_abandon_transaction();
 }
 
+static inline void sq_ResleepOn(StallQueue *sq) {
+  sq_RequeueOn(sq);
+  sched_abandon_transaction();
+}
+
 
 #define STALLQUEUE_INIT(name) { SPINLOCK_INIT, { &name.q_head, &name.q_head } }
 #define DEFQUEUE(name) \
@@ -51,6 +51,10 @@
 #define CACHE_ALIGN  __attribute__((__aligned__(CACHE_LINE_SIZE), \
                                     __section__(".data.cachealign")))
 
+/** @brief Align a type or structure member to a cache line, without
+ * moving it to a special section. */
+#define CACHE_LINE_ALIGNED  __attribute__((__aligned__(CACHE_LINE_SIZE)))
+
 #define PAGE_ALIGN  __attribute__((__aligned__(COYOTOS_PAGE_SIZE), \
                                      __section__(".pagedata")))
 
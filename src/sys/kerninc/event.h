@@ -20,29 +20,56 @@
  * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
-#define ety_None         0
-#define ety_Halt         1
-#define ety_Trap         2
-#define ety_TrapRet      3
-#define ety_RunProc      4
-#define ety_PageFault    5
-#define ety_MapSwitch    6
-#define ety_RestartTX    7
-#define ety_AbandonTX    8
-#define ety_UserPreempt  9
-#define ety_KernPreempt  10
+/** @file
+ * @brief Kernel event trace.
+ *
+ * Each CPU logs into its own ring of EvtTraceRecords. The ring size
+ * is taken from the "evtrace=" command line option, and the records
+ * can be read back through KernLog.
+ */
+
+#include <coyotos/evtrace.h>
 
 #ifndef __ASSEMBLER__
 
+#include <stddef.h>
+
 #define LOG_EVENT(ety, v0, v1, v2) \
   event(ety, (uintptr_t) v0, (uintptr_t) v1, (uintptr_t) v2)
 
+/** @brief Requested per-CPU trace length, in records.
+ *
+ * Set from the command line. Zero selects the default. */
+extern size_t evt_trace_entries;
+
 #ifdef EVT_TRACE
 
 extern void
 event(uint8_t evtType, uintptr_t v0, uintptr_t v1, uintptr_t v2);
 extern void event_log_dump();
 
+/** @brief Allocate the per-CPU trace rings.
+ *
+ * Must be called after the CPUs have been counted and the heap is
+ * available, but before interrupts are enabled. Returns the number
+ * of pages of heap consumed, so that the caller can account for them
+ * when sizing the object cache.
+ */
+extern size_t event_init(void);
+
+/** @brief Return the number of records kept for each CPU. */
+extern size_t event_ring_entries(void);
+
+/** @brief Copy trace records for CPU @p cpu into @p out.
+ *
+ * Copies at most @p max records, starting with event number @p seq,
+ * or with the oldest retained event if @p seq has already been
+ * overwritten. Stores the number of the event following the last one
+ * copied in @p next, and returns the number of records copied.
+ */
+extern size_t event_read(size_t cpu, uint32_t seq, EvtTraceRecord *out,
+			 size_t max, uint32_t *next);
+
 #else /* EVT_TRACE */
 
 static inline void
@@ -52,6 +79,21 @@ event(uint8_t evtType, uintptr_t v0, uintptr_t v1, uintptr_t v2)
 static inline void event_log_dump()
 {
 }
+static inline size_t event_init(void)
+{
+  return 0;
+}
+static inline size_t event_ring_entries(void)
+{
+  return 0;
+}
+static inline size_t
+event_read(size_t cpu, uint32_t seq, EvtTraceRecord *out,
+	   size_t max, uint32_t *next)
+{
+  *next = seq;
+  return 0;
+}
 
 #endif /* EVT_TRACE */
 
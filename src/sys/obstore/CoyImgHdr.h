@@ -43,6 +43,28 @@ struct CoyImgBank {
 typedef struct CoyImgBank CoyImgBank;
 
 
+/// @brief Current image format version.
+///
+/// Version 1 images hold every page verbatim, in OID order. Version 2
+/// images store each distinct page content once as a @em frame and
+/// add a page table that maps every page and capability page OID to
+/// its frame. Data pages that are entirely zero have no frame at all.
+///
+/// A version 2 image is laid out as:
+///
+/// @li nFrame page frames. Frame 0 is page OID 0 (this header).
+/// @li The page table: one uint32_t per page OID, followed by one
+///     per capability page OID, padded to a page boundary.
+/// @li GPTs, endpoints and processes, exactly as in version 1.
+///
+/// Frames are numbered in order of first use within the page table,
+/// so a loader walking the table can tell the first reference to a
+/// frame from a duplicate by comparing against a running count.
+#define COYIMG_VERSION 2
+
+/// @brief Page table entry for a data page that is entirely zero.
+#define COYIMG_ZERO_PAGE 0xffffffffu
+
 /// @brief Information that we will pass to the space bank to support
 /// its initialization.
 ///
@@ -91,6 +113,9 @@ struct CoyImgHdr {
   oid_t    allocVecOID __attribute__ ((aligned (8)));
   /// @brief End OID for pages of metadata
   oid_t    endVecOID __attribute__ ((aligned (8)));
+
+  /// @brief Number of stored page frames (version 2 and later).
+  uint32_t nFrame;
 };
 typedef struct CoyImgHdr CoyImgHdr;
 